@@ -0,0 +1,29 @@
+/* File: alloc_record.h
+ * --------------------
+ * Raw event format written by the LD_PRELOAD allocation recorder
+ * (alloc_recorder.c) and read by trace_convert -r, which turns the
+ * recorded addresses into script block ids.  A raw file is RAW_MAGIC
+ * followed by raw_event records, grouped per thread and not in time
+ * order; trace_convert sorts them by timestamp.  A realloc is an 'm'
+ * stamped before the call, while old_ptr is still held, and an 'r' from
+ * the same thread stamped after it (with ptr 0 if it failed or freed).
+ */
+
+#ifndef _ALLOC_RECORD_H_
+#define _ALLOC_RECORD_H_
+
+#include <stdint.h>
+
+#define RAW_MAGIC "HMRAW001"
+
+// one intercepted call
+typedef struct {
+    uint64_t time_ns;   // CLOCK_MONOTONIC when the call was recorded
+    uint64_t ptr;       // block returned by a/r, or block passed to f
+    uint64_t old_ptr;   // block passed to m/r
+    uint64_t size;      // requested size for a/r
+    uint32_t tid;       // kernel thread id of the caller
+    uint32_t op;        // 'a', 'm', 'r' or 'f'
+} raw_event;
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * File: alloc_recorder.c
+ * ----------------------
+ * An LD_PRELOAD library that records every malloc, calloc, realloc, free,
+ * memalign, posix_memalign and aligned_alloc call made by a process, so
+ * that real workloads can be replayed by the test harness:
+ *
+ *   ALLOC_RECORD_FILE=server.raw LD_PRELOAD=./liballocrecord.so ./server
+ *   ./trace_convert -r server.raw server.trace
+ *
+ * Each call is appended to a buffer owned by the calling thread, so the
+ * hot path takes no locks.  Full buffers are pushed onto a lock-free
+ * list and written out by a background flusher thread.  Events carry the
+ * caller's thread id and a CLOCK_MONOTONIC timestamp.  Frees are stamped
+ * before the block is released and allocations after it is obtained, so
+ * sorting by time gives an order in which no address is handed out twice
+ * while still live.  A realloc does both, so it is recorded as two events:
+ * an 'm' for the old block before the call and an 'r' for the new one
+ * after it.  trace_convert does that sort and maps addresses to script
+ * block ids.
+ *
+ * Calls made by the recorder itself (and by dlsym while the real
+ * functions are being looked up) are passed through without recording.
+ *
+ * Every process records to a file of its own, since their addresses
+ * overlap.  The first one uses ALLOC_RECORD_FILE as given; processes it
+ * forks or execs, and theirs, add their pid to it (server.raw.<pid>).
+ * A forked child that execs keeps its pid, so the new program takes
+ * over the child's file.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "alloc_record.h"
+
+
+// events per thread buffer (about 1.5 MB)
+#define BUFFER_EVENTS 32768
+
+// how often the flusher thread wakes up to write full buffers
+#define FLUSH_INTERVAL_NS 10000000
+
+// space handed out to dlsym before the real calloc is known
+#define BOOTSTRAP_BYTES 8192
+
+// set by the first recording process, so that processes it execs know
+// they are not the first
+#define OWNER_VAR "ALLOC_RECORD_OWNER"
+
+typedef struct event_buffer {
+    struct event_buffer *next;  // link in the list of full buffers
+    size_t count;
+    raw_event events[BUFFER_EVENTS];
+} event_buffer;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+static char bootstrap[BOOTSTRAP_BYTES] __attribute__((aligned(16)));
+static size_t bootstrap_used;
+static bool resolving;
+
+static __thread bool in_hook;           // set while the recorder itself runs
+static __thread event_buffer *buffer;   // this thread's current buffer
+static __thread uint32_t thread_id;
+
+static event_buffer *full_list;         // lock-free stack of buffers to write
+static pthread_key_t buffer_key;        // flushes a thread's buffer when it exits
+static pthread_t flusher;
+static bool flusher_running;
+static volatile bool stopping;
+static int out_fd = -1;
+
+
+/* Function: resolve_real
+ * ----------------------
+ * Looks up the next definitions of the allocation functions.  dlsym may
+ * itself call calloc, which is served from the bootstrap buffer meanwhile.
+ */
+static void resolve_real(void) {
+    resolving = true;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    resolving = false;
+}
+
+static inline void ensure_resolved(void) {
+    if (real_malloc == NULL && !resolving) {
+        resolve_real();
+    }
+}
+
+static inline bool from_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP_BYTES;
+}
+
+static void *bootstrap_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    if (bootstrap_used + size > BOOTSTRAP_BYTES) {
+        return NULL;
+    }
+    void *p = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return p;   // static storage is already zeroed, as calloc requires
+}
+
+/* Function: write_buffer
+ * ----------------------
+ * Writes a buffer's events to the output file and releases the buffer.
+ */
+static void write_buffer(event_buffer *buf) {
+    const char *data = (const char *)buf->events;
+    size_t remaining = buf->count * sizeof(raw_event);
+    while (out_fd != -1 && remaining > 0) {
+        ssize_t n = write(out_fd, data, remaining);
+        if (n <= 0) {
+            break;
+        }
+        data += n;
+        remaining -= n;
+    }
+    munmap(buf, sizeof(event_buffer));
+}
+
+/* Function: flush_full_buffers
+ * ----------------------------
+ * Takes every buffer on the full list in one atomic exchange and writes
+ * them out.
+ */
+static void flush_full_buffers(void) {
+    event_buffer *list = __atomic_exchange_n(&full_list, NULL, __ATOMIC_ACQUIRE);
+    while (list != NULL) {
+        event_buffer *next = list->next;
+        write_buffer(list);
+        list = next;
+    }
+}
+
+/* Function: push_full
+ * -------------------
+ * Hands a buffer to the flusher by pushing it on the lock-free full list.
+ */
+static void push_full(event_buffer *buf) {
+    buf->next = __atomic_load_n(&full_list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&full_list, &buf->next, buf, true,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Function: release_thread_buffer
+ * -------------------------------
+ * pthread key destructor: queues an exiting thread's partly filled buffer.
+ */
+static void release_thread_buffer(void *arg) {
+    event_buffer *buf = arg;
+    if (buf != NULL && buf == buffer) {
+        buffer = NULL;
+        push_full(buf);
+    }
+}
+
+static void *flusher_main(void *unused) {
+    in_hook = true;     // the flusher's own allocations are never recorded
+    struct timespec interval = { .tv_sec = 0, .tv_nsec = FLUSH_INTERVAL_NS };
+    while (!stopping) {
+        nanosleep(&interval, NULL);
+        flush_full_buffers();
+    }
+    return NULL;
+}
+
+/* Function: record
+ * ----------------
+ * Appends one event to the calling thread's buffer, starting a new buffer
+ * (mapped directly, to stay out of malloc) when there is none.
+ */
+static void record(uint32_t op, void *ptr, void *old_ptr, size_t size) {
+    in_hook = true;
+    if (buffer == NULL) {
+        buffer = mmap(NULL, sizeof(event_buffer), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            buffer = NULL;
+            in_hook = false;
+            return;
+        }
+        if (thread_id == 0) {
+            thread_id = syscall(SYS_gettid);
+        }
+        pthread_setspecific(buffer_key, buffer);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    raw_event *event = &buffer->events[buffer->count++];
+    event->time_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    event->ptr = (uintptr_t)ptr;
+    event->old_ptr = (uintptr_t)old_ptr;
+    event->size = size;
+    event->tid = thread_id;
+    event->op = op;
+
+    if (buffer->count == BUFFER_EVENTS) {
+        push_full(buffer);
+        buffer = NULL;
+        pthread_setspecific(buffer_key, NULL);
+    }
+    in_hook = false;
+}
+
+/* Function: open_output
+ * ---------------------
+ * Opens this process's output file and writes the magic number: the
+ * ALLOC_RECORD_FILE path, with ".<pid>" added unless first is set, or
+ * alloc_record.<pid>.raw if there is none.
+ */
+static void open_output(bool first) {
+    char path[4096];
+    const char *name = getenv("ALLOC_RECORD_FILE");
+    if (name == NULL) {
+        snprintf(path, sizeof(path), "alloc_record.%d.raw", (int)getpid());
+    } else if (first) {
+        snprintf(path, sizeof(path), "%s", name);
+    } else {
+        snprintf(path, sizeof(path), "%s.%d", name, (int)getpid());
+    }
+    out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd != -1 && write(out_fd, RAW_MAGIC, 8) != 8) {
+        close(out_fd);
+        out_fd = -1;
+    }
+}
+
+/* Function: recorder_child
+ * ------------------------
+ * pthread_atfork child handler.  The child's copies of the parent's
+ * buffers are the parent's to write, so they are dropped, and the child
+ * starts over with a file and a flusher thread of its own (only the
+ * forking thread survives a fork).
+ */
+static void recorder_child(void) {
+    in_hook = true;
+    event_buffer *list = __atomic_exchange_n(&full_list, NULL, __ATOMIC_ACQUIRE);
+    while (list != NULL) {
+        event_buffer *next = list->next;
+        munmap(list, sizeof(event_buffer));
+        list = next;
+    }
+    if (buffer != NULL) {
+        munmap(buffer, sizeof(event_buffer));
+        buffer = NULL;
+        pthread_setspecific(buffer_key, NULL);
+    }
+    thread_id = 0;
+    if (out_fd != -1) {
+        close(out_fd);
+    }
+    open_output(false);
+    stopping = false;
+    flusher_running = pthread_create(&flusher, NULL, flusher_main, NULL) == 0;
+    in_hook = false;
+}
+
+/* Function: recorder_start
+ * ------------------------
+ * Opens the output file (see open_output) and starts the flusher thread.
+ * The first recording process marks itself in the environment, so that
+ * the programs it execs, which run this again, pick files of their own.
+ */
+__attribute__((constructor))
+static void recorder_start(void) {
+    in_hook = true;
+    ensure_resolved();
+    pthread_key_create(&buffer_key, release_thread_buffer);
+    pthread_atfork(NULL, NULL, recorder_child);
+
+    bool first = getenv(OWNER_VAR) == NULL;
+    if (first) {
+        char pid[16];
+        snprintf(pid, sizeof(pid), "%d", (int)getpid());
+        setenv(OWNER_VAR, pid, 1);
+    }
+    open_output(first);
+    flusher_running = pthread_create(&flusher, NULL, flusher_main, NULL) == 0;
+    in_hook = false;
+}
+
+/* Function: recorder_stop
+ * -----------------------
+ * At exit, stops the flusher and writes out everything still buffered by
+ * the exiting thread.  Threads still running at exit lose the events in
+ * their current, partly filled buffer.
+ */
+__attribute__((destructor))
+static void recorder_stop(void) {
+    in_hook = true;
+    stopping = true;
+    if (flusher_running) {
+        pthread_join(flusher, NULL);
+    }
+    if (buffer != NULL) {
+        push_full(buffer);
+        buffer = NULL;
+    }
+    flush_full_buffers();
+    if (out_fd != -1) {
+        close(out_fd);
+        out_fd = -1;
+    }
+}
+
+
+/* INTERCEPTED FUNCTIONS */
+
+
+void *malloc(size_t size) {
+    ensure_resolved();
+    if (real_malloc == NULL) {
+        return bootstrap_alloc(size);
+    }
+    void *p = real_malloc(size);
+    if (!in_hook && p != NULL) {
+        record('a', p, NULL, size);
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    ensure_resolved();
+    if (real_calloc == NULL) {
+        return bootstrap_alloc(nmemb * size);
+    }
+    void *p = real_calloc(nmemb, size);
+    if (!in_hook && p != NULL) {
+        record('a', p, NULL, nmemb * size);
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    ensure_resolved();
+    if (from_bootstrap(ptr)) {
+        // never freed; copy out of the bootstrap area into a real block
+        // (no further than the end of what was handed out)
+        size_t old_size = bootstrap + bootstrap_used - (char *)ptr;
+        void *p = malloc(size);
+        if (p != NULL) {
+            memcpy(p, ptr, size < old_size ? size : old_size);
+        }
+        return p;
+    }
+    if (!in_hook && ptr != NULL) {
+        record('m', NULL, ptr, 0);
+    }
+    void *p = real_realloc(ptr, size);
+    if (!in_hook && (p != NULL || ptr != NULL)) {
+        record('r', p, ptr, size);
+    }
+    return p;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || from_bootstrap(ptr)) {
+        return;
+    }
+    ensure_resolved();
+    if (!in_hook) {
+        record('f', ptr, NULL, 0);
+    }
+    real_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    ensure_resolved();
+    void *p = real_memalign(alignment, size);
+    if (!in_hook && p != NULL) {
+        record('a', p, NULL, size);
+    }
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    ensure_resolved();
+    int result = real_posix_memalign(memptr, alignment, size);
+    if (!in_hook && result == 0) {
+        record('a', *memptr, NULL, size);
+    }
+    return result;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    ensure_resolved();
+    void *p = real_aligned_alloc(alignment, size);
+    if (!in_hook && p != NULL) {
+        record('a', p, NULL, size);
+    }
+    return p;
+}
@@ -2,18 +2,102 @@
  * -----------------
  * Interface file for the custom heap allocator.
  */
-#ifndef _ALLOCATOR_H
-#define _ALLOCATOR_H
+#ifndef _ALLOCATOR_H_
+#define _ALLOCATOR_H_
 
 #include <stdbool.h> // for bool
 #include <stddef.h>  // for size_t
+#include <stdio.h>   // for FILE
 
-// Alignment requirement for all blocks
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Alignment requirement for all blocks.  Set at build time with
+// `make ALIGN=16` (or 32, 64); run `make clean` first when changing it
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
+
+// Cache line size assumed by MALLOC_CACHE_ALIGN
+#define CACHE_LINE_SIZE 64
+
+#if ALIGNMENT < 8 || ALIGNMENT > CACHE_LINE_SIZE || (ALIGNMENT & (ALIGNMENT - 1)) != 0
+#error "ALIGNMENT must be a power of two from 8 to 64"
+#endif
+
+// Hints for mymalloc_hint
+#define MALLOC_CACHE_ALIGN 0x1  // start the payload on a cache line boundary
+#define MALLOC_SHORT_LIVED 0x2  // will be freed soon: place it with other short-lived blocks
+#define MALLOC_LONG_LIVED 0x4   // will live long: keep it away from short-lived blocks
+
+// Parameters for mymallopt
+typedef enum {
+    MALLOPT_QUICK_MAX = 1,      // largest payload kept on a quick list (0 turns them off)
+    MALLOPT_QUICK_LIMIT,        // blocks held on quick lists before they are all flushed
+    MALLOPT_REALLOC_GROWTH,     // percent of its size a block grown again by myrealloc may take
+    MALLOPT_LIFETIME,           // lifetime segregation: 0 off, 1 hints only (default), 2 hints and predictor
+    MALLOPT_MAINTENANCE_US,     // microseconds between background mymaintain calls, 0 for none (thread-safe builds)
+    MALLOPT_FREE_ORDER,         // free list order: 0 newest first (default), 1 lowest address first
+} mallopt_param;
+
+// range of values MALLOPT_QUICK_LIMIT accepts
+#define MALLOPT_QUICK_LIMIT_MIN 1
+#define MALLOPT_QUICK_LIMIT_MAX 4096
 
 // maximum size of block that must be accommodated
 #define MAX_REQUEST_SIZE (1 << 30)
 
+// How much checking validate_heap_level does, from cheapest to most thorough
+typedef enum {
+    VALIDATE_NONE,          // no checks at all
+    VALIDATE_CHEAP,         // constant-time checks of the allocator's bookkeeping
+    VALIDATE_INCREMENTAL,   // recently touched blocks plus a rolling window of the rest
+    VALIDATE_FULL,          // walk every block (same as validate_heap)
+} validate_level;
+
+// Requests are counted in power-of-two size classes: class k holds sizes
+// in [2^k, 2^(k+1)), and sizes 0 and 1 are both in class 0
+#define STATS_SIZE_CLASSES 32
+
+// Counters reported by mystats
+typedef struct {
+    size_t bytes_in_use;        // payload bytes in allocated blocks
+    size_t bytes_free;          // payload bytes in free blocks
+    size_t free_blocks;         // number of free blocks
+    size_t largest_free;        // payload bytes in the largest free block
+    unsigned long allocs[STATS_SIZE_CLASSES];  // mymalloc calls by requested size
+    unsigned long frees[STATS_SIZE_CLASSES];   // myfree calls by block payload size
+    unsigned long realloc_in_place;     // myrealloc calls that kept the block
+    unsigned long realloc_copied;       // myrealloc calls that moved the block
+    size_t realloc_bytes_copied;        // bytes copied by those moves
+    size_t slack_reclaimed;     // realloc headroom taken back because the heap was full
+    unsigned long searches;     // mymalloc calls that searched for a block
+    unsigned long search_steps; // blocks examined during those searches
+    unsigned long quick_hits;   // mymalloc calls served from a quick list
+    unsigned long quick_flushes;        // times the quick lists were emptied
+    size_t quick_blocks;        // freed blocks held on quick lists (in neither total above)
+    size_t bytes_compacted;     // payload bytes moved by mycompact
+    unsigned long nursery_allocs;       // requests placed in the short-lived nursery
+    unsigned long nursery_chunks_freed; // nursery chunks given back once all their objects were freed
+    unsigned long maintenance_passes;   // mymaintain calls, including the maintenance thread's
+    unsigned long blocks_merged;        // free blocks mymaintain merged into the free block before them
+    size_t bytes_purged;        // bytes of free pages mymaintain gave back to the OS, each counted once until reused
+    unsigned long segments_added;       // segments the heap took on with myextend
+} heap_stats;
+
+// A function the allocator calls when the heap is full (see mygrow_hook).
+// It should reserve a new segment of at least min_size bytes, store its
+// actual size in *size and return its start, or return NULL.
+typedef void *(*heap_grow_fn)(size_t min_size, size_t *size);
+
+/* Function: stats_size_class
+ * --------------------------
+ * Returns the size class that mystats counts a request of this size in.
+ */
+static inline int stats_size_class(size_t size) {
+    return size < 2 ? 0 : (int)(sizeof(size_t) * 8 - 1 - __builtin_clzl(size));
+}
 
 
 /* Function: myinit
@@ -27,6 +111,59 @@
  */
 bool myinit(void *heap_start, size_t heap_size);
 
+
+/* Function: myattach
+ * ------------------
+ * Resumes a heap that an earlier process built in the same segment (see
+ * open_heap_segment), instead of emptying it like myinit.  After a clean
+ * mydetach this takes constant time; otherwise the heap is checked and
+ * its bookkeeping rebuilt block by block.  Returns false if the segment
+ * does not hold a usable heap, in which case call myinit.
+ */
+bool myattach(void *heap_start, size_t heap_size);
+
+
+/* Function: mydetach
+ * ------------------
+ * Saves the allocator's state inside the heap so that the next myattach
+ * can resume it quickly.  Call it last, before exiting; the heap must not
+ * be used again until it is attached.
+ */
+void mydetach(void);
+
+
+/* Function: myextend
+ * -------------------
+ * Adds the memory from start to start + size to the heap as a segment of
+ * its own, so the heap can grow past the range given to myinit without
+ * moving anything (see add_heap_segment).  Blocks never span two
+ * segments.  The segments added are forgotten by the next myinit, and
+ * do not persist: a heap that has been extended is recovered from its
+ * first segment alone by myattach.  Returns false if the allocator cannot
+ * take on more memory, or the range is too small or overlaps the heap.
+ */
+bool myextend(void *start, size_t size);
+
+
+/* Function: mygrow_hook
+ * ---------------------
+ * Sets the function the allocator calls for another segment when no free
+ * block fits a request (NULL for none, the default), passing whatever it
+ * returns to myextend.  The hook lasts across myinit, and is called with
+ * the heap lock held in thread-safe builds.
+ */
+void mygrow_hook(heap_grow_fn grow);
+
+
+/* Function: myroot
+ * ----------------
+ * Returns the address of a pointer-sized slot kept in the heap's own
+ * metadata, for a persistent heap's client to find its data again after
+ * myattach.  It is NULL after myinit.  Returns NULL if the allocator
+ * cannot persist its heap.
+ */
+void **myroot(void);
+
 /* Function: mymalloc
  * ------------------
  * Custom version of malloc.
@@ -34,6 +171,20 @@ bool myinit(void *heap_start, size_t heap_size);
 void *mymalloc(size_t requested_size);
 
 
+/* Function: mymalloc_hint
+ * -----------------------
+ * Like mymalloc, but with placement hints (MALLOC_* flags above).  With
+ * MALLOC_CACHE_ALIGN the payload starts on a cache line boundary, so an
+ * object of up to CACHE_LINE_SIZE bytes sits in a single line and does
+ * not share its first line with the previous block.  MALLOC_SHORT_LIVED
+ * and MALLOC_LONG_LIVED say how long the block will be kept, so that
+ * short-lived blocks can be packed together, away from long-lived ones
+ * (see MALLOPT_LIFETIME).  Allocators may ignore the lifetime hints, but
+ * not MALLOC_CACHE_ALIGN: myaligned_alloc in allocator.hpp relies on it.
+ */
+void *mymalloc_hint(size_t requested_size, unsigned hints);
+
+
 /* Function: myrealloc
  * -------------------
  * Custom version of realloc.
@@ -57,4 +208,76 @@ void myfree(void *ptr);
  */
 bool validate_heap();
 
+
+/* Function: validate_heap_level
+ * -----------------------------
+ * Like validate_heap, but does only as much checking as the given level
+ * asks for, so that validation can stay on during long runs.  Incremental
+ * checks cover the blocks touched since the previous check and advance
+ * a window over the rest of the heap, so repeated calls eventually visit
+ * every block.
+ */
+bool validate_heap_level(validate_level level);
+
+
+/* Function: mymallopt
+ * -------------------
+ * Sets one of the allocator's tuning parameters (see mallopt_param).  The
+ * setting lasts across myinit.  Returns false if the allocator has no such
+ * parameter or the value is out of range.
+ */
+bool mymallopt(mallopt_param param, long value);
+
+
+/* Function: mycompact
+ * --------------------
+ * One step of incremental heap compaction: slides allocated blocks toward
+ * the start of the heap so that free space collects at the end.  A block
+ * is only moved if can_move(payload) returns true, and moved(old, new) is
+ * called after each move so the owner can update its references (see
+ * handles.h).  Each call carries on where the last one stopped and returns
+ * after moving about budget payload bytes or reaching the end of the heap.
+ * Returns the number of bytes moved, 0 if the allocator cannot compact.
+ */
+size_t mycompact(size_t budget, bool (*can_move)(void *payload),
+    void (*moved)(void *old_payload, void *new_payload));
+
+
+/* Function: mymaintain
+ * ---------------------
+ * Does a bounded amount of the housekeeping that requests would otherwise
+ * do inline, such as merging neighbouring free blocks and giving the pages
+ * of large free blocks back to the OS.  Each call carries on where the
+ * last one stopped.  A thread-safe build can call it from a background
+ * thread of its own (see MALLOPT_MAINTENANCE_US), which must be stopped
+ * before the heap's memory is unmapped; anyone may call it between
+ * requests.  Does nothing in allocators with nothing
+ * to tidy.
+ */
+void mymaintain(void);
+
+
+/* Function: mystats
+ * -----------------
+ * Fills in stats with the allocator's counters since the last myinit.
+ * The counters are kept up to date as requests are made; the byte and
+ * free block totals are worked out from the heap when this is called.
+ * mymalloc and myfree calls made by myrealloc are counted too.
+ */
+void mystats(heap_stats *stats);
+
+
+/* Function: mysnapshot
+ * --------------------
+ * Appends a binary map of every block in the heap (offset, size and
+ * whether it is allocated) to out in a single pass, in the format described
+ * in heapmap.h.  The tag is stored with the snapshot so the heapmap tool
+ * can say when it was taken.  Returns false if writing failed.
+ */
+bool mysnapshot(FILE *out, unsigned long tag);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,178 @@
+/* File: allocator.hpp
+ * -------------------
+ * C++ adapters for the allocator in allocator.h: my_allocator<T>, an
+ * allocator for the standard containers, and my_memory_resource, a
+ * std::pmr::memory_resource for the pmr containers.
+ *
+ *   std::vector<int, my_allocator<int>> v;
+ *   std::pmr::map<int, int> m(my_resource());
+ *
+ * Both take the heap as it is; call myinit first.  Every my_allocator and
+ * every my_memory_resource draws on the same heap, so they all compare
+ * equal and memory allocated through one may be freed through another.
+ * Alignments above ALIGNMENT are met by over-allocating (see
+ * myaligned_alloc), which is why deallocation needs the alignment, though
+ * never the size.
+ */
+
+#ifndef _ALLOCATOR_HPP_
+#define _ALLOCATOR_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include "allocator.h"
+
+
+/* Function: myaligned_alloc
+ * -------------------------
+ * Returns size bytes aligned to align (a power of 2), or NULL if the heap
+ * is full.  Cache line alignment uses mymalloc_hint, which must honour
+ * MALLOC_CACHE_ALIGN.  Larger alignments
+ * allocate align extra bytes and keep the address mymalloc returned just
+ * below the aligned block, for myaligned_free.  A size of 0 is treated as
+ * 1, since callers expect a unique non-NULL pointer.
+ */
+inline void *myaligned_alloc(size_t size, size_t align) {
+    if (size == 0) {
+        size = 1;
+    }
+    if (align <= ALIGNMENT) {
+        return mymalloc(size);
+    }
+    if (align == CACHE_LINE_SIZE) {
+        void *p = mymalloc_hint(size, MALLOC_CACHE_ALIGN);
+        assert(((uintptr_t)p & (CACHE_LINE_SIZE - 1)) == 0);
+        return p;
+    }
+    if (size > SIZE_MAX - align) {
+        return nullptr;
+    }
+    void *raw = mymalloc(size + align);
+    if (raw == nullptr) {
+        return nullptr;
+    }
+    // always moves up by at least align bytes, leaving room for raw
+    void *aligned = (void *)(((uintptr_t)raw + align) & ~(uintptr_t)(align - 1));
+    ((void **)aligned)[-1] = raw;
+    return aligned;
+}
+
+/* Function: myaligned_free
+ * ------------------------
+ * Frees a block from myaligned_alloc, given the same alignment.
+ */
+inline void myaligned_free(void *ptr, size_t align) {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (align <= ALIGNMENT || align == CACHE_LINE_SIZE) {
+        myfree(ptr);
+    } else {
+        myfree(((void **)ptr)[-1]);
+    }
+}
+
+
+/* Class: my_allocator
+ * -------------------
+ * A standard allocator over mymalloc and myfree.  allocate throws
+ * std::bad_alloc when the heap is full.  reallocate is an extension for
+ * containers of trivially copyable types that manage their own storage:
+ * it resizes an array with myrealloc, which can often do it in place.
+ */
+template <typename T>
+struct my_allocator {
+    using value_type = T;
+
+    my_allocator() noexcept = default;
+    template <typename U>
+    my_allocator(const my_allocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void *p = myaligned_alloc(n * sizeof(T), alignof(T));
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        myaligned_free(p, alignof(T));
+    }
+
+    T *reallocate(T *p, size_t old_n, size_t new_n) {
+        static_assert(std::is_trivially_copyable<T>::value,
+            "reallocate moves elements with myrealloc");
+        if (new_n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        if (alignof(T) > ALIGNMENT) {
+            T *grown = allocate(new_n);
+            if (p != nullptr) {
+                memcpy(grown, p, (old_n < new_n ? old_n : new_n) * sizeof(T));
+                deallocate(p, old_n);
+            }
+            return grown;
+        }
+        void *grown = myrealloc(p, new_n ? new_n * sizeof(T) : 1);
+        if (grown == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(grown);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const my_allocator<T> &, const my_allocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const my_allocator<T> &, const my_allocator<U> &) noexcept {
+    return false;
+}
+
+
+/* Class: my_memory_resource
+ * -------------------------
+ * A memory resource over myaligned_alloc and myaligned_free, throwing
+ * std::bad_alloc when the heap is full.  Any two compare equal.
+ */
+class my_memory_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(size_t bytes, size_t align) override {
+        void *p = myaligned_alloc(bytes, align);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        myaligned_free(p, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const my_memory_resource *>(&other) != nullptr;
+    }
+};
+
+/* Function: my_resource
+ * ---------------------
+ * Returns a my_memory_resource that lives as long as the program, to pass
+ * to pmr containers or std::pmr::set_default_resource.
+ */
+inline my_memory_resource *my_resource() {
+    static my_memory_resource resource;
+    return &resource;
+}
+
+#endif
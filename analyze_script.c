@@ -0,0 +1,594 @@
+/*
+ * File: analyze_script.c
+ * ----------------------
+ * Offline workload analyzer for allocator scripts.  Reads a script (text,
+ * binary trace or "-" for text on stdin) in a single pass and prints what
+ * the workload looks like: the request size histogram, how many requests
+ * each block lives for, how reallocs grow blocks, the peak live bytes and
+ * the order blocks are freed in.  It then suggests settings for the
+ * allocators in this repo: size class boundaries, quick list settings
+ * (-o quick_max, -o quick_limit), realloc headroom (-o realloc_growth) and
+ * a threshold above which requests are better served separately.
+ *
+ *   ./analyze_script samples/trace-firefox.script
+ *   ./gen_script -n 1000000 | ./analyze_script -
+ *
+ * Text scripts are read a line at a time rather than with parse_script,
+ * which keeps every request, and binary traces are decoded straight from
+ * their mapping, so memory grows with the number of block ids, not the
+ * number of requests.
+ */
+
+#include <error.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "script.h"
+
+
+// requests up to this size get a count of their own in the size histogram,
+// one for each multiple of ALIGNMENT (the largest quick list size, see
+// MALLOPT_QUICK_MAX)
+#define SMALL_MAX 1024
+#define SMALL_SIZES (SMALL_MAX / ALIGNMENT + 1)
+
+// lifetime histogram buckets are powers of two requests
+#define LIFETIME_BUCKETS 32
+
+// requests a block lives for that count as short-lived
+#define SHORT_LIFE 64
+
+// suggested size classes split the small requests into this many parts
+#define SIZE_CLASSES 8
+
+// share of small frees the suggested quick_max covers, in percent
+#define QUICK_COVERAGE 90
+
+// smallest request considered for the huge threshold, and the most (in
+// percent of requests) and fewest (in percent of bytes) requests above it
+#define HUGE_MIN 4096
+#define HUGE_MAX_REQUESTS 1
+#define HUGE_MIN_BYTES 10
+
+// realloc growth ratios, as percentages of the old size: a realloc falls
+// in the first bucket whose bound is at least its ratio
+static const unsigned growth_bounds[] = {100, 125, 150, 200, 400, ~0u};
+#define GROWTH_BUCKETS (sizeof(growth_bounds) / sizeof(growth_bounds[0]))
+
+// what is known about one block id
+typedef struct {
+    size_t size;        // requested size, 0 if not live
+    long born;          // request index of its alloc
+    long seq;           // its alloc's number among all allocs
+    int reallocs;       // times it has been realloc'ed
+    bool live;
+} block_info;
+
+// everything gathered in the pass over the script
+typedef struct {
+    block_info *blocks;         // indexed by block id
+    int nblocks;                // entries in blocks
+    int num_ids;                // largest block id seen, plus one
+    long nops;
+    long nallocs;
+    long nfrees;
+    long nreallocs;
+    unsigned long class_counts[STATS_SIZE_CLASSES];    // allocs and reallocs by requested size
+    size_t class_bytes[STATS_SIZE_CLASSES];
+    unsigned long small_counts[SMALL_SIZES];    // the same by size, rounded up to ALIGNMENT
+    unsigned long small_frees[SMALL_SIZES];     // frees by the freed block's size
+    unsigned long lifetimes[LIFETIME_BUCKETS];  // frees by requests the block lived for
+    unsigned long short_frees[STATS_SIZE_CLASSES];  // frees after fewer than SHORT_LIFE requests
+    unsigned long class_frees[STATS_SIZE_CLASSES];
+    unsigned long growth[GROWTH_BUCKETS];       // reallocs by new size as a percent of old
+    unsigned long repeat_growth[GROWTH_BUCKETS];    // those of blocks grown before
+    int most_reallocs;          // most reallocs of one block
+    size_t live_bytes;
+    size_t peak_bytes;
+    long live_blocks;
+    long peak_blocks;
+    long peak_op;               // request index where live_bytes peaked
+    long last_seq;              // seq of the latest alloc
+    long prev_free_seq;         // seq of the latest freed block, -2 if none
+    long in_order;              // frees of the block allocated right after the last one freed
+    long reverse_order;         // ... right before
+    long newest;                // frees of the latest alloc
+    long burst;                 // frees since the last alloc or realloc
+    unsigned long bursts[LIFETIME_BUCKETS];     // frees by the length of their run of frees
+} analysis;
+
+
+static void analyze_file(const char *path, analysis *an);
+static void analyze_request(analysis *an, const request_t *request);
+static block_info *lookup_block(analysis *an, int id);
+static void add_live(analysis *an, size_t size, long index);
+static void end_burst(analysis *an);
+static int log2_bucket(unsigned long n);
+static size_t small_index(size_t size);
+static void print_analysis(const char *name, const analysis *an);
+static void print_sizes(const analysis *an);
+static void print_lifetimes(const analysis *an);
+static void print_reallocs(const analysis *an);
+static void print_locality(const analysis *an);
+static void print_suggestions(const analysis *an);
+static double percent(double part, double whole);
+
+
+/* Function: main
+ * --------------
+ * Analyzes each script named on the command line in turn.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        error(1, 0, "Usage: %s script...", argv[0]);
+    }
+    for (int i = 1; i < argc; i++) {
+        analysis an;
+        memset(&an, 0, sizeof(an));
+        an.prev_free_seq = -2;
+        analyze_file(argv[i], &an);
+        end_burst(&an);
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        print_analysis(strcmp(argv[i], "-") == 0 ? "stdin" : name, &an);
+        free(an.blocks);
+    }
+    return 0;
+}
+
+/* Function: analyze_file
+ * ----------------------
+ * Feeds every request of the script at path to analyze_request.  Binary
+ * traces are opened with parse_script, which maps them without decoding;
+ * text is read one line at a time, skipping blank lines and # comments.
+ */
+static void analyze_file(const char *path, analysis *an) {
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+    char magic[sizeof(((trace_header *)0)->magic)];
+    if (fp != stdin && fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+        memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+        fclose(fp);
+        script_t script = parse_script(path);
+        script_cursor cursor = script_begin(&script);
+        request_t request;
+        while (script_next(&script, &cursor, &request)) {
+            analyze_request(an, &request);
+        }
+        free_script(&script);
+        return;
+    }
+    if (fp != stdin) {
+        rewind(fp);
+    }
+
+    char buffer[1024];
+    int lineno = 0;
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        lineno++;
+        char *start = buffer + strspn(buffer, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0') {
+            continue;
+        }
+        request_t request = parse_script_line(buffer, lineno, (char *)path);
+        analyze_request(an, &request);
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+}
+
+/* Function: analyze_request
+ * -------------------------
+ * Updates the analysis with one request.
+ */
+static void analyze_request(analysis *an, const request_t *request) {
+    long index = an->nops++;
+    block_info *block = lookup_block(an, request->id);
+    if (request->id >= an->num_ids) {
+        an->num_ids = request->id + 1;
+    }
+    if (request->op == ALLOC) {
+        end_burst(an);
+        an->nallocs++;
+        int class = stats_size_class(request->size);
+        an->class_counts[class]++;
+        an->class_bytes[class] += request->size;
+        if (request->size <= SMALL_MAX) {
+            an->small_counts[small_index(request->size)]++;
+        }
+        *block = (block_info) {.size = request->size, .born = index, .seq = an->last_seq + 1,
+            .reallocs = 0, .live = true};
+        an->last_seq++;
+        an->live_blocks++;
+        add_live(an, request->size, index);
+    } else if (request->op == REALLOC) {
+        end_burst(an);
+        an->nreallocs++;
+        int class = stats_size_class(request->size);
+        an->class_counts[class]++;
+        an->class_bytes[class] += request->size;
+        if (request->size <= SMALL_MAX) {
+            an->small_counts[small_index(request->size)]++;
+        }
+        size_t old_size = block->live ? block->size : 0;
+        if (old_size > 0) {
+            unsigned long ratio = 100 * request->size / old_size;
+            size_t bucket = 0;
+            while (ratio > growth_bounds[bucket]) {
+                bucket++;
+            }
+            an->growth[bucket]++;
+            if (block->reallocs > 0 && request->size > old_size) {
+                an->repeat_growth[bucket]++;
+            }
+        }
+        if (!block->live) {  // a realloc of nothing is an alloc
+            *block = (block_info) {.born = index, .seq = ++an->last_seq, .live = true};
+            an->live_blocks++;
+        }
+        if (++block->reallocs > an->most_reallocs) {
+            an->most_reallocs = block->reallocs;
+        }
+        an->live_bytes -= old_size;
+        block->size = request->size;
+        add_live(an, request->size, index);
+    } else if (request->op == FREE && block->live) {
+        an->nfrees++;
+        an->burst++;
+        int class = stats_size_class(block->size);
+        long life = index - block->born;
+        an->lifetimes[log2_bucket(life)]++;
+        an->class_frees[class]++;
+        if (life < SHORT_LIFE) {
+            an->short_frees[class]++;
+        }
+        if (block->size <= SMALL_MAX) {
+            an->small_frees[small_index(block->size)]++;
+        }
+        if (block->seq == an->prev_free_seq + 1) {
+            an->in_order++;
+        } else if (block->seq == an->prev_free_seq - 1) {
+            an->reverse_order++;
+        }
+        if (block->seq == an->last_seq) {
+            an->newest++;
+        }
+        an->prev_free_seq = block->seq;
+        an->live_bytes -= block->size;
+        an->live_blocks--;
+        block->live = false;
+        block->size = 0;
+    }
+}
+
+/* Function: lookup_block
+ * ----------------------
+ * Returns the entry for a block id, growing the table to hold it.
+ */
+static block_info *lookup_block(analysis *an, int id) {
+    if (id >= an->nblocks) {
+        int n = an->nblocks ? an->nblocks : 1024;
+        while (n <= id) {
+            n *= 2;
+        }
+        an->blocks = realloc(an->blocks, n * sizeof(block_info));
+        if (an->blocks == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        memset(an->blocks + an->nblocks, 0, (n - an->nblocks) * sizeof(block_info));
+        an->nblocks = n;
+    }
+    return &an->blocks[id];
+}
+
+/* Function: add_live
+ * ------------------
+ * Adds size bytes to the live total and notes a new peak.
+ */
+static void add_live(analysis *an, size_t size, long index) {
+    an->live_bytes += size;
+    if (an->live_bytes > an->peak_bytes) {
+        an->peak_bytes = an->live_bytes;
+        an->peak_blocks = an->live_blocks;
+        an->peak_op = index;
+    }
+}
+
+/* Function: end_burst
+ * -------------------
+ * Records the run of frees that an alloc or realloc (or the end of the
+ * script) has just ended, weighted by its length.
+ */
+static void end_burst(analysis *an) {
+    if (an->burst > 0) {
+        an->bursts[log2_bucket(an->burst)] += an->burst;
+        an->burst = 0;
+    }
+}
+
+/* Function: log2_bucket
+ * ---------------------
+ * Returns the power-of-two bucket n falls in: 0 for 0 and 1, then
+ * bucket b for 2^(b-1) < n <= 2^b.
+ */
+static int log2_bucket(unsigned long n) {
+    int bucket = 0;
+    while (bucket < LIFETIME_BUCKETS - 1 && (1UL << bucket) < n) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/* Function: small_index
+ * ---------------------
+ * Returns the small size histogram entry for a request of at most
+ * SMALL_MAX bytes: its size rounded up to a multiple of ALIGNMENT, in
+ * units of ALIGNMENT.
+ */
+static size_t small_index(size_t size) {
+    return (size + ALIGNMENT - 1) / ALIGNMENT;
+}
+
+static double percent(double part, double whole) {
+    return whole > 0 ? 100 * part / whole : 0;
+}
+
+
+/* REPORT */
+
+
+/* Function: print_analysis
+ * ------------------------
+ * Prints every section of the report for one script.
+ */
+static void print_analysis(const char *name, const analysis *an) {
+    printf("%s: %ld requests (%ld allocs, %ld reallocs, %ld frees), %d block ids\n",
+        name, an->nops, an->nallocs, an->nreallocs, an->nfrees, an->num_ids);
+    printf("peak live: %zu bytes in %ld blocks, at request %ld\n",
+        an->peak_bytes, an->peak_blocks, an->peak_op + 1);
+    print_sizes(an);
+    print_lifetimes(an);
+    print_reallocs(an);
+    print_locality(an);
+    print_suggestions(an);
+    printf("\n");
+}
+
+/* Function: print_sizes
+ * ---------------------
+ * Prints the requests and bytes in each power-of-two size class, and the
+ * sizes requested most often.
+ */
+static void print_sizes(const analysis *an) {
+    double nrequests = an->nallocs + an->nreallocs;
+    size_t total_bytes = 0;
+    for (int i = 0; i < STATS_SIZE_CLASSES; i++) {
+        total_bytes += an->class_bytes[i];
+    }
+    printf("\nrequest sizes (allocs and reallocs)\n");
+    printf("  %-22s %10s %8s %8s %10s\n", "size class", "requests", "%", "% bytes", "short-lived");
+    for (int i = 0; i < STATS_SIZE_CLASSES; i++) {
+        if (an->class_counts[i] == 0) {
+            continue;
+        }
+        char range[32];
+        snprintf(range, sizeof(range), "%lu-%lu", i == 0 ? 0UL : 1UL << i, (2UL << i) - 1);
+        char short_lived[16] = "-";
+        if (an->class_frees[i] > 0) {
+            snprintf(short_lived, sizeof(short_lived), "%.0f%%",
+                percent(an->short_frees[i], an->class_frees[i]));
+        }
+        printf("  %-22s %10lu %7.1f%% %7.1f%% %10s\n", range, an->class_counts[i],
+            percent(an->class_counts[i], nrequests), percent(an->class_bytes[i], total_bytes),
+            short_lived);
+    }
+
+    printf("  most requested sizes (rounded up to %d):", ALIGNMENT);
+    bool shown[SMALL_SIZES] = {false};
+    for (int n = 0; n < 8; n++) {
+        int best = -1;
+        for (int i = 0; i < SMALL_SIZES; i++) {
+            if (!shown[i] && an->small_counts[i] > 0 &&
+                (best == -1 || an->small_counts[i] > an->small_counts[best])) {
+                best = i;
+            }
+        }
+        if (best == -1) {
+            break;
+        }
+        shown[best] = true;
+        printf(" %d (%.1f%%)", best * ALIGNMENT, percent(an->small_counts[best], nrequests));
+    }
+    printf("\n");
+}
+
+/* Function: print_lifetimes
+ * -------------------------
+ * Prints how many requests freed blocks lived for, as a cumulative
+ * distribution over power-of-two buckets.
+ */
+static void print_lifetimes(const analysis *an) {
+    printf("\nlifetimes (requests from alloc to free)\n");
+    unsigned long seen = 0;
+    for (int i = 0; i < LIFETIME_BUCKETS; i++) {
+        if (an->lifetimes[i] == 0) {
+            continue;
+        }
+        seen += an->lifetimes[i];
+        printf("  <= %-10lu %10lu %7.1f%%  (%.1f%% cumulative)\n", 1UL << i,
+            an->lifetimes[i], percent(an->lifetimes[i], an->nfrees), percent(seen, an->nfrees));
+    }
+    printf("  never freed: %ld blocks\n", an->live_blocks);
+}
+
+/* Function: print_reallocs
+ * ------------------------
+ * Prints how reallocs change block sizes, overall and for blocks that
+ * had already been realloc'ed.
+ */
+static void print_reallocs(const analysis *an) {
+    if (an->nreallocs == 0) {
+        return;
+    }
+    printf("\nreallocs (new size as a percent of old)\n");
+    printf("  %-14s %10s %14s\n", "ratio", "reallocs", "repeat growth");
+    unsigned lower = 0;
+    for (size_t i = 0; i < GROWTH_BUCKETS; i++) {
+        char range[32];
+        if (i == 0) {
+            snprintf(range, sizeof(range), "<= %u%%", growth_bounds[i]);
+        } else if (growth_bounds[i] == ~0u) {
+            snprintf(range, sizeof(range), "> %u%%", lower);
+        } else {
+            snprintf(range, sizeof(range), "%u-%u%%", lower, growth_bounds[i]);
+        }
+        lower = growth_bounds[i];
+        printf("  %-14s %10lu %14lu\n", range, an->growth[i], an->repeat_growth[i]);
+    }
+    printf("  most reallocs of one block: %d\n", an->most_reallocs);
+}
+
+/* Function: print_locality
+ * ------------------------
+ * Prints how closely the order of frees follows the order of allocation,
+ * and how frees are grouped into runs.
+ */
+static void print_locality(const analysis *an) {
+    printf("\nfree order\n");
+    printf("  frees of the block allocated just after the one freed before: %.1f%%\n",
+        percent(an->in_order, an->nfrees));
+    printf("  frees of the block allocated just before it: %.1f%%\n",
+        percent(an->reverse_order, an->nfrees));
+    printf("  frees of the most recent allocation: %.1f%%\n", percent(an->newest, an->nfrees));
+    printf("  frees in runs of (weighted by run length):");
+    for (int i = 0; i < LIFETIME_BUCKETS; i++) {
+        if (an->bursts[i] > 0) {
+            printf(" <=%lu %.0f%%", 1UL << i, percent(an->bursts[i], an->nfrees));
+        }
+    }
+    printf("\n");
+}
+
+/* Function: print_suggestions
+ * ---------------------------
+ * Works out and prints the suggested settings:
+ *  - size class boundaries that split the requests of up to SMALL_MAX
+ *    bytes into SIZE_CLASSES parts of about equal count
+ *  - quick_max: the smallest size that QUICK_COVERAGE percent of the frees
+ *    of small blocks are at or below
+ *  - quick_limit: the run of frees (rounded up to a power of two) that 90%
+ *    of frees happen in runs no longer than, so held blocks are flushed
+ *    about once per run
+ *  - realloc_growth: enough headroom for the next step of 90% of the
+ *    growth of blocks that grow more than once (at least 125%, at most
+ *    400%), or 100 (no headroom) if few do
+ *  - a huge threshold: the smallest power of two from HUGE_MIN up whose
+ *    requests are at most HUGE_MAX_REQUESTS percent of all requests but at
+ *    least HUGE_MIN_BYTES percent of the bytes
+ */
+static void print_suggestions(const analysis *an) {
+    printf("\nsuggestions\n");
+
+    unsigned long nsmall = 0;
+    for (int i = 0; i < SMALL_SIZES; i++) {
+        nsmall += an->small_counts[i];
+    }
+    if (nsmall > 0) {
+        printf("  size class boundaries:");
+        unsigned long seen = 0;
+        int part = 1;
+        for (int i = 0; i < SMALL_SIZES && part <= SIZE_CLASSES; i++) {
+            seen += an->small_counts[i];
+            if (seen * SIZE_CLASSES >= part * nsmall) {
+                printf(" %d", i * ALIGNMENT);
+                while (part <= SIZE_CLASSES && seen * SIZE_CLASSES >= part * nsmall) {
+                    part++;
+                }
+            }
+        }
+        printf(" (requests up to %d bytes, %.0f%% of all)\n", SMALL_MAX,
+            percent(nsmall, an->nallocs + an->nreallocs));
+    }
+
+    unsigned long nsmall_frees = 0;
+    for (int i = 0; i < SMALL_SIZES; i++) {
+        nsmall_frees += an->small_frees[i];
+    }
+    if (nsmall_frees > 0) {
+        unsigned long seen = 0;
+        int quick_max = 0;
+        while (seen * 100 < nsmall_frees * QUICK_COVERAGE) {
+            seen += an->small_frees[quick_max++];
+        }
+        unsigned long bursts_seen = 0;
+        int bucket = 0;
+        while (bucket < LIFETIME_BUCKETS - 1 && bursts_seen * 10 < an->nfrees * 9) {
+            bursts_seen += an->bursts[bucket++];
+        }
+        long quick_limit = 1L << (bucket > 0 ? bucket - 1 : 0);
+        quick_limit = quick_limit < MALLOPT_QUICK_LIMIT_MIN ? MALLOPT_QUICK_LIMIT_MIN
+                    : quick_limit > MALLOPT_QUICK_LIMIT_MAX ? MALLOPT_QUICK_LIMIT_MAX : quick_limit;
+        printf("  quick lists: -o quick_max=%d -o quick_limit=%ld "
+            "(%d%% of frees of up to %d bytes fit, 90%% of frees come in runs of <= %ld)\n",
+            (quick_max - 1) * ALIGNMENT, quick_limit, QUICK_COVERAGE, SMALL_MAX,
+            1L << (bucket > 0 ? bucket - 1 : 0));
+    }
+
+    unsigned long nrepeat = 0;
+    for (size_t i = 0; i < GROWTH_BUCKETS; i++) {
+        nrepeat += an->repeat_growth[i];
+    }
+    if (an->nreallocs > 0) {
+        unsigned growth = 100;
+        if (nrepeat * 10 >= (unsigned long)an->nreallocs) {
+            unsigned long seen = 0;
+            size_t i = 0;
+            while (seen * 10 < nrepeat * 9) {
+                seen += an->repeat_growth[i++];
+            }
+            growth = growth_bounds[i - 1] < 125 ? 125
+                   : growth_bounds[i - 1] > 400 ? 400 : growth_bounds[i - 1];
+        }
+        printf("  realloc headroom: -o realloc_growth=%u (%.0f%% of reallocs grow a block grown before)\n",
+            growth, percent(nrepeat, an->nreallocs));
+    }
+
+    double nrequests = an->nallocs + an->nreallocs;
+    size_t total_bytes = 0;
+    for (int i = 0; i < STATS_SIZE_CLASSES; i++) {
+        total_bytes += an->class_bytes[i];
+    }
+    int huge = -1;
+    for (int i = STATS_SIZE_CLASSES - 1; i >= 0 && (1UL << i) >= HUGE_MIN; i--) {
+        unsigned long count = 0;
+        size_t bytes = 0;
+        for (int j = i; j < STATS_SIZE_CLASSES; j++) {
+            count += an->class_counts[j];
+            bytes += an->class_bytes[j];
+        }
+        if (percent(count, nrequests) > HUGE_MAX_REQUESTS) {
+            break;
+        }
+        if (percent(bytes, total_bytes) >= HUGE_MIN_BYTES) {
+            huge = i;
+        }
+    }
+    if (huge == -1) {
+        printf("  huge threshold: none (no rare size range holds %d%% of the bytes)\n",
+            HUGE_MIN_BYTES);
+    } else {
+        unsigned long count = 0;
+        size_t bytes = 0;
+        for (int j = huge; j < STATS_SIZE_CLASSES; j++) {
+            count += an->class_counts[j];
+            bytes += an->class_bytes[j];
+        }
+        printf("  huge threshold: %lu bytes (%.2f%% of requests, %.0f%% of bytes); "
+            "serve these apart from the heap's free list\n",
+            1UL << huge, percent(count, nrequests), percent(bytes, total_bytes));
+    }
+}
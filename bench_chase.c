@@ -0,0 +1,131 @@
+/*
+ * File: bench_chase.c
+ * -------------------
+ * Pointer-chasing benchmark for block placement.  Allocates a list of
+ * equally sized nodes from the explicit allocator, with small filler
+ * blocks of random size between them (as in a real heap, where nodes are
+ * rarely allocated back to back), links the nodes in a random order and
+ * then walks the list, reading every word of each node.  Reports the
+ * nanoseconds per hop and how many nodes straddle a cache line boundary.
+ *
+ *   ./bench_chase            nodes placed by mymalloc
+ *   ./bench_chase -c         nodes placed by mymalloc_hint(MALLOC_CACHE_ALIGN)
+ *
+ * Build with `make ALIGN=16` (etc.) to compare block alignments.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "allocator.h"
+#include "segment.h"
+
+typedef struct node {
+    struct node *next;
+    long words[];       // the rest of the node, all read on every hop
+} node;
+
+// state for the random number generator (splitmix64)
+static uint64_t rng_state = 107;
+
+static uint64_t next_random(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Function: main
+ * --------------
+ * Parses the flags (-n nodes, -s node size, -r rounds, -c for the cache
+ * line hint, -f for no filler blocks), builds the list and times the walk.
+ */
+int main(int argc, char *argv[]) {
+    long nnodes = 1 << 19;
+    size_t node_size = CACHE_LINE_SIZE;
+    int rounds = 10;
+    bool line_hint = false, fillers = true;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:s:r:cf")) != EOF) {
+        switch (c) {
+            case 'n': nnodes = atol(optarg); break;
+            case 's': node_size = strtoul(optarg, NULL, 10); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'c': line_hint = true; break;
+            case 'f': fillers = false; break;
+            default:
+                error(1, 0, "Usage: %s [-n nodes] [-s size] [-r rounds] [-c] [-f]", argv[0]);
+        }
+    }
+    if (nnodes < 1 || node_size < sizeof(node) || rounds < 1) {
+        error(1, 0, "Invalid parameters.");
+    }
+
+    init_heap_segment(1L << 32);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        error(1, 0, "myinit() returned false.");
+    }
+
+    node **nodes = malloc(nnodes * sizeof(node *));
+    if (nodes == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    long straddling = 0;
+    size_t nwords = (node_size - sizeof(node)) / sizeof(long);
+    for (long i = 0; i < nnodes; i++) {
+        if (fillers && mymalloc(8 + next_random() % 49) == NULL) {
+            error(1, 0, "Heap exhausted after %ld nodes.", i);
+        }
+        nodes[i] = line_hint ? mymalloc_hint(node_size, MALLOC_CACHE_ALIGN) : mymalloc(node_size);
+        if (nodes[i] == NULL) {
+            error(1, 0, "Heap exhausted after %ld nodes.", i);
+        }
+        uintptr_t first_line = (uintptr_t)nodes[i] / CACHE_LINE_SIZE;
+        uintptr_t last_line = ((uintptr_t)nodes[i] + node_size - 1) / CACHE_LINE_SIZE;
+        straddling += last_line - first_line + 1 > (node_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+        for (size_t w = 0; w < nwords; w++) {
+            nodes[i]->words[w] = i + w;
+        }
+    }
+
+    // Fisher-Yates shuffle, then link the nodes into one cycle in that order
+    for (long i = nnodes - 1; i > 0; i--) {
+        long j = next_random() % (i + 1);
+        node *tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+    for (long i = 0; i < nnodes; i++) {
+        nodes[i]->next = nodes[(i + 1) % nnodes];
+    }
+
+    long sum = 0;
+    node *p = nodes[0];
+    double start = now_secs();
+    for (long hop = 0; hop < (long)rounds * nnodes; hop++) {
+        for (size_t w = 0; w < nwords; w++) {
+            sum += p->words[w];
+        }
+        p = p->next;
+    }
+    double elapsed = now_secs() - start;
+
+    printf("alignment %d, %s, %ld nodes of %zu bytes: %.2f ns/hop, "
+        "%.1f%% of nodes span an extra cache line (checksum %ld)\n",
+        ALIGNMENT, line_hint ? "cache line hint" : "no hint", nnodes, node_size,
+        elapsed * 1e9 / ((double)rounds * nnodes), 100.0 * straddling / nnodes, sum);
+    free(nodes);
+    return 0;
+}
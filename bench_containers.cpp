@@ -0,0 +1,204 @@
+/*
+ * File: bench_containers.cpp
+ * --------------------------
+ * Container benchmark for the C++ adapters in allocator.hpp.  Runs the same
+ * std::vector, std::map, std::unordered_map and std::list workloads with
+ * the C library's allocator (std::allocator), with my_allocator and with
+ * std::pmr containers on my_resource(), and prints the nanoseconds per
+ * element of each.  `make` builds one of these for each allocator:
+ *
+ *   ./bench_containers_explicit            100000 elements, 5 rounds
+ *   ./bench_containers_implicit -n 10000   fewer elements (it searches every block)
+ *
+ * Every round with our heap starts from a fresh myinit.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include "allocator.hpp"
+#include "segment.h"
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the i'th of n keys, in a scrambled order
+static long key_at(long i, long n) {
+    return (i * 2654435761L) % (n * 4 + 1);
+}
+
+
+/* Function: vector_workload
+ * -------------------------
+ * Grows a vector one element at a time, then reads it back.
+ */
+template <template <typename> class A>
+static long vector_workload(long n) {
+    std::vector<long, A<long>> v;
+    for (long i = 0; i < n; i++) {
+        v.push_back(i);
+    }
+    long sum = 0;
+    for (long x : v) {
+        sum += x;
+    }
+    return sum;
+}
+
+/* Function: map_workload
+ * ----------------------
+ * Inserts n keys into a map, erases every other one and looks them all up.
+ */
+template <template <typename> class A>
+static long map_workload(long n) {
+    std::map<long, long, std::less<long>, A<std::pair<const long, long>>> m;
+    for (long i = 0; i < n; i++) {
+        m[key_at(i, n)] = i;
+    }
+    for (long i = 0; i < n; i += 2) {
+        m.erase(key_at(i, n));
+    }
+    long found = 0;
+    for (long i = 0; i < n; i++) {
+        found += m.count(key_at(i, n));
+    }
+    return found;
+}
+
+/* Function: unordered_map_workload
+ * --------------------------------
+ * The map workload on a hash table.
+ */
+template <template <typename> class A>
+static long unordered_map_workload(long n) {
+    std::unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+        A<std::pair<const long, long>>> m;
+    for (long i = 0; i < n; i++) {
+        m[key_at(i, n)] = i;
+    }
+    for (long i = 0; i < n; i += 2) {
+        m.erase(key_at(i, n));
+    }
+    long found = 0;
+    for (long i = 0; i < n; i++) {
+        found += m.count(key_at(i, n));
+    }
+    return found;
+}
+
+/* Function: list_workload
+ * -----------------------
+ * Appends n nodes to a list, removes every other one, then adds n / 2
+ * more at the front, so that new nodes land in the holes.
+ */
+template <template <typename> class A>
+static long list_workload(long n) {
+    std::list<long, A<long>> l;
+    for (long i = 0; i < n; i++) {
+        l.push_back(i);
+    }
+    bool drop = true;
+    for (auto it = l.begin(); it != l.end(); drop = !drop) {
+        it = drop ? l.erase(it) : std::next(it);
+    }
+    for (long i = 0; i < n / 2; i++) {
+        l.push_front(i);
+    }
+    long sum = 0;
+    for (long x : l) {
+        sum += x;
+    }
+    return sum;
+}
+
+/* Function: time_workload
+ * -----------------------
+ * Runs a workload for the given number of rounds and returns the
+ * nanoseconds per element.  With our heap, every round gets a fresh one.
+ * Checks that the result matches the glibc run's.
+ */
+static double time_workload(long (*run)(long), long n, int rounds, bool my_heap,
+    long expected, const char *name) {
+    double total = 0;
+    for (int r = 0; r < rounds; r++) {
+        if (my_heap && !myinit(heap_segment_start(), heap_segment_size())) {
+            error(1, 0, "myinit() returned false.");
+        }
+        double start = now_secs();
+        long result = run(n);
+        total += now_secs() - start;
+        if (result != expected) {
+            error(1, 0, "%s workload gave %ld, expected %ld.", name, result, expected);
+        }
+    }
+    return total * 1e9 / ((double)rounds * n);
+}
+
+// polymorphic_allocator on the default resource, which main sets to my_resource()
+template <typename T>
+using pmr_allocator = std::pmr::polymorphic_allocator<T>;
+
+/* Function: main
+ * --------------
+ * Parses the flags (-n elements, -r rounds) and prints a table of the
+ * nanoseconds per element for each workload and allocator.
+ */
+int main(int argc, char *argv[]) {
+    long n = 100000;
+    int rounds = 5;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:r:")) != EOF) {
+        switch (c) {
+            case 'n': n = atol(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            default:
+                error(1, 0, "Usage: %s [-n elements] [-r rounds]", argv[0]);
+        }
+    }
+    if (n < 2 || rounds < 1) {
+        error(1, 0, "Invalid parameters.");
+    }
+
+    init_heap_segment(1L << 32);
+    std::pmr::set_default_resource(my_resource());
+
+    static const struct {
+        const char *name;
+        long (*glibc)(long);
+        long (*mine)(long);
+        long (*pmr)(long);
+    } workloads[] = {
+        {"vector", vector_workload<std::allocator>, vector_workload<my_allocator>,
+            vector_workload<pmr_allocator>},
+        {"map", map_workload<std::allocator>, map_workload<my_allocator>,
+            map_workload<pmr_allocator>},
+        {"unordered_map", unordered_map_workload<std::allocator>,
+            unordered_map_workload<my_allocator>, unordered_map_workload<pmr_allocator>},
+        {"list", list_workload<std::allocator>, list_workload<my_allocator>,
+            list_workload<pmr_allocator>},
+    };
+
+    printf("%ld elements, %d rounds, ns/element\n", n, rounds);
+    printf("%-16s %12s %14s %12s\n", "workload", "glibc", "my_allocator", "pmr");
+    for (const auto &w : workloads) {
+        long expected = w.glibc(n);
+        double glibc_ns = time_workload(w.glibc, n, rounds, false, expected, w.name);
+        double mine_ns = time_workload(w.mine, n, rounds, true, expected, w.name);
+        double pmr_ns = time_workload(w.pmr, n, rounds, true, expected, w.name);
+        printf("%-16s %12.2f %14.2f %12.2f\n", w.name, glibc_ns, mine_ns, pmr_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * File: bench_restart.c
+ * ---------------------
+ * Warm restart benchmark for the file-backed heap.  The first run builds a
+ * hash table of string keys in a heap mapped from a file, keeps the table
+ * in the heap's root slot and detaches.  Later runs find the table again
+ * with myattach instead of rebuilding it, so the time to get going is the
+ * time to map the file and check the heap's metadata.  Either way, every
+ * key is then looked up to make sure the table is intact.
+ *
+ *   ./bench_restart          build the table, or pick it up from last time
+ *   ./bench_restart -c       exit without mydetach, as if the process crashed
+ *                            (the next run has to recover the heap)
+ *
+ * Delete the heap file (bench_restart.heap unless -f is given) to start over.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "segment.h"
+
+typedef struct entry {
+    struct entry *next;     // next entry in the same bucket
+    long value;
+    char key[];
+} entry;
+
+typedef struct {
+    size_t nbuckets;        // a power of 2
+    size_t nentries;
+    entry *buckets[];
+} table;
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// FNV-1a
+static size_t hash_key(const char *key) {
+    size_t hash = 14695981039346656037ULL;
+    for (; *key != '\0'; key++) {
+        hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+/* Function: build_table
+ * ---------------------
+ * Allocates a table of n entries in the heap, key "k<i>" holding i * 3.
+ */
+static table *build_table(long n) {
+    size_t nbuckets = 1;
+    while (nbuckets < (size_t)n) {
+        nbuckets *= 2;
+    }
+    table *t = mymalloc(sizeof(table) + nbuckets * sizeof(entry *));
+    if (t == NULL) {
+        error(1, 0, "Heap exhausted allocating the table.");
+    }
+    t->nbuckets = nbuckets;
+    t->nentries = 0;
+    memset(t->buckets, 0, nbuckets * sizeof(entry *));
+
+    char key[32];
+    for (long i = 0; i < n; i++) {
+        int len = snprintf(key, sizeof(key), "k%ld", i);
+        entry *e = mymalloc(sizeof(entry) + len + 1);
+        if (e == NULL) {
+            error(1, 0, "Heap exhausted after %ld entries.", i);
+        }
+        memcpy(e->key, key, len + 1);
+        e->value = i * 3;
+        size_t b = hash_key(key) & (nbuckets - 1);
+        e->next = t->buckets[b];
+        t->buckets[b] = e;
+        t->nentries++;
+    }
+    return t;
+}
+
+/* Function: lookup
+ * ----------------
+ * Returns the entry for key, or NULL if there is none.
+ */
+static entry *lookup(table *t, const char *key) {
+    entry *e = t->buckets[hash_key(key) & (t->nbuckets - 1)];
+    while (e != NULL && strcmp(e->key, key) != 0) {
+        e = e->next;
+    }
+    return e;
+}
+
+
+/* Function: main
+ * --------------
+ * Parses the flags (-f heap file, -n entries, -s heap size, -c to skip
+ * mydetach), attaches to or builds the table and checks every key.
+ */
+int main(int argc, char *argv[]) {
+    const char *path = "bench_restart.heap";
+    long n = 1000000;
+    size_t heap_size = 1L << 30;
+    bool crash = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "f:n:s:c")) != EOF) {
+        switch (c) {
+            case 'f': path = optarg; break;
+            case 'n': n = atol(optarg); break;
+            case 's': heap_size = strtoul(optarg, NULL, 10); break;
+            case 'c': crash = true; break;
+            default:
+                error(1, 0, "Usage: %s [-f file] [-n entries] [-s heap size] [-c]", argv[0]);
+        }
+    }
+    if (n < 1) {
+        error(1, 0, "Invalid parameters.");
+    }
+
+    double start = now_secs();
+    void *heap_start = open_heap_segment(path, heap_size);
+    if (heap_start == NULL) {
+        error(1, 0, "Cannot map heap file %s.", path);
+    }
+    table *t = NULL;
+    bool warm = myattach(heap_start, heap_size);
+    if (warm) {
+        t = *myroot();
+    }
+    if (t == NULL) {
+        if (!myinit(heap_start, heap_size)) {
+            error(1, 0, "myinit() returned false.");
+        }
+        t = build_table(n);
+        *myroot() = t;
+    }
+    double ready = now_secs() - start;
+
+    start = now_secs();
+    char key[32];
+    for (size_t i = 0; i < t->nentries; i++) {
+        snprintf(key, sizeof(key), "k%zu", i);
+        entry *e = lookup(t, key);
+        if (e == NULL || e->value != (long)i * 3) {
+            error(1, 0, "Entry %s is missing or wrong.", key);
+        }
+    }
+    double checked = now_secs() - start;
+
+    printf("%s %zu entries in %.3f ms, looked them all up in %.3f ms\n",
+        warm ? "attached to" : "built", t->nentries, ready * 1e3, checked * 1e3);
+    if (!crash) {
+        mydetach();
+    }
+    if (!sync_heap_segment()) {
+        error(1, 0, "Cannot sync heap file %s.", path);
+    }
+    return 0;
+}
@@ -14,6 +14,9 @@
 #include <string.h>
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./heaplock.h"
+#include "./heapmap.h"
+#include "./heapprof.h"
 
 // how many bytes are printed per line in dump_heap
 #define BYTES_PER_LINE 32
@@ -21,6 +24,7 @@
 static void *segment_start;
 static size_t segment_size;
 static size_t nused;
+static heap_stats counters;   // running totals reported by mystats
 
 
 /* Function: myinit
@@ -29,12 +33,41 @@ static size_t nused;
  * segment boundary parameters.
  */
 bool myinit(void *heap_start, size_t heap_size) {
+    HEAP_LOCK();
     segment_start = heap_start;
     segment_size = heap_size;
     nused = 0;
+    memset(&counters, 0, sizeof(counters));
     return true;
 }
 
+/* Function: myattach, mydetach, myroot
+ * ------------------------------------
+ * The bump allocator keeps no state in the heap, so it cannot resume one.
+ */
+bool myattach(void *heap_start, size_t heap_size) {
+    return false;
+}
+
+void mydetach(void) {
+}
+
+void **myroot(void) {
+    return NULL;
+}
+
+/* Function: myextend, mygrow_hook
+ * -------------------------------
+ * The bump allocator only ever hands out the next bytes of one range, so
+ * it cannot span several segments.
+ */
+bool myextend(void *start, size_t size) {
+    return false;
+}
+
+void mygrow_hook(heap_grow_fn grow) {
+}
+
 /* Function: roundup
  * -----------------
  * This function rounds up the given number to the given multiple, which
@@ -51,15 +84,38 @@ size_t roundup(size_t sz, size_t mult) {
  * it is fast, but no memory recycling means very poor utilization.
  */
 void *mymalloc(size_t requested_size) {
+    HEAP_LOCK();
     size_t needed = roundup(requested_size, ALIGNMENT);
     if (needed + nused > segment_size) {
         return NULL;
     }
     void *ptr = (char *)segment_start + nused;
     nused += needed;
+    counters.allocs[stats_size_class(requested_size)]++;
+    if (heapprof_should_sample(requested_size)) {
+        heapprof_sample_alloc(ptr, requested_size);   // never freed, so never untracked
+    }
     return ptr;
 }
 
+/* Function: mymalloc_hint
+ * -----------------------
+ * With MALLOC_CACHE_ALIGN, bumps the end of the heap up to the next cache
+ * line boundary before allocating.  The skipped bytes are simply wasted.
+ */
+void *mymalloc_hint(size_t requested_size, unsigned hints) {
+    HEAP_LOCK();
+    if (hints & MALLOC_CACHE_ALIGN) {
+        size_t start = (size_t)segment_start;
+        size_t aligned = roundup(start + nused, CACHE_LINE_SIZE) - start;
+        if (aligned > segment_size) {
+            return NULL;
+        }
+        nused = aligned;
+    }
+    return mymalloc(requested_size);
+}
+
 /* Function: myfree
  * ----------------
  * This function does nothing - fast!... but lame :(
@@ -73,12 +129,58 @@ void myfree(void *ptr) {}
  * existing contents to that region.  It's not particularly efficient.
  */
 void *myrealloc(void *old_ptr, size_t new_size) {
+    HEAP_LOCK();
     void *new_ptr = mymalloc(new_size);
+    if (new_ptr == NULL || old_ptr == NULL) {
+        return new_ptr;
+    }
     memcpy(new_ptr, old_ptr, new_size);
     myfree(old_ptr);
+    counters.realloc_copied++;
+    counters.realloc_bytes_copied += new_size;
     return new_ptr;
 }
 
+/* Function: mymallopt
+ * -------------------
+ * The bump allocator has nothing to tune.
+ */
+bool mymallopt(mallopt_param param, long value) {
+    return false;
+}
+
+/* Function: mycompact
+ * -------------------
+ * Freed space is never reused, so moving blocks into it would gain
+ * nothing; nothing is ever moved.
+ */
+size_t mycompact(size_t budget, bool (*can_move)(void *payload),
+    void (*moved)(void *old_payload, void *new_payload)) {
+    return 0;
+}
+
+/* Function: mymaintain
+ * ---------------------
+ * Nothing is ever freed, so there is nothing to tidy.
+ */
+void mymaintain(void) {
+}
+
+/* Function: mystats
+ * -----------------
+ * Blocks are never freed (myfree isn't counted), so everything below
+ * nused is in use and the untouched rest of the segment counts as one
+ * free block.
+ */
+void mystats(heap_stats *stats) {
+    HEAP_LOCK();
+    *stats = counters;
+    stats->bytes_in_use = nused;
+    stats->bytes_free = segment_size - nused;
+    stats->free_blocks = stats->bytes_free > 0 ? 1 : 0;
+    stats->largest_free = stats->bytes_free;
+}
+
 /* Function: validate_heap
  * -----------------------
  * This function checks for potential errors/inconsistencies in the heap data
@@ -87,6 +189,19 @@ void *myrealloc(void *old_ptr, size_t new_size) {
  * available.
  */
 bool validate_heap() {
+    return validate_heap_level(VALIDATE_FULL);
+}
+
+/* Function: validate_heap_level
+ * -----------------------------
+ * The bump allocator's only check is already constant-time, so every level
+ * other than VALIDATE_NONE does the same thing.
+ */
+bool validate_heap_level(validate_level level) {
+    HEAP_LOCK();
+    if (level == VALIDATE_NONE) {
+        return true;
+    }
     if (nused > segment_size) {
         printf("Oops! Have used more heap than total available?!\n");
         breakpoint();   // call this function to stop in gdb to poke around
@@ -95,6 +210,25 @@ bool validate_heap() {
     return true;
 }
 
+/* Function: mysnapshot
+ * --------------------
+ * The bump allocator has no block headers, so the map shows everything
+ * handed out so far as one allocated block followed by the free rest of
+ * the segment.
+ */
+bool mysnapshot(FILE *out, unsigned long tag) {
+    HEAP_LOCK();
+    heapmap_writer writer;
+    heapmap_begin(&writer, out, segment_start, segment_size, tag);
+    if (nused > 0) {
+        heapmap_add(&writer, segment_start, nused, true);
+    }
+    if (nused < segment_size) {
+        heapmap_add(&writer, (char *)segment_start + nused, segment_size - nused, false);
+    }
+    return heapmap_end(&writer);
+}
+
 /* Function: dump_heap
  * -------------------
  * This function is not called from anywhere, it is just here to
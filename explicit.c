@@ -1,49 +1,287 @@
+#include <stddef.h>  // for offsetof
+#include <stdint.h>  // for uint32_t
 #include <stdio.h>  // for printf
+#include <stdlib.h>  // for qsort
 #include <string.h>  // for memmove
+#include <sys/mman.h>  // for madvise
+#include <time.h>  // for clock_gettime
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./heaplock.h"
+#include "./heapmap.h"
+#include "./heapprof.h"
 
 #define LEAST_3_SIGBITS ~0x7
-#define ALIGNMENT 8
 #define MAX_REQUEST_SIZE (1 << 30)
-#define MIN_REQUEST_SIZE 24  // the minimum number of bytes for an "empty" heap
+#ifdef COMPACT_HEADERS
+// Compact mode (-DCOMPACT_HEADERS): a 4-byte header that holds the size of
+// the whole block, header included, since header plus payload is a multiple
+// of ALIGNMENT while the payload alone is not.  Free list links are 32-bit
+// offsets from segment_start, so the heap is limited to 4 GiB.
+#define HEADER_SIZE 4
+#define SIZE_BIAS HEADER_SIZE  // what the header adds to the payload size
+#define MIN_PAYLOAD 8  // a free payload must hold two uint32_t offsets
+#define MAX_SEGMENT_SIZE UINT32_MAX  // the largest size a header or offset can hold
+#else
+#define HEADER_SIZE 8  // every block starts with one size_t header
+#define SIZE_BIAS 0
+#define MAX_SEGMENT_SIZE SIZE_MAX
+#define MIN_PAYLOAD 24  // smallest payload of a block
+#endif
+// the minimum number of bytes for an "empty" heap: MIN_PAYLOAD, or more if
+// that would leave header plus payload not a multiple of ALIGNMENT
+// (24 bytes normally, 12 with compact headers)
+#define MIN_REQUEST_SIZE (((MIN_PAYLOAD + HEADER_SIZE + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) - HEADER_SIZE)
+#define SAMPLED_BIT 0x2  // header flag for blocks sampled by the heap profiler
+#define QUICK_BIT 0x4  // header flag for freed blocks held on a quick list
+#define QUICK_MAX_SIZE 1024  // largest payload MALLOPT_QUICK_MAX may allow
+#define QUICK_BINS ((QUICK_MAX_SIZE - MIN_REQUEST_SIZE) / ALIGNMENT + 1)  // one per payload size
+#define NURSERY_BIT QUICK_BIT  // with the allocated bit, marks a live object in a nursery chunk
+#define NURSERY_CHUNK 4096  // payload bytes of each nursery chunk
+#define NURSERY_MAX 256  // largest request placed in a nursery chunk
+#define NURSERY_SPARES 4  // empty nursery chunks kept for the next ones rather than freed
+#define PREDICT_MAX 64  // largest request the lifetime predictor sends there
+#define NURSERY_CLASSES (PREDICT_MAX / ALIGNMENT + 1)  // lifetime predictor classes, one per size
+#define SHORT_LIFETIME (NURSERY_CHUNK / 4)  // bytes allocated during a life that counts as short
+#define SCORE_MAX 8  // how far a predictor score can go either way
+#define LONG_PENALTY 4  // how far one long life moves a score (a short one moves it by 1)
+#define PROBE_EVERY 16  // one in this many requests predicted long-lived goes to the nursery anyway
+#define LIFETIME_OFF 0  // MALLOPT_LIFETIME settings: no nursery at all,
+#define LIFETIME_HINTS 1  // only for MALLOC_SHORT_LIVED requests,
+#define LIFETIME_PREDICT 2  // or also for requests predicted short-lived
+#define HEAP_MAGIC "EXPLHEAP"  // marks the metadata at the end of a heap
+#define HEAP_LAYOUT (HEADER_SIZE | ALIGNMENT << 8)  // heaps built with other settings can't be attached
+#define GROWN_RING 8  // how many recently grown blocks myrealloc remembers
+#define GROWTH_MAX 400  // largest value MALLOPT_REALLOC_GROWTH may take
+#define MAINTAIN_BLOCKS 1024  // blocks each mymaintain call looks at
+#define PURGE_MIN (64 * 1024)  // smallest free payload whose pages mymaintain gives back
+#define PURGE_TAG 0x7075726765646d6bULL  // mixed into purgeBlock's note (see purgeMark)
+#define PAGE_SIZE 4096  // granularity of madvise (see segment.h)
+#define MAINTAIN_INTERVAL_MAX 60000000  // largest value MALLOPT_MAINTENANCE_US may take (a minute)
+#define TOUCHED_RING 32  // how many recently touched blocks incremental validation remembers
+#define WINDOW_BLOCKS 32  // how many other blocks each incremental validation checks
+#define MAX_EXTENSIONS 64  // segments myextend may add to the one from myinit
+#define SENTINEL 1  // header just past the last block of an added segment: allocated, size 0
+#define SKIP_LEVELS 12  // levels of the free list in address order, the linked list included
+#define FREE_ORDER_LIFO 0  // MALLOPT_FREE_ORDER settings: newest free block first,
+#define FREE_ORDER_ADDRESS 1  // or lowest address first (see skipInsert)
 
 // link struct that will be used to build the linked list of free heap blocks
+// (get and set the fields with getNext, setNext, getPrevious and setPrevious).
+// In address order a free block's link is followed by a tower of skip_refs,
+// its next block on each level above the list it is on (see getForward).
+#ifdef COMPACT_HEADERS
+typedef uint32_t header;  // typedef header for easier readability and less confusion
+typedef struct link {
+    uint32_t next;  // offset of the next free payload from segment_start, 0 for none
+    uint32_t previous;
+} link;
+typedef uint32_t skip_ref;  // offset like a link's, 0 for none
+#else
+typedef size_t header;  // typedef header for easier readability and less confusion
 typedef struct link {
     struct link *next;
     struct link *previous;
 } link;
+typedef link *skip_ref;
+#endif
+
+// metadata kept in the last bytes of the heap, so that myattach can pick
+// the heap up again in a later process (see mydetach)
+typedef struct {
+    char magic[8];  // HEAP_MAGIC
+    uint64_t layout;  // HEAP_LAYOUT of the build that made the heap
+    uint64_t heap_start;  // heap_start and heap_size given to myinit
+    uint64_t heap_size;
+    uint64_t free_list;  // offset of linked_start from segment_start (0 for none)
+    uint64_t blocks_allocated;
+    void *root;  // the client's slot (see myroot)
+    uint32_t clean;  // 1 from mydetach until the next myattach
+    uint32_t checksum;  // over everything above
+} heap_meta;
+
+// a block that myrealloc grew, and how much of it the client asked for
+// (the rest is headroom for the next growth)
+typedef struct {
+    void *payload;  // NULL if the slot is unused
+    size_t used;
+} grown_block;
+
+// start of a nursery chunk's payload: short-lived objects are bumped off
+// the rest of it, each with a birth time and a header that holds its size
+// and its offset in the chunk (see nurseryAlloc)
+typedef struct {
+    uint32_t live;  // objects not freed yet
+    uint32_t used;  // offset of the next object's payload from the start of the chunk
+    void *next_spare;  // next chunk on the spare list, while this one is empty and on it
+} nursery_chunk;
+
+// a segment added by myextend: its blocks run from first up to an allocated
+// sentinel header, which stops coalescing at its end (see addSegment)
+typedef struct {
+    header *first;
+    header *sentinel;
+} extension;
 
 static void *segment_start;  // variable that keeps track of the start of the heap (from myinit)
 static size_t segment_size;  // variable that stores the size of the heap (from myinit)
 static char *segment_end;  // variable that stores the end of the heap (from myinit)
-typedef size_t header;  // typedef header for easier readability and less confusion
 static header* start_hdr;  // header of the start of the heap (from myinit)
 link *linked_start;  // linked list that points will continually be updated as the list is built
 static int blocks_allocated;  // keeps track of the number of allocated blocks in the heap (for validate_heap_
+static header *touched[TOUCHED_RING];  // ring of headers changed since the last incremental check
+static size_t ntouched;  // number of headers noted since the last incremental check
+static header *window_cursor;  // first block of the next incremental check's window
+static header *compact_cursor;  // block where the next mycompact call starts
+static heap_stats counters;  // running totals reported by mystats
+static link *quick_lists[QUICK_BINS];  // freed small blocks of each exact size, not coalesced
+static size_t nquick;  // number of blocks on all the quick lists
+static size_t quick_max = 128;  // largest payload put on a quick list (MALLOPT_QUICK_MAX)
+static size_t quick_limit = 256;  // nquick that makes myfree flush them all (MALLOPT_QUICK_LIMIT)
+static grown_block grown[GROWN_RING];  // ring of blocks recently grown by myrealloc
+static size_t ngrown;  // number of blocks noted in grown so far
+static size_t realloc_growth = 150;  // percent of its size a block grown again may take (MALLOPT_REALLOC_GROWTH)
+static int lifetime_mode = LIFETIME_HINTS;  // LIFETIME_* (MALLOPT_LIFETIME)
+static nursery_chunk *nursery;  // chunk new short-lived objects are placed in, NULL if none
+static nursery_chunk *spare_chunks;  // empty nursery chunks held for reuse (see nurseryFree)
+static int nspares;  // number of chunks on spare_chunks
+static uint32_t alloc_clock;  // bytes requested so far (wrapping), which lifetimes are measured in
+static signed char lifetime_score[NURSERY_CLASSES];  // for each size, >= 0 predicts short-lived
+static unsigned probes;  // requests predicted long-lived, for PROBE_EVERY
+static heap_meta *meta;  // metadata at the end of the heap, just past segment_end
+static header *maintain_cursor;  // block where the next mymaintain call starts
+static char *high_water;  // end of the highest block allocated so far in the first segment
+static bool maintained;  // whether the maintenance thread is running, so myfree can leave flushes to it
+static extension extensions[MAX_EXTENSIONS];  // segments added by myextend, in address order
+static int nextensions;  // number of segments in extensions
+static size_t extended_bytes;  // bytes of blocks, headers included, in those segments
+static heap_grow_fn grow_hook;  // asked for another segment when nothing fits (see mygrow_hook)
+static int free_order = FREE_ORDER_LIFO;  // FREE_ORDER_* (MALLOPT_FREE_ORDER)
+static link *skip_heads[SKIP_LEVELS];  // first block on each level above the linked list (index 0 unused)
+#ifdef THREAD_SAFE
+static pthread_t maintainer;  // background thread calling mymaintain, while maintain_interval > 0
+static long maintain_interval;  // microseconds between its calls (MALLOPT_MAINTENANCE_US), 0 if stopped
+static pthread_mutex_t maintain_lock = PTHREAD_MUTEX_INITIALIZER;  // guards maintain_interval
+static pthread_cond_t maintain_wake = PTHREAD_COND_INITIALIZER;  // signalled when it changes
+#endif
+
+void setSize(header *hdr, size_t size);
+link *getNext(link *block);
+link *getPrevious(link *block);
+void setNext(link *block, link *next);
+void setPrevious(link *block, link *previous);
+#ifdef THREAD_SAFE
+bool setMaintenance(long interval);
+#endif
+
+/* HELPER FUNCTION : setBounds
+ * ------------------------------
+ * Given the heap_start and heap_size from myinit or
+ * myattach, works out where the blocks and the metadata
+ * go and resets everything that is not kept in the heap.
+ * The metadata takes the last bytes.  The first header
+ * is placed so that its payload is ALIGNMENT-aligned,
+ * and the end of the blocks is trimmed so that their
+ * length is a multiple of ALIGNMENT.  With compact
+ * headers only the first 4 GiB of the heap is used.
+ * Segments added by myextend are forgotten.
+ * Returns false (with no metadata) if the heap is too small.
+ */
+bool setBounds(void *heap_start, size_t heap_size) {
+    size_t first_payload = ((size_t) heap_start + HEADER_SIZE + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+    size_t skipped = first_payload - HEADER_SIZE - (size_t) heap_start;
+    // makes sure that the heap has room for the metadata and a header
+    if (heap_size < skipped + sizeof(heap_meta) + 2 * ALIGNMENT) {
+        meta = NULL;
+        return false;
+    }
+    meta = (heap_meta *) (((size_t) heap_start + heap_size - sizeof(heap_meta)) & ~(size_t) 7);
+    segment_start = (char *) heap_start + skipped;
+    segment_size = (char *) meta - (char *) segment_start;
+    if (segment_size > MAX_SEGMENT_SIZE) {
+        segment_size = MAX_SEGMENT_SIZE;
+    }
+    segment_size &= ~(size_t) (ALIGNMENT - 1);
+    segment_end = (char *) segment_start + segment_size;
+    start_hdr = segment_start;
+    ntouched = 0;
+    window_cursor = start_hdr;
+    compact_cursor = start_hdr;
+    maintain_cursor = start_hdr;
+    high_water = segment_start;
+    memset(&counters, 0, sizeof(counters));
+    memset(quick_lists, 0, sizeof(quick_lists));
+    nquick = 0;
+    memset(grown, 0, sizeof(grown));
+    ngrown = 0;
+    nursery = NULL;
+    spare_chunks = NULL;
+    nspares = 0;
+    alloc_clock = 0;
+    memset(lifetime_score, -1, sizeof(lifetime_score));  // long-lived until shown otherwise
+    probes = 0;
+    nextensions = 0;
+    extended_bytes = 0;
+    memset(skip_heads, 0, sizeof(skip_heads));
+    return true;
+}
+
+/* HELPER FUNCTION : metaChecksum
+ * -------------------------------
+ * Returns the FNV-1a hash of the metadata up to its
+ * checksum field.
+ */
+uint32_t metaChecksum() {
+    uint32_t hash = 2166136261u;
+    const unsigned char *bytes = (const unsigned char *) meta;
+    for (size_t i = 0; i < offsetof(heap_meta, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
 
+/* HELPER FUNCTION : writeMeta
+ * ----------------------------
+ * Copies the free list head and the allocated block count
+ * into the metadata, marks it clean or not and updates
+ * the checksum.
+ */
+void writeMeta(bool clean) {
+    meta->free_list = linked_start == NULL ? 0 : (char *) linked_start - (char *) segment_start;
+    meta->blocks_allocated = blocks_allocated;
+    meta->clean = clean;
+    meta->checksum = metaChecksum();
+}
 
 /* MAIN FUNCTION : myinit
  * -----------------------
  * Given a non-NULL heap_start pointer and a 
  * heap_size value, initializes the heap by 
- * giving the global variables values. 
+ * giving the global variables values (see setBounds)
+ * and making the whole heap one free block.  The
+ * metadata is written straight away, so a heap that
+ * was never detached can still be recovered by myattach.
  * Returns true if heap was properly initialized
  * and returns false if parameters were not valid
  * (heap not able to be initialized).
  */
 bool myinit(void *heap_start, size_t heap_size) {
-    if (heap_size >= ALIGNMENT) {  // makes sure that the heap_size is at least 8 bytes
+    HEAP_LOCK();
+    if (setBounds(heap_start, heap_size)) {
         blocks_allocated = 0;
-        segment_start = heap_start;
-        segment_size = heap_size;
-        segment_end = (char *) segment_start + segment_size;
-        start_hdr = segment_start;
-        *start_hdr = heap_size - ALIGNMENT;
-        linked_start = (link *) ((char*) start_hdr + ALIGNMENT);
+        setSize(start_hdr, segment_size - HEADER_SIZE);
+        linked_start = (link *) ((char*) start_hdr + HEADER_SIZE);
+        setNext(linked_start, NULL);
+        setPrevious(linked_start, NULL);
+        memcpy(meta->magic, HEAP_MAGIC, sizeof(meta->magic));
+        meta->layout = HEAP_LAYOUT;
+        meta->heap_start = (size_t) heap_start;
+        meta->heap_size = heap_size;
+        meta->root = NULL;
+        writeMeta(false);
         return true;
     }
-    return false;  // if heap_size is less than 8 bytes
+    return false;  // if heap_size is too small
 }
 
 /* HELPER FUNCTION : statusAllocated
@@ -71,9 +309,78 @@ void statusFree(header* hdr) {
  * hold the free/used status)
  */
 size_t getSize(header* hdr) {
-    return (*hdr & LEAST_3_SIGBITS);
+    return (*hdr & LEAST_3_SIGBITS) - SIZE_BIAS;
+}
+
+/* HELPER FUNCTION : setSize
+ * --------------------------
+ * Writes a payload size into a header, clearing
+ * its status bits (the block reads as free).
+ */
+void setSize(header *hdr, size_t size) {
+    *hdr = size + SIZE_BIAS;
+}
+
+/* HELPER FUNCTIONS : getNext, getPrevious, setNext, setPrevious,
+ *                    getForward, setForward
+ * --------------------------------------------------------------
+ * Read and write the links of a free block, and the entries
+ * of its tower (for levels from 1 up) in address order.
+ * With compact headers a link is stored as the offset of
+ * the payload from segment_start; no payload starts at
+ * offset 0 (the first header is there), so 0 stands for NULL.
+ */
+#ifdef COMPACT_HEADERS
+link *getNext(link *block) {
+    return block->next == 0 ? NULL : (link *) ((char *) segment_start + block->next);
+}
+
+link *getPrevious(link *block) {
+    return block->previous == 0 ? NULL : (link *) ((char *) segment_start + block->previous);
 }
 
+void setNext(link *block, link *next) {
+    block->next = next == NULL ? 0 : (char *) next - (char *) segment_start;
+}
+
+void setPrevious(link *block, link *previous) {
+    block->previous = previous == NULL ? 0 : (char *) previous - (char *) segment_start;
+}
+
+link *getForward(link *block, int level) {
+    skip_ref ref = ((skip_ref *) (block + 1))[level - 1];
+    return ref == 0 ? NULL : (link *) ((char *) segment_start + ref);
+}
+
+void setForward(link *block, int level, link *next) {
+    ((skip_ref *) (block + 1))[level - 1] = next == NULL ? 0 : (char *) next - (char *) segment_start;
+}
+#else
+link *getNext(link *block) {
+    return block->next;
+}
+
+link *getPrevious(link *block) {
+    return block->previous;
+}
+
+void setNext(link *block, link *next) {
+    block->next = next;
+}
+
+void setPrevious(link *block, link *previous) {
+    block->previous = previous;
+}
+
+link *getForward(link *block, int level) {
+    return ((skip_ref *) (block + 1))[level - 1];
+}
+
+void setForward(link *block, int level, link *next) {
+    ((skip_ref *) (block + 1))[level - 1] = next;
+}
+#endif
+
 /* HELPER FUNCTION : accessPayload
  * --------------------------------
  * Given a header pointer, return the associated
@@ -81,7 +388,7 @@ size_t getSize(header* hdr) {
  * the header since the header size is eight).
  */
 void* accessPayload(header* hdr) {
-    return (char*) hdr + ALIGNMENT;
+    return (char*) hdr + HEADER_SIZE;
 }
 
 /* HELPER FUNCTION : accessHeader
@@ -91,7 +398,7 @@ void* accessPayload(header* hdr) {
  * payload since the the header size is eight).
  */ 
 header* accessHeader(void* payload) {
-    return (header*) ((char*) payload - ALIGNMENT);
+    return (header*) ((char*) payload - HEADER_SIZE);
 }
 
 /* HELPER FUNCTION : isAllocated
@@ -104,12 +411,38 @@ bool isAllocated(header* hdr) {
     return ((*hdr & 1) == 1);
 }
 
+/* HELPER FUNCTION : isQuick
+ * --------------------------
+ * Given a header pointer, return true if the block
+ * was freed onto a quick list.  Such blocks keep their
+ * allocated bit so that nothing coalesces into them.
+ */
+bool isQuick(header *hdr) {
+    return (*hdr & QUICK_BIT) != 0;
+}
+
+/* HELPER FUNCTION : quickIndex
+ * -----------------------------
+ * Given a payload size, returns the quick list that holds
+ * blocks of exactly that size, or -1 if the size is too big
+ * for one.  Every payload size is MIN_REQUEST_SIZE plus a
+ * multiple of ALIGNMENT (see roundup).
+ */
+int quickIndex(size_t size) {
+    if (size > quick_max) {
+        return -1;
+    }
+    return (size - MIN_REQUEST_SIZE) / ALIGNMENT;
+}
+
 /* HELPER FUNCTION : roundup
  * --------------------------
- * Given a number and a multiple (must be a power of 2),
- * returns the rounded up version of the number.
- * Used to make sure requested_size in mymalloc is 
- * rounded up the the next biggest multiple of eight.
+ * Given a requested size and a multiple (must be a power
+ * of 2), returns the payload size of the block that will
+ * hold it: big enough, and with header plus payload a
+ * multiple of mult so that the next block's payload is
+ * aligned too.  With 8-byte alignment this is the next
+ * biggest multiple of eight.
  * If the number is less than the minimum size though,
  * this function will return the minimum size.
  */
@@ -117,7 +450,7 @@ size_t roundup(size_t sz, size_t mult) {
     if (MIN_REQUEST_SIZE > sz) {
         return MIN_REQUEST_SIZE;
     }
-    return (sz + mult - 1) & ~(mult - 1);
+    return ((sz + HEADER_SIZE + mult - 1) & ~(mult - 1)) - HEADER_SIZE;
 }
 
 /* HELPER FUNCTION : nextBlock
@@ -133,22 +466,209 @@ header* nextBlock(header* hdr) {
     return nxt;
 }
 
+/* HELPER FUNCTION : isSentinel
+ * -----------------------------
+ * Given a header inside the heap, returns true if it is
+ * the sentinel at the end of a segment added by myextend
+ * rather than the header of a block.  No block has a size
+ * of 0, so only the sentinel has no size bits.
+ */
+bool isSentinel(header *hdr) {
+    return (*hdr & LEAST_3_SIGBITS) == 0;
+}
+
+/* HELPER FUNCTION : findExtension
+ * --------------------------------
+ * Returns the index of the added segment whose blocks hold
+ * the given address, found by binary search, or -1 if
+ * there is none.
+ */
+int findExtension(void *addr) {
+    int low = 0;
+    int high = nextensions - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if ((char *) addr < (char *) extensions[mid].first) {
+            high = mid - 1;
+        } else if ((char *) addr >= (char *) extensions[mid].sentinel) {
+            low = mid + 1;
+        } else {
+            return mid;
+        }
+    }
+    return -1;
+}
+
+/* HELPER FUNCTION : segmentEnd
+ * -----------------------------
+ * Returns the end of the blocks of the segment holding the
+ * given address: segment_end for the one from myinit, the
+ * sentinel for one added by myextend.  Returns NULL if the
+ * address is not inside the heap.
+ */
+char *segmentEnd(void *addr) {
+    if ((char *) addr >= (char *) segment_start && (char *) addr < segment_end) {
+        return segment_end;
+    }
+    int i = findExtension(addr);
+    return i == -1 ? NULL : (char *) extensions[i].sentinel;
+}
+
+/* HELPER FUNCTION : endsSegment
+ * ------------------------------
+ * Given a header, returns true if its block is the last
+ * one in its segment.
+ */
+bool endsSegment(header *hdr) {
+    header *next = nextBlock(hdr);
+    return (char *) next == segment_end || isSentinel(next);
+}
+
+/* HELPER FUNCTION : followingBlock
+ * ---------------------------------
+ * Given a header, returns the header of the block after
+ * it in a walk over the whole heap: the segment from
+ * myinit first, then the added ones in address order.
+ * Returns NULL after the last block of the last segment.
+ */
+header *followingBlock(header *hdr) {
+    header *next = nextBlock(hdr);
+    if ((char *) next == segment_end) {
+        return nextensions > 0 ? extensions[0].first : NULL;
+    }
+    if (isSentinel(next)) {
+        int i = findExtension(hdr);
+        return i + 1 < nextensions ? extensions[i + 1].first : NULL;
+    }
+    return next;
+}
+
+/* HELPER FUNCTION : skipHeight
+ * -----------------------------
+ * Returns how many levels of the free list in address
+ * order a block at this address goes on if it has room:
+ * 1, plus one more with probability 1/4 each time, taken
+ * from a hash of the address so that it can be worked out
+ * again when the block is unlinked.
+ */
+int skipHeight(link *block) {
+    uint32_t bits = (uint32_t) (((uint64_t) (size_t) block * 0x9E3779B97F4A7C15ull) >> 32);
+    int height = 1;
+    while (height < SKIP_LEVELS && (bits & 3) == 0) {
+        height++;
+        bits >>= 2;
+    }
+    return height;
+}
+
+/* HELPER FUNCTIONS : skipNext, setSkipNext
+ * ------------------------------------------
+ * Read and write the block after pred on the given level
+ * of the free list in address order, where level 0 is the
+ * linked list itself and a NULL pred is the level's head.
+ */
+link *skipNext(link *pred, int level) {
+    if (pred == NULL) {
+        return level == 0 ? linked_start : skip_heads[level];
+    }
+    return level == 0 ? getNext(pred) : getForward(pred, level);
+}
+
+void setSkipNext(link *pred, int level, link *next) {
+    if (pred == NULL && level == 0) {
+        linked_start = next;
+    } else if (pred == NULL) {
+        skip_heads[level] = next;
+    } else if (level == 0) {
+        setNext(pred, next);
+    } else {
+        setForward(pred, level, next);
+    }
+}
+
+/* HELPER FUNCTION : skipInsert
+ * -----------------------------
+ * Puts a free block into the linked list in address order.
+ * The list is the bottom level of a skip list whose upper
+ * levels are singly linked through the towers that follow
+ * the links in free payloads, so the block's place is found
+ * by going down from the top level in O(log n) steps.  The
+ * block goes on skipHeight levels, or as many as its payload
+ * has room for.
+ */
+void skipInsert(link *block) {
+    int height = skipHeight(block);
+    int room = 1 + (getSize(accessHeader(block)) - sizeof(link)) / sizeof(skip_ref);
+    if (height > room) {
+        height = room;
+    }
+    link *pred = NULL;
+    for (int level = SKIP_LEVELS - 1; level >= 0; level--) {
+        link *next = skipNext(pred, level);
+        while (next != NULL && next < block) {
+            pred = next;
+            next = skipNext(pred, level);
+        }
+        if (level == 0) {
+            setNext(block, next);
+            setPrevious(block, pred);
+            if (next != NULL) {
+                setPrevious(next, block);
+            }
+        } else if (level < height) {
+            setForward(block, level, next);
+        } else {
+            continue;
+        }
+        setSkipNext(pred, level, block);
+    }
+}
+
+/* HELPER FUNCTION : skipRemove
+ * -----------------------------
+ * Takes a free block off the levels above the linked list
+ * in address order.  Its height is not stored, but it is
+ * on no more levels than skipHeight says, so most blocks
+ * (three in four) need no search at all.
+ */
+void skipRemove(link *block) {
+    if (skipHeight(block) == 1) {
+        return;
+    }
+    link *pred = NULL;
+    for (int level = SKIP_LEVELS - 1; level >= 1; level--) {
+        link *next = skipNext(pred, level);
+        while (next != NULL && next < block) {
+            pred = next;
+            next = skipNext(pred, level);
+        }
+        if (next == block) {
+            setSkipNext(pred, level, getForward(block, level));
+        }
+    }
+}
+
 /* HELPER FUNCTION : linkFree
  * ----------------------------
  * Given a heap block that should be free, add it
  * to the linked list using the "last-in first-out"
- * explicit free list design logic.
+ * explicit free list design logic, or in address
+ * order (see skipInsert).
  */
 void linkFree(link *block) {
+    if (free_order == FREE_ORDER_ADDRESS) {
+        skipInsert(block);
+        return;
+    }
     // if linked list has some elements
     if (linked_start != NULL) {
-        block->next = linked_start;
-        block->previous = NULL;
-        linked_start->previous = block;
+        setNext(block, linked_start);
+        setPrevious(block, NULL);
+        setPrevious(linked_start, block);
         linked_start = block;
     } else {  // if linked list is empty
-        block->next = NULL;
-        block->previous = NULL;
+        setNext(block, NULL);
+        setPrevious(block, NULL);
         linked_start = block;
     }
 }
@@ -158,26 +678,79 @@ void linkFree(link *block) {
  * Given a heap block that we want to set as allocated,
  * rewire the linked list to fit it in using the 
  * "last-in first-out explicit free list design logic".
+ * In address order it comes off the upper levels too.
  */
 void unlinkFree(link *block) {
-    link *before_block = block->previous;
-    link *after_block = block->next;
+    if (free_order == FREE_ORDER_ADDRESS) {
+        skipRemove(block);
+    }
+    link *before_block = getPrevious(block);
+    link *after_block = getNext(block);
     // if before and after blocks exist 
     if (before_block != NULL && after_block != NULL) {
-        before_block->next = after_block;
-        after_block->previous = before_block;
+        setNext(before_block, after_block);
+        setPrevious(after_block, before_block);
      // if there is nothing before but there is a block afte   
     } else if (before_block == NULL && after_block != NULL) {
-        after_block->previous = NULL;
+        setPrevious(after_block, NULL);
         linked_start = after_block;
      // if there is nothing after but there is a block before
     } else if (before_block != NULL && after_block == NULL) {
-        before_block->next = NULL;
+        setNext(before_block, NULL);
     } else {  // if before and after blocks do not exist
         linked_start = NULL;
     }         
 }
 
+/* HELPER FUNCTION : relinkFree
+ * -----------------------------
+ * Rebuilds the linked list in the current free_order from
+ * the free blocks in the heap, for a change of order.
+ */
+void relinkFree() {
+    linked_start = NULL;
+    memset(skip_heads, 0, sizeof(skip_heads));
+    for (header *hdr = start_hdr; hdr != NULL; hdr = followingBlock(hdr)) {
+        if (!isAllocated(hdr)) {
+            linkFree((link *) accessPayload(hdr));
+        }
+    }
+}
+
+/* HELPER FUNCTION : noteTouched
+ * -------------------------------
+ * Remembers a header that was just changed so the next incremental
+ * validation checks it.  Only the last TOUCHED_RING are kept.
+ */
+void noteTouched(header *hdr) {
+    touched[ntouched++ % TOUCHED_RING] = hdr;
+}
+
+/* HELPER FUNCTION : forgetAbsorbed
+ * ---------------------------------
+ * Given a header that coalescing (or compaction) just merged
+ * into the block at hdr, point any remembered reference to it
+ * (in the touched ring, the validation window, the compactor
+ * or mymaintain) at hdr instead, since the old header is now
+ * just bytes inside a free payload.
+ */
+void forgetAbsorbed(header *absorbed, header *hdr) {
+    for (int i = 0; i < TOUCHED_RING; i++) {
+        if (touched[i] == absorbed) {
+            touched[i] = hdr;
+        }
+    }
+    if (window_cursor == absorbed) {
+        window_cursor = hdr;
+    }
+    if (compact_cursor == absorbed) {
+        compact_cursor = hdr;
+    }
+    if (maintain_cursor == absorbed) {
+        maintain_cursor = hdr;
+    }
+}
+
 /* HELPER FUNCTION : coalesce
  * ----------------------------
  * Given a payload, check if there is a free
@@ -187,15 +760,78 @@ void unlinkFree(link *block) {
 bool coalesce(void *payload) {
     header *curr = accessHeader(payload);
     header *neighbor = nextBlock(curr);
-    if (!isAllocated(neighbor)) {
+    if ((char *) neighbor != segment_end && !isAllocated(neighbor)) {
         size_t neighbor_size = getSize(neighbor);
-        *curr += neighbor_size + ALIGNMENT;
+        *curr += neighbor_size + HEADER_SIZE;
         unlinkFree((link *) accessPayload(neighbor));
+        forgetAbsorbed(neighbor, curr);
         return true;
     }
     return false;
 }
 
+/* HELPER FUNCTION : coalesceBack
+ * --------------------------------
+ * Given the header of a free block on the linked list, in
+ * address order, looks up the block before it in the list:
+ * the nearest free block below it.  If the two touch, that
+ * one absorbs it.  Returns the header of the block that
+ * now holds it.  Does nothing in LIFO order, where myfree
+ * only coalesces forward.
+ */
+header *coalesceBack(header *hdr) {
+    if (free_order != FREE_ORDER_ADDRESS) {
+        return hdr;
+    }
+    link *before = getPrevious((link *) accessPayload(hdr));
+    if (before != NULL && nextBlock(accessHeader(before)) == hdr) {
+        coalesce(before);
+        return accessHeader(before);
+    }
+    return hdr;
+}
+
+/* HELPER FUNCTION : compareDescending
+ * ------------------------------------
+ * qsort comparison that puts higher header addresses first.
+ */
+int compareDescending(const void *a, const void *b) {
+    header *first = *(header **) a;
+    header *second = *(header **) b;
+    return (first < second) - (first > second);
+}
+
+/* HELPER FUNCTION : flushQuick
+ * -----------------------------
+ * Frees every block held on the quick lists into the
+ * linked list and coalesces them in one go.  They are
+ * freed from the highest address down, so each block
+ * can absorb the free blocks after it (including ones
+ * just flushed) before anything absorbs it in turn.
+ */
+void flushQuick() {
+    static header *flushing[MALLOPT_QUICK_LIMIT_MAX];
+    size_t count = 0;
+    for (int i = 0; i < QUICK_BINS; i++) {
+        for (link *block = quick_lists[i]; block != NULL; block = getNext(block)) {
+            flushing[count++] = accessHeader(block);
+        }
+        quick_lists[i] = NULL;
+    }
+    qsort(flushing, count, sizeof(header *), compareDescending);
+    for (size_t i = 0; i < count; i++) {
+        header *hdr = flushing[i];
+        *hdr &= ~QUICK_BIT;
+        statusFree(hdr);
+        linkFree((link *) accessPayload(hdr));
+        while (coalesce(accessPayload(hdr))) {}
+        noteTouched(hdr);
+        coalesceBack(hdr);
+    }
+    nquick = 0;
+    counters.quick_flushes++;
+}
+
 /* HELPER FUNCTION : splitting
  * ----------------------------
  * If the free block found is greater than the number of 
@@ -204,157 +840,1501 @@ bool coalesce(void *payload) {
  * free. Otherwise, it is a wastage of space on the heap.
  */
 link *splitting(header *hdr, size_t actual_size, size_t og_size, link *list) {
-    *hdr = actual_size;
+    unlinkFree(list);  // first, since the new header may land on its tower
+    setSize(hdr, actual_size);
     header *split = nextBlock(hdr);
     blocks_allocated++;
-    *split = og_size - actual_size - ALIGNMENT;
+    setSize(split, og_size - actual_size - HEADER_SIZE);
     link *neighbor = (link *) accessPayload(split);
     linkFree(neighbor);
-    unlinkFree(list);
     statusAllocated(hdr);
+    noteTouched(hdr);
+    noteTouched(split);
     return list;
 }
 
-/* MAIN FUNCTION : mymalloc
- * -------------------------
- * Given a user-inputted requested size (the amount the user 
- * wants allocated on the heap), find the best free block from the
- * linked list that is greater than or equal to the rounded up version
- * of requested_size (next biggest multiple of 8).
- *
- * If the heap block found is greater than request_size bytes, 
- * splitting is implemented.
- *
- * Returns pointer to the payload of the allocated heap block if
- * successful or return NULL if there is no space on the heap for 
- * the requested size.
+/* HELPER FUNCTION : profileAlloc
+ * --------------------------------
+ * Given the header of a block that was just allocated,
+ * let the heap profiler sample it if enough bytes have
+ * been allocated since the last sample, marking the
+ * header if it was.  Returns the block's payload.
  */
-void *mymalloc(size_t requested_size) {
-    size_t actual_size = roundup(requested_size, ALIGNMENT);
-    link *list = linked_start;
-    while (list != NULL) {
-        header *hdr = accessHeader(list);
-        size_t og_size = getSize(hdr);
-        if (og_size < actual_size) {
-            list = list->next;  // finding the right free bloock in the linked list
-            continue;
-        }
-        if (og_size >= actual_size + MIN_REQUEST_SIZE) {
-            return splitting(hdr, actual_size, og_size, list);  // goes to splitting helper function
-        } else {  // if the free block found fits the actual_size perfectly
-            unlinkFree(list);
-            statusAllocated(hdr);
-            blocks_allocated++;
-            return list;
-        }
+void *profileAlloc(header *hdr, size_t requested_size) {
+    void *payload = accessPayload(hdr);
+    if (heapprof_should_sample(requested_size) &&
+        heapprof_sample_alloc(payload, requested_size)) {
+        *hdr |= SAMPLED_BIT;
     }
-    return NULL;
+    return payload;
 }
 
-/* MAIN FUNCTION: myfree
- * ----------------------
- * Given a pointer to a heap block's payload, change
- * the status bit of the corresponding header to free 
- * (turn off least significant bit).
- * Includes coalescing!
+/* HELPER FUNCTION : purgeMark
+ * -----------------------------
+ * Returns where purgeBlock keeps its note in a free
+ * block's payload, just after the links and the tallest
+ * tower they may have: a tag tying the note to the
+ * block's address, then the end of the pages purged.
  */
-void myfree(void *ptr) {
-    if (ptr != NULL) {  // makes sure that an invalid pointer is not given
-        header *hdr = accessHeader(ptr);
-        link *freed = (link *) ptr;
-        linkFree(freed);
-        coalesce(ptr);  // goes to coalesce helper function
-        statusFree(hdr);
-        blocks_allocated--;
-    }
+size_t *purgeMark(header *hdr) {
+    size_t links = (sizeof(link) + (SKIP_LEVELS - 1) * sizeof(skip_ref) + 7) & ~(size_t) 7;
+    return (size_t *) ((char *) accessPayload(hdr) + links);
 }
 
-/* MAIN FUNCTION - myrealloc
- * --------------------------
- * Given an old pointer to a heap block payload and the new size
- * that the block is expanding to, returns a pointer to the payload
- * of a heap block that is new_size bytes large.
+/* HELPER FUNCTION : forgetPurge
+ * -------------------------------
+ * Given a free block about to be used, clears
+ * purgeBlock's note, so that pages written from now on
+ * are not taken for ones still given back.
  */
-void *myrealloc(void *old_ptr, size_t new_size) {
-    new_size = roundup(new_size, ALIGNMENT);
-    // if no old_ptr specified, just do regular mymalloc
-    if (old_ptr == NULL) {
-        return mymalloc(new_size);
-    }
-    size_t old_size = getSize(accessHeader(old_ptr));
-    // if specified new_size is smaller than the old_size, do not change anything.
-    // myrealloc only expands
-    if (new_size <= old_size) {
-        return old_ptr;
+void forgetPurge(header *hdr) {
+    if (getSize(hdr) >= PURGE_MIN) {
+        purgeMark(hdr)[0] = 0;
     }
-    // mymalloc a bigger heap block
-    void *result = mymalloc(new_size);
-    memcpy(result, old_ptr, old_size);  // copies memory from old block to new block
-    myfree(old_ptr);
-    return result;
 }
 
-/* HELPER FUNCTION: linkedListWrong
- * ---------------------------------
- * Given a block in the linked list that should be free,
- * check if the list is wired incorrectly in terms of the 
- * order or if an allocated block is included.
+/* HELPER FUNCTION : raiseHighWater
+ * ----------------------------------
+ * Given a block just allocated or grown, moves
+ * high_water up to its end if it is in the first
+ * segment and ends past it.
  */
-bool linkedListWrong(link *curr) {
-    header *curr_hdr = accessHeader(curr);
-    // if the order of the list does not make sense
-    if ((curr->previous != NULL && curr->previous->next != curr) ||
-        (curr->next != NULL && curr->next->previous != curr)) {  
-        return true;
+void raiseHighWater(header *hdr) {
+    char *end = (char *) nextBlock(hdr);
+    if (end > high_water && end <= (char *) segment_end) {
+        high_water = end;
     }
-        // if something in the list is not free
-    if (isAllocated(curr_hdr)) {  
-        return true;
+}
+
+/* HELPER FUNCTION : placeBlock
+ * ------------------------------
+ * Given a free heap block from the linked list that is
+ * at least actual_size bytes, allocates it for the
+ * request.  If the block is big enough, splitting is
+ * implemented.  Returns the header.
+ */
+header *placeBlock(header *hdr, size_t actual_size) {
+    link *list = (link *) accessPayload(hdr);
+    size_t og_size = getSize(hdr);
+    forgetPurge(hdr);
+    if (og_size >= actual_size + MIN_REQUEST_SIZE) {
+        splitting(hdr, actual_size, og_size, list);  // goes to splitting helper function
+    } else {  // if the free block found fits the actual_size perfectly
+        unlinkFree(list);
+        statusAllocated(hdr);
+        noteTouched(hdr);
+        blocks_allocated++;
     }
-    return false;
+    raiseHighWater(hdr);
+    return hdr;
 }
 
-/* HELPER FUNCTION : validate_heap
- * --------------------------------
- * Goes through the entire linked list and calls the
- * linkedListWrong helper function to make sure it is 
- * not wired incorrectly.
- * In adddition, it goes through the entire heap and 
- * makes sure that the number of allocated blocks matches
- * the block_allocated variable that was being continually
- * updated as myfree and mymalloc were being called.
+/* HELPER FUNCTION : findFit
+ * ----------------------------
+ * Returns the header of the first block in the linked
+ * list with at least actual_size bytes of payload, or
+ * NULL if there is none.
  */
-bool validate_heap() {
-    bool result =  true;
+header *findFit(size_t actual_size) {
+    for (link *list = linked_start; list != NULL; list = getNext(list)) {
+        counters.search_steps++;
+        header *hdr = accessHeader(list);
+        if (getSize(hdr) >= actual_size) {
+            return hdr;
+        }
+    }
+    return NULL;
+}
 
-    // checks whether the number of allocated blocks checks out
-    header *ptr = segment_start;
-    int check_allocated = 0;
-    while ((char *) ptr != segment_end) {
-        if (isAllocated(ptr)) {
-            check_allocated++;
+/* HELPER FUNCTION : grownSlot
+ * -----------------------------
+ * Returns the slot in the grown ring that holds the
+ * given payload, or -1 if it is not there.
+ */
+int grownSlot(void *payload) {
+    if (ngrown == 0) {
+        return -1;
+    }
+    for (int i = 0; i < GROWN_RING; i++) {
+        if (grown[i].payload == payload) {
+            return i;
         }
-        ptr = nextBlock(ptr);
     }
-    // Should be equal if heap blocks were allocated properly
-    if (check_allocated != blocks_allocated) {
-        printf("ERROR! nused and check_nused do not match up.");
-        breakpoint();
-        result = false;
+    return -1;
+}
+
+/* HELPER FUNCTION : noteGrown
+ * -----------------------------
+ * Records that myrealloc grew a block to used bytes, in
+ * the given slot or (if it is -1) in place of the oldest
+ * block in the grown ring.
+ */
+void noteGrown(int slot, void *payload, size_t used) {
+    if (slot == -1) {
+        slot = ngrown++ % GROWN_RING;
     }
+    grown[slot] = (grown_block) {.payload = payload, .used = used};
+}
 
-    // checks if the linked list was built correctly
-    link *curr = linked_start;
-    if (curr == NULL) {
-        result = false;
+/* HELPER FUNCTION : trimBlock
+ * -----------------------------
+ * Given an allocated block, cuts it down to actual_size
+ * bytes of payload if the rest is big enough to be a
+ * block of its own, and frees the rest (coalescing it
+ * with the block after it).  Returns the bytes cut off.
+ */
+size_t trimBlock(header *hdr, size_t actual_size) {
+    size_t size = getSize(hdr);
+    if (size < actual_size + MIN_REQUEST_SIZE) {
+        return 0;
     }
-    while (curr != NULL) {
-        if (linkedListWrong(curr)) {
-            result = false;
+    header flags = *hdr & ~LEAST_3_SIGBITS;
+    setSize(hdr, actual_size);
+    *hdr |= flags;
+    header *rest = nextBlock(hdr);
+    setSize(rest, size - actual_size - HEADER_SIZE);
+    linkFree((link *) accessPayload(rest));
+    coalesce(accessPayload(rest));
+    noteTouched(hdr);
+    noteTouched(rest);
+    return size - actual_size;
+}
+
+/* HELPER FUNCTION : reclaimSlack
+ * --------------------------------
+ * Used by mymalloc when nothing fits: trims the headroom
+ * off every block in the grown ring.  Returns the bytes
+ * given back.
+ */
+size_t reclaimSlack() {
+    size_t reclaimed = 0;
+    for (int i = 0; i < GROWN_RING; i++) {
+        if (grown[i].payload != NULL) {
+            reclaimed += trimBlock(accessHeader(grown[i].payload), grown[i].used);
         }
-        curr = curr->next;
     }
-    return result;
+    counters.slack_reclaimed += reclaimed;
+    return reclaimed;
+}
+
+/* HELPER FUNCTION : growInPlace
+ * -------------------------------
+ * If the block after the given allocated block is free
+ * and the two together have at least needed bytes of
+ * payload, absorbs it and trims the result down to
+ * reserve bytes (when there is that much).  Returns
+ * false if the block could not grow.
+ */
+bool growInPlace(header *hdr, size_t needed, size_t reserve) {
+    header *next = nextBlock(hdr);
+    if ((char *) next == segment_end || isAllocated(next) ||
+        getSize(hdr) + HEADER_SIZE + getSize(next) < needed) {
+        return false;
+    }
+    coalesce(accessPayload(hdr));
+    trimBlock(hdr, reserve);
+    noteTouched(hdr);
+    raiseHighWater(hdr);
+    return true;
+}
+
+/* HELPER FUNCTION : freeChunk
+ * -----------------------------
+ * Gives an empty nursery chunk back to the heap.
+ */
+void freeChunk(nursery_chunk *chunk) {
+    header *chunk_hdr = accessHeader(chunk);
+    blocks_allocated--;
+    linkFree((link *) chunk);
+    coalesce(chunk);
+    statusFree(chunk_hdr);
+    noteTouched(chunk_hdr);
+    coalesceBack(chunk_hdr);
+    counters.nursery_chunks_freed++;
+}
+
+/* HELPER FUNCTION : releaseSpares
+ * ---------------------------------
+ * Frees every chunk on the spare list.  Returns the bytes
+ * given back.
+ */
+size_t releaseSpares() {
+    size_t released = 0;
+    while (spare_chunks != NULL) {
+        nursery_chunk *chunk = spare_chunks;
+        spare_chunks = chunk->next_spare;
+        released += getSize(accessHeader(chunk));
+        freeChunk(chunk);
+    }
+    nspares = 0;
+    return released;
+}
+
+/* HELPER FUNCTION : addSegment
+ * -----------------------------
+ * Lays out the memory from start to start + size as a
+ * segment of the heap: one free block, followed by a
+ * sentinel header that reads as an allocated block, so
+ * that coalescing and growing in place stop at the end
+ * of the segment without having to look it up.  The
+ * first payload is ALIGNMENT-aligned like the heap's.
+ * With compact headers the whole segment must lie within
+ * 4 GiB above segment_start, for the free list offsets.
+ * Returns false if there are MAX_EXTENSIONS already, or
+ * the range is too small or overlaps the heap.
+ */
+bool addSegment(void *start, size_t size) {
+    if (segment_start == NULL || nextensions == MAX_EXTENSIONS || size > SIZE_MAX - (size_t) start) {
+        return false;
+    }
+    size_t first_payload = ((size_t) start + HEADER_SIZE + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+    char *first = (char *) first_payload - HEADER_SIZE;
+    char *end = (char *) start + size;
+    if (end < first + HEADER_SIZE + MIN_REQUEST_SIZE + HEADER_SIZE) {
+        return false;
+    }
+    size_t span = (size_t) (end - HEADER_SIZE - first) & ~(size_t) (ALIGNMENT - 1);
+    header *sentinel = (header *) (first + span);
+#ifdef COMPACT_HEADERS
+    if (first < (char *) segment_start ||
+        (size_t) (end - (char *) segment_start) > MAX_SEGMENT_SIZE) {
+        return false;
+    }
+#endif
+    if (first < (char *) meta + sizeof(heap_meta) && end > (char *) segment_start) {
+        return false;
+    }
+    int i = nextensions;
+    while (i > 0 && (char *) extensions[i - 1].first > first) {
+        i--;
+    }
+    if ((i > 0 && (char *) extensions[i - 1].sentinel + HEADER_SIZE > first) ||
+        (i < nextensions && end > (char *) extensions[i].first)) {
+        return false;
+    }
+    memmove(&extensions[i + 1], &extensions[i], (nextensions - i) * sizeof(extension));
+    extensions[i] = (extension) { (header *) first, sentinel };
+    nextensions++;
+    extended_bytes += span;
+    *sentinel = SENTINEL;
+    setSize((header *) first, span - HEADER_SIZE);
+    linkFree((link *) first_payload);
+    noteTouched((header *) first);
+    counters.segments_added++;
+    return true;
+}
+
+/* HELPER FUNCTION : growHeap
+ * ----------------------------
+ * Asks the grow hook, if there is one, for a segment big
+ * enough for a block of actual_size bytes of payload and
+ * adds it to the heap.  Returns false if it could not.
+ */
+bool growHeap(size_t actual_size) {
+    if (grow_hook == NULL) {
+        return false;
+    }
+    size_t size;
+    void *start = grow_hook(actual_size + 2 * HEADER_SIZE + ALIGNMENT, &size);
+    return start != NULL && addSegment(start, size);
+}
+
+/* HELPER FUNCTION : searchBlock
+ * -------------------------------
+ * Returns the header of a free block with at least
+ * actual_size bytes of payload, or NULL if there is none.
+ * If the linked list has nothing big enough, the quick
+ * lists are flushed (their blocks may coalesce into one
+ * that fits) and it is searched again.  The same happens
+ * before a request too big for a quick list cuts into the
+ * block at the end of a segment, so that held blocks are
+ * reused before the heap grows.  If still nothing fits,
+ * the spare nursery chunks and then the headroom myrealloc
+ * left in recently grown blocks are taken back (see
+ * releaseSpares and reclaimSlack), and last of all the
+ * grow hook is asked for another segment (see growHeap).
+ */
+header *searchBlock(size_t actual_size) {
+    counters.searches++;
+    header *hdr = findFit(actual_size);  // finding the right free block in the linked list
+    if (nquick > 0 && (hdr == NULL ||
+        (quickIndex(actual_size) == -1 && endsSegment(hdr)))) {
+        flushQuick();
+        hdr = findFit(actual_size);
+    }
+    if (hdr == NULL && releaseSpares() > 0) {
+        hdr = findFit(actual_size);
+    }
+    if (hdr == NULL && reclaimSlack() > 0) {
+        hdr = findFit(actual_size);
+    }
+    if (hdr == NULL && growHeap(actual_size)) {
+        hdr = findFit(actual_size);
+    }
+    return hdr;
+}
+
+/* HELPER FUNCTION : lifetimeClass
+ * --------------------------------
+ * Returns the lifetime predictor class for a request of
+ * at most PREDICT_MAX bytes.
+ */
+int lifetimeClass(size_t requested_size) {
+    return (requested_size + ALIGNMENT - 1) / ALIGNMENT;
+}
+
+/* HELPER FUNCTION : predictShort
+ * -------------------------------
+ * Returns true if a request of this size is predicted to
+ * be short-lived, which it is not until objects of its size
+ * have been seen dying young.  Every PROBE_EVERY'th request
+ * predicted long-lived is called short anyway, so that the
+ * nursery keeps measuring the size and can change its mind.
+ */
+bool predictShort(size_t requested_size) {
+    if (lifetime_score[lifetimeClass(requested_size)] >= 0) {
+        return true;
+    }
+    return ++probes % PROBE_EVERY == 0;
+}
+
+/* HELPER FUNCTION : scoreLifetime
+ * --------------------------------
+ * Given the size of a nursery object that was just freed
+ * and how many bytes were allocated during its life,
+ * moves its class's score toward short-lived (by 1) or
+ * long-lived (by LONG_PENALTY, since one long-lived object
+ * keeps a whole chunk from being freed).
+ */
+void scoreLifetime(size_t requested_size, uint32_t lifetime) {
+    signed char *score = &lifetime_score[lifetimeClass(requested_size)];
+    if (lifetime < SHORT_LIFETIME) {
+        *score = *score >= SCORE_MAX ? SCORE_MAX : *score + 1;
+    } else {
+        *score = *score - LONG_PENALTY <= -SCORE_MAX ? -SCORE_MAX : *score - LONG_PENALTY;
+    }
+}
+
+/* HELPER FUNCTION : isNursery
+ * ----------------------------
+ * Given the header of a block that the client still holds,
+ * returns true if it is an object in a nursery chunk.  A
+ * block in the heap itself never has NURSERY_BIT (alias
+ * QUICK_BIT) set while it is allocated to the client.
+ */
+bool isNursery(header *hdr) {
+    return (*hdr & (NURSERY_BIT | 1)) == (NURSERY_BIT | 1);
+}
+
+/* HELPER FUNCTION : nurserySize
+ * ------------------------------
+ * Returns the payload size recorded in a nursery object's
+ * header (bits 3 to 15; the offset is above them).
+ */
+size_t nurserySize(header *hdr) {
+    return *hdr & 0xFFFF & LEAST_3_SIGBITS;
+}
+
+/* HELPER FUNCTION : nurseryBirth
+ * -------------------------------
+ * Returns where a nursery object's birth time is kept,
+ * just before its header.
+ */
+uint32_t *nurseryBirth(header *hdr) {
+    return (uint32_t *) ((char *) hdr - sizeof(uint32_t));
+}
+
+/* HELPER FUNCTION : nurseryStride
+ * --------------------------------
+ * Returns the bytes from one nursery object's payload to
+ * the next, for an object of the given size: room for the
+ * payload and the next object's birth time and header.
+ */
+size_t nurseryStride(size_t size) {
+    return (size + HEADER_SIZE + sizeof(uint32_t) + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+}
+
+/* HELPER FUNCTION : nurseryAlloc
+ * -------------------------------
+ * Places a request of at most NURSERY_MAX bytes at the end
+ * of the current nursery chunk.  If it is full it is
+ * started over when everything in it has been freed, and
+ * otherwise replaced by a spare chunk or, failing that, a
+ * new block of NURSERY_CHUNK bytes from the heap.  Apart
+ * from the newest object's (see nurseryFree), the space a
+ * freed object leaves is not reused until its whole chunk
+ * is empty.  Each object has its birth time and a header
+ * in front of it.  Returns NULL if there is no room for a
+ * new chunk.
+ */
+void *nurseryAlloc(size_t requested_size) {
+    size_t size = (requested_size + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+    size_t first = nurseryStride(sizeof(nursery_chunk));  // the chunk's own fields come first
+    if (nursery != NULL && nursery->used + size > NURSERY_CHUNK && nursery->live == 0) {
+        nursery->used = first;
+    }
+    if (nursery == NULL || nursery->used + size > NURSERY_CHUNK) {
+        if (spare_chunks != NULL) {
+            nursery = spare_chunks;
+            spare_chunks = nursery->next_spare;
+            nspares--;
+        } else {
+            size_t chunk_size = roundup(NURSERY_CHUNK, ALIGNMENT);  // compact headers need a valid block size
+            header *hdr = searchBlock(chunk_size);
+            if (hdr == NULL) {
+                return NULL;
+            }
+            nursery = accessPayload(placeBlock(hdr, chunk_size));
+        }
+        nursery->live = 0;
+        nursery->used = first;
+    }
+    char *payload = (char *) nursery + nursery->used;
+    header *hdr = accessHeader(payload);
+    *hdr = (header) nursery->used << 16 | size | NURSERY_BIT | 1;
+    *nurseryBirth(hdr) = alloc_clock;
+    nursery->used += nurseryStride(size);
+    nursery->live++;
+    alloc_clock += requested_size;
+    counters.allocs[stats_size_class(requested_size)]++;
+    counters.nursery_allocs++;
+    if (heapprof_should_sample(requested_size) &&
+        heapprof_sample_alloc(payload, requested_size)) {
+        *hdr |= SAMPLED_BIT;
+    }
+    return payload;
+}
+
+/* HELPER FUNCTION : nurseryFree
+ * ------------------------------
+ * Frees a nursery object, feeding its lifetime to the
+ * predictor.  If it was the last object placed in the
+ * current chunk, its space is reused straight away (the
+ * usual case for short-lived churn).  When the last object
+ * in a chunk other than the current one goes, the chunk is
+ * kept on the spare list for the nursery to use next, or
+ * freed if NURSERY_SPARES are already held.  Keeping them
+ * stops long-lived requests from splitting the space the
+ * nursery has just given up, which would make every new
+ * chunk come from the end of the heap.
+ */
+void nurseryFree(header *hdr) {
+    void *ptr = accessPayload(hdr);
+    size_t size = nurserySize(hdr);
+    counters.frees[stats_size_class(size)]++;
+    if (*hdr & SAMPLED_BIT) {
+        heapprof_sample_free(ptr);
+    }
+    if (size <= PREDICT_MAX) {
+        scoreLifetime(size, alloc_clock - *nurseryBirth(hdr));
+    }
+    size_t offset = *hdr >> 16;
+    nursery_chunk *chunk = (nursery_chunk *) ((char *) ptr - offset);
+    if (chunk == nursery && offset + nurseryStride(size) == chunk->used) {
+        chunk->used = offset;
+    }
+    *hdr = 0;  // no longer a live object
+    if (--chunk->live == 0 && chunk != nursery) {
+        if (nspares < NURSERY_SPARES) {
+            chunk->next_spare = spare_chunks;
+            spare_chunks = chunk;
+            nspares++;
+        } else {
+            freeChunk(chunk);
+        }
+    }
+}
+
+/* HELPER FUNCTION : heapAlloc
+ * -----------------------------
+ * Given a user-inputted requested size (the amount the user 
+ * wants allocated on the heap), find the best free block from the
+ * linked list that is greater than or equal to the rounded up version
+ * of requested_size (see roundup), leaving the nursery out.
+ *
+ * Small requests are first served straight from the quick list
+ * for their exact size, if it has a block.  Otherwise the linked
+ * list is searched (see searchBlock).
+ *
+ * If the heap block found is greater than request_size bytes, 
+ * splitting is implemented.
+ *
+ * When built with -DLINE_ALIGN_MIN=n, requests of n bytes or more
+ * are placed on a cache line boundary as if by mymalloc_hint.
+ *
+ * Returns pointer to the payload of the allocated heap block if
+ * successful or return NULL if there is no space on the heap for 
+ * the requested size.
+ */
+void *heapAlloc(size_t requested_size) {
+#if defined(LINE_ALIGN_MIN) && ALIGNMENT < CACHE_LINE_SIZE
+    if (requested_size >= LINE_ALIGN_MIN) {
+        return mymalloc_hint(requested_size, MALLOC_CACHE_ALIGN);
+    }
+#endif
+    size_t actual_size = roundup(requested_size, ALIGNMENT);
+    alloc_clock += requested_size;
+    counters.allocs[stats_size_class(requested_size)]++;
+    int quick = quickIndex(actual_size);
+    if (quick != -1 && quick_lists[quick] != NULL) {  // reuse a block freed at this size
+        link *block = quick_lists[quick];
+        quick_lists[quick] = getNext(block);
+        nquick--;
+        header *hdr = accessHeader(block);
+        *hdr &= ~QUICK_BIT;
+        noteTouched(hdr);
+        blocks_allocated++;
+        counters.quick_hits++;
+        return profileAlloc(hdr, requested_size);
+    }
+    header *hdr = searchBlock(actual_size);
+    if (hdr == NULL) {
+        return NULL;
+    }
+    return profileAlloc(placeBlock(hdr, actual_size), requested_size);
+}
+
+/* MAIN FUNCTION : mymalloc
+ * -------------------------
+ * Allocates requested_size bytes.  With the lifetime
+ * predictor on (MALLOPT_LIFETIME), requests of up to
+ * PREDICT_MAX bytes that it expects to be short-lived go
+ * to the nursery (see
+ * nurseryAlloc); everything else goes to heapAlloc.
+ * Returns NULL if there is no space on the heap for the
+ * requested size.
+ */
+void *mymalloc(size_t requested_size) {
+    HEAP_LOCK();
+    if (lifetime_mode == LIFETIME_PREDICT && requested_size <= PREDICT_MAX &&
+        predictShort(requested_size)) {
+        return mymalloc_hint(requested_size, MALLOC_SHORT_LIVED);
+    }
+    return heapAlloc(requested_size);
+}
+
+/* HELPER FUNCTION : findLineFit
+ * --------------------------------
+ * Returns the header of a free block whose payload starts
+ * on a cache line boundary and has at least actual_size
+ * bytes, or NULL if there is none.  It is cut from the
+ * first block in the linked list that still fits once its
+ * payload is moved up to the next line.  The bytes skipped
+ * over stay in the list as a smaller free block, so they
+ * must be big enough to hold one; if not, the payload
+ * moves up one more line.
+ */
+header *findLineFit(size_t actual_size) {
+    for (link *list = linked_start; list != NULL; list = getNext(list)) {
+        counters.search_steps++;
+        header *hdr = accessHeader(list);
+        size_t og_size = getSize(hdr);
+        size_t gap = -(size_t) list & (CACHE_LINE_SIZE - 1);  // bytes up to the next line
+        if (gap > 0 && gap < HEADER_SIZE + MIN_REQUEST_SIZE) {
+            gap += CACHE_LINE_SIZE;
+        }
+        if (og_size < gap + actual_size) {
+            continue;
+        }
+        if (gap > 0) {  // the front of the block stays free, linked where it was
+            forgetPurge(hdr);
+            header *aligned = (header *) ((char *) list + gap - HEADER_SIZE);
+            if (free_order == FREE_ORDER_ADDRESS) {  // its tower may reach past the gap
+                unlinkFree(list);
+            }
+            setSize(aligned, og_size - gap);
+            setSize(hdr, gap - HEADER_SIZE);
+            if (free_order == FREE_ORDER_ADDRESS) {
+                linkFree(list);
+            }
+            linkFree((link *) accessPayload(aligned));
+            noteTouched(hdr);
+            noteTouched(aligned);
+            hdr = aligned;
+        }
+        return hdr;
+    }
+    return NULL;
+}
+
+/* MAIN FUNCTION : mymalloc_hint
+ * ------------------------------
+ * Like mymalloc, but with MALLOC_CACHE_ALIGN the block's
+ * payload starts on a cache line boundary (see
+ * findLineFit).  If no free block fits, the quick lists,
+ * spare nursery chunks and realloc headroom are given back
+ * and the heap grows, as in searchBlock.
+ *
+ * Otherwise, unless MALLOPT_LIFETIME is off, a request of
+ * up to NURSERY_MAX bytes with MALLOC_SHORT_LIVED goes to
+ * the nursery, and one with MALLOC_LONG_LIVED skips the
+ * lifetime predictor.
+ */
+void *mymalloc_hint(size_t requested_size, unsigned hints) {
+    HEAP_LOCK();
+    if (!(hints & (MALLOC_CACHE_ALIGN | MALLOC_SHORT_LIVED | MALLOC_LONG_LIVED))) {
+        return mymalloc(requested_size);
+    }
+    if (!(hints & MALLOC_CACHE_ALIGN) || ALIGNMENT >= CACHE_LINE_SIZE) {  // every payload is already line-aligned
+        if ((hints & (MALLOC_SHORT_LIVED | MALLOC_LONG_LIVED)) == MALLOC_SHORT_LIVED &&
+            lifetime_mode != LIFETIME_OFF && requested_size <= NURSERY_MAX) {
+            void *obj = nurseryAlloc(requested_size);
+            if (obj != NULL) {
+                return obj;
+            }
+        }
+        return heapAlloc(requested_size);
+    }
+    size_t actual_size = roundup(requested_size, ALIGNMENT);
+    alloc_clock += requested_size;
+    counters.allocs[stats_size_class(requested_size)]++;
+    counters.searches++;
+    // on a miss, the same fallbacks as searchBlock; a new segment gets room
+    // for the gap too, which can be up to two lines (see findLineFit)
+    header *hdr = findLineFit(actual_size);
+    if (hdr == NULL && nquick > 0) {
+        flushQuick();
+        hdr = findLineFit(actual_size);
+    }
+    if (hdr == NULL && releaseSpares() > 0) {
+        hdr = findLineFit(actual_size);
+    }
+    if (hdr == NULL && reclaimSlack() > 0) {
+        hdr = findLineFit(actual_size);
+    }
+    if (hdr == NULL && growHeap(actual_size + 2 * CACHE_LINE_SIZE)) {
+        hdr = findLineFit(actual_size);
+    }
+    if (hdr == NULL) {
+        return NULL;
+    }
+    return profileAlloc(placeBlock(hdr, actual_size), requested_size);
+}
+
+/* MAIN FUNCTION: myfree
+ * ----------------------
+ * Given a pointer to a heap block's payload, change
+ * the status bit of the corresponding header to free 
+ * (turn off least significant bit).
+ * Includes coalescing! (with the block after it, and in
+ * address order also the one before it; see coalesceBack)
+ * Blocks small enough for a quick list are pushed onto
+ * it instead, still marked allocated and not coalesced,
+ * until quick_limit of them are held and all are flushed
+ * (MALLOPT_QUICK_LIMIT_MAX while the maintenance thread is there
+ * to flush them sooner; see mymaintain).
+ * Nursery objects go back to their chunk (see nurseryFree).
+ */
+void myfree(void *ptr) {
+    HEAP_LOCK();
+    if (ptr != NULL) {  // makes sure that an invalid pointer is not given
+        header *hdr = accessHeader(ptr);
+        if (isNursery(hdr)) {
+            nurseryFree(hdr);
+            return;
+        }
+        counters.frees[stats_size_class(getSize(hdr))]++;
+        if (*hdr & SAMPLED_BIT) {  // tell the heap profiler a sampled block is gone
+            heapprof_sample_free(ptr);
+            *hdr &= ~SAMPLED_BIT;
+        }
+        blocks_allocated--;
+        noteTouched(hdr);
+        int slot = grownSlot(ptr);
+        if (slot != -1) {
+            grown[slot].payload = NULL;
+        }
+        int quick = quickIndex(getSize(hdr));
+        if (quick != -1) {
+            *hdr |= QUICK_BIT;
+            setNext((link *) ptr, quick_lists[quick]);
+            quick_lists[quick] = ptr;
+            if (++nquick >= (maintained ? MALLOPT_QUICK_LIMIT_MAX : quick_limit)) {
+                flushQuick();
+            }
+            return;
+        }
+        link *freed = (link *) ptr;
+        linkFree(freed);
+        coalesce(ptr);  // goes to coalesce helper function
+        statusFree(hdr);
+        coalesceBack(hdr);
+    }
+}
+
+/* MAIN FUNCTION - myrealloc
+ * --------------------------
+ * Given an old pointer to a heap block payload and the new size
+ * that the block is expanding to, returns a pointer to the payload
+ * of a heap block that is new_size bytes large.
+ *
+ * A block grows in place when the block after it is free and
+ * big enough; otherwise it moves.  Blocks that grow are noted
+ * in the grown ring, and one that grows again is probably being
+ * appended to, so it gets room for more: realloc_growth percent
+ * of its current size (1.5x by default), in place or wherever
+ * it moves to.  Only the bytes the client asked for are copied
+ * when it moves.  The headroom is taken back if the heap fills
+ * up (see reclaimSlack).  Growing blocks never go in the
+ * nursery.
+ */
+void *myrealloc(void *old_ptr, size_t new_size) {
+    HEAP_LOCK();
+    new_size = roundup(new_size, ALIGNMENT);
+    // if no old_ptr specified, just do regular mymalloc
+    if (old_ptr == NULL) {
+        return mymalloc(new_size);
+    }
+    header *hdr = accessHeader(old_ptr);
+    if (isNursery(hdr)) {  // a nursery object that grows moves into the heap itself
+        size_t old_size = nurserySize(hdr);
+        if (new_size <= old_size) {
+            counters.realloc_in_place++;
+            return old_ptr;
+        }
+        void *result = heapAlloc(new_size);
+        if (result == NULL) {
+            return NULL;
+        }
+        memcpy(result, old_ptr, old_size);
+        myfree(old_ptr);
+        counters.realloc_copied++;
+        counters.realloc_bytes_copied += old_size;
+        return result;
+    }
+    size_t old_size = getSize(hdr);
+    int slot = grownSlot(old_ptr);
+    // if specified new_size is smaller than the old_size, do not change anything.
+    // myrealloc only expands
+    if (new_size <= old_size) {
+        if (slot != -1) {
+            grown[slot].used = new_size;
+        }
+        counters.realloc_in_place++;
+        return old_ptr;
+    }
+    size_t reserve = new_size;
+    if (slot != -1) {  // grown before, so leave room to grow again
+        size_t headroom = roundup(old_size * realloc_growth / 100, ALIGNMENT);
+        if (headroom > reserve && headroom <= MAX_REQUEST_SIZE) {
+            reserve = headroom;
+        }
+    }
+    if (growInPlace(hdr, new_size, reserve)) {
+        noteGrown(slot, old_ptr, new_size);
+        counters.realloc_in_place++;
+        return old_ptr;
+    }
+    // mymalloc a bigger heap block, or just big enough if that fails
+    void *result = heapAlloc(reserve);
+    if (result == NULL && reserve > new_size) {
+        result = heapAlloc(new_size);
+    }
+    if (result == NULL) {
+        return NULL;
+    }
+    size_t copied = slot != -1 ? grown[slot].used : old_size;
+    memcpy(result, old_ptr, copied);  // copies memory from old block to new block
+    myfree(old_ptr);
+    noteGrown(slot, result, new_size);
+    counters.realloc_copied++;
+    counters.realloc_bytes_copied += copied;
+    return result;
+}
+
+/* HELPER FUNCTION: linkedListWrong
+ * ---------------------------------
+ * Given a block in the linked list that should be free,
+ * check if the list is wired incorrectly in terms of the 
+ * order (including address order, if that is in use) or
+ * if an allocated block is included.
+ */
+bool linkedListWrong(link *curr) {
+    header *curr_hdr = accessHeader(curr);
+    // if the order of the list does not make sense
+    link *previous = getPrevious(curr);
+    link *next = getNext(curr);
+    if ((previous != NULL && getNext(previous) != curr) ||
+        (next != NULL && getPrevious(next) != curr)) {  
+        return true;
+    }
+    if (free_order == FREE_ORDER_ADDRESS && next != NULL && next <= curr) {
+        return true;
+    }
+        // if something in the list is not free
+    if (isAllocated(curr_hdr)) {  
+        return true;
+    }
+    return false;
+}
+
+/* HELPER FUNCTION : inSegment
+ * -----------------------------
+ * Returns true if the given address lies inside the
+ * blocks of one of the heap's segments.
+ */
+bool inSegment(void *addr) {
+    return segmentEnd(addr) != NULL;
+}
+
+/* HELPER FUNCTION : skipListWrong
+ * ---------------------------------
+ * Checks that each level above the linked list (empty in
+ * LIFO order) holds only free blocks inside the heap, in
+ * ascending address order.  Returns true if anything is
+ * wrong.
+ */
+bool skipListWrong() {
+    for (int level = 1; level < SKIP_LEVELS; level++) {
+        for (link *curr = skip_heads[level]; curr != NULL; curr = getForward(curr, level)) {
+            link *next = getForward(curr, level);
+            if (!inSegment(curr) || isAllocated(accessHeader(curr)) ||
+                (next != NULL && next <= curr)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* HELPER FUNCTION : blockWrong
+ * ------------------------------
+ * Given a header pointer, check that it lies inside the heap
+ * with an aligned payload, that only allocated blocks have the
+ * sampled or quick bit (never both), that quick blocks are small
+ * enough for a quick list and that the block does not run past the end of
+ * its segment.  Free blocks also have their list links checked
+ * with linkedListWrong.  Returns true if anything is wrong.
+ */
+bool blockWrong(header *hdr) {
+    if (!inSegment(hdr) || ((size_t) accessPayload(hdr) & (ALIGNMENT - 1)) != 0) {
+        return true;
+    }
+    if (!isAllocated(hdr) && (*hdr & (SAMPLED_BIT | QUICK_BIT))) {
+        return true;
+    }
+    if (isQuick(hdr) && ((*hdr & SAMPLED_BIT) || quickIndex(getSize(hdr)) == -1)) {
+        return true;
+    }
+    if (getSize(hdr) > (size_t) (segmentEnd(hdr) - (char *) accessPayload(hdr))) {
+        return true;
+    }
+    if (!isAllocated(hdr)) {
+        link *curr = (link *) accessPayload(hdr);
+        if ((getPrevious(curr) != NULL && !inSegment(getPrevious(curr))) ||
+            (getNext(curr) != NULL && !inSegment(getNext(curr)))) {
+            return true;
+        }
+        return linkedListWrong(curr);
+    }
+    return false;
+}
+
+/* HELPER FUNCTION : quickListsWrong
+ * ------------------------------------
+ * Goes through every quick list and checks that each
+ * block in it is a quick block of the list's exact size,
+ * and that they add up to nquick.
+ */
+bool quickListsWrong() {
+    size_t count = 0;
+    for (int i = 0; i < QUICK_BINS; i++) {
+        for (link *block = quick_lists[i]; block != NULL; block = getNext(block)) {
+            header *hdr = accessHeader(block);
+            if (blockWrong(hdr) || !isQuick(hdr) ||
+                quickIndex(getSize(hdr)) != i || ++count > nquick) {
+                return true;
+            }
+        }
+    }
+    return count != nquick;
+}
+
+/* HELPER FUNCTION : validate_heap
+ * --------------------------------
+ * Runs the most thorough level of checking.
+ */
+bool validate_heap() {
+    return validate_heap_level(VALIDATE_FULL);
+}
+
+/* HELPER FUNCTION : validate_heap_level
+ * --------------------------------------
+ * The cheap checks make sure blocks_allocated is not negative,
+ * that the head of the linked list is a free block inside the
+ * heap and that the first and most recently touched headers
+ * are sane.
+ * The incremental checks also look at every header touched
+ * since the last check, then at the next WINDOW_BLOCKS blocks
+ * after window_cursor (wrapping around at the end of the heap).
+ * coalesce keeps both pointing at real headers.
+ * The full check goes through the entire linked list and calls
+ * the linkedListWrong helper function to make sure it is 
+ * not wired incorrectly.
+ * In adddition, it goes through the entire heap and 
+ * makes sure that the number of allocated blocks matches
+ * the block_allocated variable that was being continually
+ * updated as myfree and mymalloc were being called
+ * (blocks on quick lists are not counted) and that
+ * the quick lists hold what they should.
+ */
+bool validate_heap_level(validate_level level) {
+    HEAP_LOCK();
+    if (level == VALIDATE_NONE) {
+        return true;
+    }
+
+    if (blocks_allocated < 0) {
+        printf("ERROR! More blocks freed than allocated.");
+        breakpoint();
+        return false;
+    }
+    if (linked_start != NULL && (!inSegment(linked_start) ||
+        isAllocated(accessHeader(linked_start)) || getPrevious(linked_start) != NULL)) {
+        printf("ERROR! Head of the free list is not a free block.");
+        breakpoint();
+        return false;
+    }
+    if (blockWrong(start_hdr) ||
+        (ntouched > 0 && blockWrong(touched[(ntouched - 1) % TOUCHED_RING]))) {
+        printf("ERROR! Corrupt block header.");
+        breakpoint();
+        return false;
+    }
+
+    if (level == VALIDATE_INCREMENTAL) {
+        size_t count = ntouched < TOUCHED_RING ? ntouched : TOUCHED_RING;
+        for (size_t i = 0; i < count; i++) {
+            if (blockWrong(touched[i])) {
+                printf("ERROR! Corrupt header in a recently used block.");
+                breakpoint();
+                return false;
+            }
+        }
+        ntouched = 0;
+        for (int i = 0; i < WINDOW_BLOCKS; i++) {
+            if (blockWrong(window_cursor)) {
+                printf("ERROR! Corrupt block header.");
+                breakpoint();
+                return false;
+            }
+            window_cursor = followingBlock(window_cursor);
+            if (window_cursor == NULL) {
+                window_cursor = start_hdr;
+            }
+        }
+        return true;
+    }
+    if (level != VALIDATE_FULL) {
+        return true;
+    }
+
+    bool result =  true;
+
+    // checks that nothing has overwritten the sentinels of added segments
+    for (int i = 0; i < nextensions; i++) {
+        if (*extensions[i].sentinel != SENTINEL) {
+            printf("ERROR! Segment sentinel overwritten.");
+            breakpoint();
+            return false;
+        }
+    }
+
+    // checks whether the number of allocated blocks checks out
+    header *ptr = start_hdr;
+    int check_allocated = 0;
+    while (ptr != NULL) {
+        if (blockWrong(ptr)) {
+            printf("ERROR! Corrupt block header.");
+            breakpoint();
+            return false;
+        }
+        if (isAllocated(ptr) && !isQuick(ptr)) {
+            check_allocated++;
+        }
+        ptr = followingBlock(ptr);
+    }
+    if (quickListsWrong()) {
+        printf("ERROR! Quick lists are corrupt.");
+        breakpoint();
+        return false;
+    }
+    if (skipListWrong()) {
+        printf("ERROR! Free list levels are corrupt.");
+        breakpoint();
+        return false;
+    }
+    // Should be equal if heap blocks were allocated properly
+    if (check_allocated != blocks_allocated) {
+        printf("ERROR! nused and check_nused do not match up.");
+        breakpoint();
+        result = false;
+    }
+
+    // checks if the linked list was built correctly (it is empty
+    // when every segment is full, as one added by myextend can be)
+    link *curr = linked_start;
+    while (curr != NULL) {
+        if (linkedListWrong(curr)) {
+            result = false;
+        }
+        curr = getNext(curr);
+    }
+    return result;
+}
+
+/* HELPER FUNCTION : rebuildHeap
+ * -------------------------------
+ * Used by myattach when the heap was not detached cleanly.
+ * Goes through the entire heap checking every header, and
+ * rebuilds the linked list and blocks_allocated from the
+ * headers alone.  Blocks that were on quick lists are freed,
+ * and sampled marks are dropped since the profiler's records
+ * are gone.  Returns false if any header is corrupt.
+ */
+bool rebuildHeap() {
+    linked_start = NULL;
+    blocks_allocated = 0;
+    header *hdr = start_hdr;
+    while ((char *) hdr != segment_end) {
+        if (!inSegment(hdr) || ((size_t) accessPayload(hdr) & (ALIGNMENT - 1)) != 0 ||
+            getSize(hdr) > (size_t) (segment_end - (char *) accessPayload(hdr))) {
+            return false;
+        }
+        *hdr &= ~SAMPLED_BIT;
+        if (isQuick(hdr)) {
+            *hdr &= ~QUICK_BIT;
+            statusFree(hdr);
+        }
+        if (isAllocated(hdr)) {
+            blocks_allocated++;
+        } else {
+            linkFree((link *) accessPayload(hdr));
+        }
+        hdr = nextBlock(hdr);
+    }
+    return true;
+}
+
+/* MAIN FUNCTION : myattach
+ * -------------------------
+ * Given the same heap_start and heap_size that myinit was
+ * given in an earlier process, checks the metadata at the
+ * end of the heap.  If mydetach left it clean and its
+ * checksum matches, the linked list and block count are
+ * taken from it and the cheap validation checks are run;
+ * otherwise (or if those fail) rebuildHeap recovers the
+ * heap from its headers.  In address order the linked
+ * list is rebuilt either way (see relinkFree).  The metadata is marked as in
+ * use again before returning.
+ */
+bool myattach(void *heap_start, size_t heap_size) {
+    HEAP_LOCK();
+    if (!setBounds(heap_start, heap_size) ||
+        memcmp(meta->magic, HEAP_MAGIC, sizeof(meta->magic)) != 0 ||
+        meta->layout != HEAP_LAYOUT || meta->heap_start != (size_t) heap_start ||
+        meta->heap_size != heap_size) {
+        return false;
+    }
+    bool resumed = false;
+    if (meta->clean && meta->checksum == metaChecksum() &&
+        meta->free_list < segment_size && meta->blocks_allocated <= segment_size) {
+        linked_start = meta->free_list == 0 ? NULL
+                     : (link *) ((char *) segment_start + meta->free_list);
+        blocks_allocated = meta->blocks_allocated;
+        resumed = validate_heap_level(VALIDATE_CHEAP);
+    }
+    if (!resumed && !rebuildHeap()) {
+        return false;
+    }
+    if (resumed && free_order == FREE_ORDER_ADDRESS) {  // the upper levels are not kept
+        relinkFree();
+    }
+    if (meta->root != NULL && !inSegment(meta->root)) {
+        return false;
+    }
+    high_water = segment_end;  // not recorded, so all of it may have been used
+    writeMeta(false);
+    return true;
+}
+
+/* MAIN FUNCTION : mydetach
+ * -------------------------
+ * Stops the maintenance thread, if there is one, empties
+ * the quick lists (their blocks are not recorded
+ * anywhere in the heap), frees the nursery chunks that
+ * hold nothing (the next myattach would not know them)
+ * and writes the metadata as clean.  A heap with segments
+ * added by myextend is left marked as in use, so that the
+ * next myattach rebuilds the first segment's free list
+ * without the links into segments that are gone.
+ */
+void mydetach() {
+#ifdef THREAD_SAFE
+    setMaintenance(0);  // before HEAP_LOCK, since the thread may be waiting for it
+#endif
+    HEAP_LOCK();
+    if (nquick > 0) {
+        flushQuick();
+    }
+    releaseSpares();
+    if (nursery != NULL && nursery->live == 0) {
+        freeChunk(nursery);
+    }
+    nursery = NULL;
+    writeMeta(nextensions == 0);
+}
+
+/* MAIN FUNCTION : myroot
+ * -----------------------
+ * Returns the root slot in the metadata, or NULL
+ * before a heap has been set up.
+ */
+void **myroot() {
+    if (meta == NULL) {
+        return NULL;
+    }
+    return &meta->root;
+}
+
+/* MAIN FUNCTION : myextend
+ * -------------------------
+ * Adds the given memory to the heap as a segment of its
+ * own (see addSegment).
+ */
+bool myextend(void *start, size_t size) {
+    HEAP_LOCK();
+    return addSegment(start, size);
+}
+
+/* MAIN FUNCTION : mygrow_hook
+ * ----------------------------
+ * Sets the function searchBlock asks for another segment
+ * when nothing fits (see growHeap).
+ */
+void mygrow_hook(heap_grow_fn grow) {
+    HEAP_LOCK();
+    grow_hook = grow;
+}
+
+#ifdef THREAD_SAFE
+/* HELPER FUNCTION : maintainLoop
+ * --------------------------------
+ * Body of the maintenance thread: calls mymaintain every
+ * maintain_interval microseconds until it is set to 0.
+ * Waiting on maintain_wake, rather than sleeping, lets a
+ * new interval take effect (or the thread stop) at once.
+ */
+void *maintainLoop(void *unused) {
+    pthread_mutex_lock(&maintain_lock);
+    while (maintain_interval > 0) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        long nsec = until.tv_nsec + maintain_interval % 1000000 * 1000;
+        until.tv_sec += maintain_interval / 1000000 + nsec / 1000000000;
+        until.tv_nsec = nsec % 1000000000;
+        if (pthread_cond_timedwait(&maintain_wake, &maintain_lock, &until) != 0 &&
+            maintain_interval > 0) {  // timed out rather than woken by setMaintenance
+            pthread_mutex_unlock(&maintain_lock);
+            mymaintain();
+            pthread_mutex_lock(&maintain_lock);
+        }
+    }
+    pthread_mutex_unlock(&maintain_lock);
+    return NULL;
+}
+
+/* HELPER FUNCTION : setMaintenance
+ * ----------------------------------
+ * Sets the maintenance thread's interval, starting the
+ * thread if it was stopped, or stopping it and waiting for
+ * it to finish if interval is 0.  Must not be called with
+ * the heap lock held, since the thread may be waiting for
+ * it.  Returns false if the thread could not be started.
+ */
+bool setMaintenance(long interval) {
+    pthread_mutex_lock(&maintain_lock);
+    bool was_running = maintain_interval > 0;
+    maintain_interval = interval;
+    pthread_cond_signal(&maintain_wake);
+    pthread_mutex_unlock(&maintain_lock);
+    if (interval > 0 && !was_running) {
+        if (pthread_create(&maintainer, NULL, maintainLoop, NULL) != 0) {
+            pthread_mutex_lock(&maintain_lock);
+            maintain_interval = 0;
+            pthread_mutex_unlock(&maintain_lock);
+            return false;
+        }
+        HEAP_LOCK();
+        maintained = true;
+    } else if (interval == 0 && was_running) {
+        {
+            HEAP_LOCK();
+            maintained = false;
+        }
+        pthread_join(maintainer, NULL);
+    }
+    return true;
+}
+#endif
+
+/* MAIN FUNCTION : mymallopt
+ * ---------------------------
+ * Sets the largest payload kept on a quick list (0 turns
+ * them off) or how many blocks they may hold before being
+ * flushed.  Anything already held is flushed first so the
+ * quick lists always match the current settings.
+ * Also sets the percentage a block that myrealloc grows
+ * again may grow to (100 turns the headroom off), which
+ * requests the nursery takes (LIFETIME_*), the order of
+ * the linked list (FREE_ORDER_*, rebuilt on a change; see
+ * relinkFree) and, in the thread-safe build, how often the
+ * maintenance thread runs (0 stops it; see setMaintenance).
+ */
+bool mymallopt(mallopt_param param, long value) {
+#ifdef THREAD_SAFE
+    if (param == MALLOPT_MAINTENANCE_US) {  // handled before HEAP_LOCK (see setMaintenance)
+        return value >= 0 && value <= MAINTAIN_INTERVAL_MAX && setMaintenance(value);
+    }
+#endif
+    HEAP_LOCK();
+    if (param == MALLOPT_QUICK_MAX && value >= 0 && value <= QUICK_MAX_SIZE) {
+        if (nquick > 0) {
+            flushQuick();
+        }
+        quick_max = value;
+        return true;
+    }
+    if (param == MALLOPT_QUICK_LIMIT && value >= MALLOPT_QUICK_LIMIT_MIN &&
+        value <= MALLOPT_QUICK_LIMIT_MAX) {
+        if (nquick > 0) {
+            flushQuick();
+        }
+        quick_limit = value;
+        return true;
+    }
+    if (param == MALLOPT_REALLOC_GROWTH && value >= 100 && value <= GROWTH_MAX) {
+        realloc_growth = value;
+        return true;
+    }
+    if (param == MALLOPT_LIFETIME && value >= LIFETIME_OFF && value <= LIFETIME_PREDICT) {
+        lifetime_mode = value;
+        return true;
+    }
+    if (param == MALLOPT_FREE_ORDER && (value == FREE_ORDER_LIFO || value == FREE_ORDER_ADDRESS)) {
+        if (value != free_order) {
+            free_order = value;
+            if (segment_start != NULL) {
+                relinkFree();
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+/* MAIN FUNCTION : mycompact
+ * ---------------------------
+ * Starting at compact_cursor, looks for a free block followed
+ * by an allocated block that can_move allows, and swaps them:
+ * the allocated block (header and payload) slides down to where
+ * the free block started, and the free block goes after it,
+ * coalescing with whatever free block follows.  Free space thus
+ * bubbles toward the end of each segment.  Quick lists are flushed
+ * first, and blocks sampled by the heap profiler never move.
+ * Returns once budget bytes have moved or the end of the heap is
+ * reached, in which case the next call starts over at the front.
+ */
+size_t mycompact(size_t budget, bool (*can_move)(void *payload),
+    void (*moved)(void *old_payload, void *new_payload)) {
+    HEAP_LOCK();
+    if (nquick > 0) {
+        flushQuick();
+    }
+    size_t total = 0;
+    while (total < budget) {
+        header *hdr = compact_cursor;
+        header *next = nextBlock(hdr);
+        if (endsSegment(hdr)) {  // blocks never move from one segment to another
+            compact_cursor = followingBlock(hdr);
+            if (compact_cursor == NULL) {
+                compact_cursor = start_hdr;  // wrap around for the next call
+                break;
+            }
+            continue;
+        }
+        if (isAllocated(hdr)) {
+            compact_cursor = next;
+            continue;
+        }
+        if (!isAllocated(next)) {  // two free blocks in a row: merge them and look again
+            coalesce(accessPayload(hdr));
+            continue;
+        }
+        if ((*next & SAMPLED_BIT) || !can_move(accessPayload(next))) {
+            compact_cursor = next;
+            continue;
+        }
+        size_t free_size = getSize(hdr);
+        size_t size = getSize(next);
+        void *old_payload = accessPayload(next);
+        forgetPurge(hdr);
+        unlinkFree((link *) accessPayload(hdr));
+        memmove(hdr, next, HEADER_SIZE + size);
+        header *rest = nextBlock(hdr);
+        setSize(rest, free_size);
+        linkFree((link *) accessPayload(rest));
+        forgetAbsorbed(next, rest);
+        noteTouched(hdr);
+        noteTouched(rest);
+        moved(old_payload, accessPayload(hdr));
+        int slot = grownSlot(old_payload);
+        if (slot != -1) {
+            grown[slot].payload = accessPayload(hdr);
+        }
+        compact_cursor = rest;
+        coalesce(accessPayload(rest));
+        total += size;
+    }
+    counters.bytes_compacted += total;
+    return total;
+}
+
+/* HELPER FUNCTION : purgeBlock
+ * -------------------------------
+ * Given a free block of at least PURGE_MIN bytes, gives
+ * the whole pages inside its payload back to the OS with
+ * madvise, keeping the page that holds its links and
+ * purgeMark's note.  In the first segment, pages past
+ * high_water were never touched and are left alone.
+ * Pages the note says were purged already are skipped,
+ * so a block that grew only has its new pages purged.
+ * Returns the bytes newly given back.
+ */
+size_t purgeBlock(header *hdr) {
+    size_t *mark = purgeMark(hdr);
+    size_t start = ((size_t) (mark + 2) + PAGE_SIZE - 1) & ~(size_t) (PAGE_SIZE - 1);
+    size_t end = (size_t) nextBlock(hdr) & ~(size_t) (PAGE_SIZE - 1);
+    if ((char *) hdr >= (char *) segment_start && (char *) hdr < (char *) segment_end) {
+        size_t used = ((size_t) high_water + PAGE_SIZE - 1) & ~(size_t) (PAGE_SIZE - 1);
+        end = end < used ? end : used;
+    }
+    if (mark[0] == ((size_t) hdr ^ PURGE_TAG) && mark[1] > start) {
+        start = mark[1];
+    }
+    if (end <= start || madvise((void *) start, end - start, MADV_DONTNEED) != 0) {
+        return 0;
+    }
+    mark[0] = (size_t) hdr ^ PURGE_TAG;
+    mark[1] = end;
+    return end - start;
+}
+
+/* MAIN FUNCTION : mymaintain
+ * ----------------------------
+ * Work that myfree and mymalloc would otherwise do inline.
+ * Flushes the quick lists once they are half full, so that
+ * myfree rarely reaches quick_limit and has to flush them
+ * in the middle of a request.  Then, starting at
+ * maintain_cursor, looks at up to MAINTAIN_BLOCKS blocks:
+ * each free block absorbs any free blocks after it (myfree
+ * only coalesces forward, so a block freed before the one
+ * after it stays split until now), and large ones have
+ * their pages given back (see purgeBlock).  The next call
+ * carries on where this one stopped, wrapping around at
+ * the end of the heap, so the heap lock is only held for
+ * a bounded time.
+ */
+void mymaintain() {
+    HEAP_LOCK();
+    if (segment_start == NULL) {
+        return;
+    }
+    counters.maintenance_passes++;
+    if (nquick > 0 && nquick >= quick_limit / 2) {
+        flushQuick();
+    }
+    for (int i = 0; i < MAINTAIN_BLOCKS; i++) {
+        header *hdr = maintain_cursor;
+        if (!isAllocated(hdr)) {
+            bool merged = false;
+            while (coalesce(accessPayload(hdr))) {
+                counters.blocks_merged++;
+                merged = true;
+            }
+            if (merged) {
+                noteTouched(hdr);
+            }
+            if (getSize(hdr) >= PURGE_MIN) {
+                counters.bytes_purged += purgeBlock(hdr);
+            }
+        }
+        maintain_cursor = followingBlock(hdr);
+        if (maintain_cursor == NULL) {
+            maintain_cursor = start_hdr;
+            break;
+        }
+    }
+}
+
+/* MAIN FUNCTION : mystats
+ * ------------------------
+ * Copies the running counters, goes through the linked list
+ * to total up the free blocks and counts everything else in
+ * the heap (minus headers and blocks on quick lists) as in use.
+ */
+void mystats(heap_stats *stats) {
+    HEAP_LOCK();
+    *stats = counters;
+    size_t header_bytes = (size_t) blocks_allocated * HEADER_SIZE;
+    for (link *curr = linked_start; curr != NULL; curr = getNext(curr)) {
+        size_t size = getSize(accessHeader(curr));
+        stats->bytes_free += size;
+        stats->free_blocks++;
+        if (size > stats->largest_free) {
+            stats->largest_free = size;
+        }
+    }
+    header_bytes += stats->free_blocks * HEADER_SIZE;
+    size_t held_bytes = 0;
+    for (int i = 0; i < QUICK_BINS; i++) {
+        for (link *block = quick_lists[i]; block != NULL; block = getNext(block)) {
+            held_bytes += getSize(accessHeader(block)) + HEADER_SIZE;
+        }
+    }
+    stats->quick_blocks = nquick;
+    stats->bytes_in_use = segment_size + extended_bytes - header_bytes - stats->bytes_free - held_bytes;
+}
+
+/* MAIN FUNCTION : mysnapshot
+ * ---------------------------
+ * Goes through the entire heap once and writes each
+ * block's payload offset, size and status to out
+ * (see heapmap.h).  Blocks on quick lists are shown as
+ * free.  Offsets are from segment_start and only reach
+ * 4 GiB, so segments added below it or beyond that are
+ * left out; the others count toward the heap size, along
+ * with the gaps between them.
+ */
+bool mysnapshot(FILE *out, unsigned long tag) {
+    HEAP_LOCK();
+    char *limit = (char *) segment_start + UINT32_MAX;
+    size_t heap_size = segment_size;
+    for (int i = 0; i < nextensions; i++) {
+        char *end = (char *) extensions[i].sentinel;
+        if ((char *) extensions[i].first > segment_end && end <= limit) {
+            heap_size = end - (char *) segment_start;
+        }
+    }
+    heapmap_writer writer;
+    heapmap_begin(&writer, out, segment_start, heap_size, tag);
+    for (header *ptr = start_hdr; ptr != NULL; ptr = followingBlock(ptr)) {
+        if ((char *) ptr < (char *) segment_start || (char *) ptr >= limit) {
+            continue;
+        }
+        heapmap_add(&writer, accessPayload(ptr), getSize(ptr), isAllocated(ptr) && !isQuick(ptr));
+    }
+    return heapmap_end(&writer);
 }
 
 /* HELPER FUNCTION : dump_heap
@@ -365,15 +2345,16 @@ bool validate_heap() {
  * information about each block within it.
  */
 void dump_heap() {
-    void *ptr = segment_start;
+    header *ptr = start_hdr;
     // Goes through the entire heap and prints out the size of each block and its status
-    while (ptr != segment_end)  {
+    while (ptr != NULL) {
         if (!isAllocated(ptr)) {
             printf("Block Size: %lu, Free\n", getSize(ptr));
-            ptr = nextBlock(ptr);
+        } else if (isQuick(ptr)) {
+            printf("Block Size: %lu, Quick list\n", getSize(ptr));
         } else {
             printf("Block Size: %lu, Allocated\n", getSize(ptr));
-            ptr = nextBlock(ptr);
         }
+        ptr = followingBlock(ptr);
     }
 }
@@ -0,0 +1,328 @@
+/*
+ * File: gen_script.c
+ * ------------------
+ * Generates allocator scripts in the same text format as the files in
+ * samples/ for a handful of parameterized stress patterns:
+ *
+ *   larson    server churn: a fixed set of slots, each step frees a random
+ *             slot and refills it with a new random-size block
+ *   prodcons  producer/consumer: bursts of allocations consumed in FIFO order
+ *   powerlaw  random churn with Pareto-distributed (heavy-tailed) sizes
+ *   phases    ramp-up to a live-set target, steady churn, then ramp-down
+ *   realloc   many buffers grown by repeated appends via realloc
+ *
+ * The same seed always produces the same script.  Output goes to stdout
+ * unless -o is given, so it can be piped straight into the test harness,
+ * e.g.  ./gen_script -p larson -n 10000000 | ./test_explicit -q -
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+
+
+// settings for one generated script
+typedef struct {
+    const char *pattern;
+    long num_ops;       // approximate number of requests to emit
+    int live;           // number of live slots / live-set target
+    size_t min_size;    // smallest request size
+    size_t max_size;    // largest request size
+    double alpha;       // Pareto shape for powerlaw sizes
+    uint64_t seed;
+} gen_params;
+
+// state for the random number generator (splitmix64)
+static uint64_t rng_state;
+
+// the output stream and how many requests have been written to it
+static FILE *out;
+static long nwritten;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static void gen_larson(gen_params *params);
+static void gen_prodcons(gen_params *params);
+static void gen_powerlaw(gen_params *params);
+static void gen_phases(gen_params *params);
+static void gen_realloc(gen_params *params);
+static uint64_t next_random(void);
+static size_t uniform_size(gen_params *params);
+static size_t pareto_size(gen_params *params);
+static void emit_alloc(int id, size_t size);
+static void emit_realloc(int id, size_t size);
+static void emit_free(int id);
+
+
+// table of patterns selectable with -p
+static const struct {
+    const char *name;
+    void (*generate)(gen_params *);
+} patterns[] = {
+    {"larson", gen_larson},
+    {"prodcons", gen_prodcons},
+    {"powerlaw", gen_powerlaw},
+    {"phases", gen_phases},
+    {"realloc", gen_realloc},
+};
+#define NUM_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+
+/* Function: main
+ * --------------
+ * Parses the command-line flags and writes one generated script.
+ */
+int main(int argc, char *argv[]) {
+    gen_params params = {
+        .pattern = "larson",
+        .num_ops = 100000,
+        .live = 1000,
+        .min_size = 8,
+        .max_size = 512,
+        .alpha = 1.2,
+        .seed = 107,
+    };
+    const char *outfile = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "p:n:l:m:M:a:s:o:")) != EOF) {
+        switch (c) {
+            case 'p': params.pattern = optarg; break;
+            case 'n': params.num_ops = atol(optarg); break;
+            case 'l': params.live = atoi(optarg); break;
+            case 'm': params.min_size = strtoul(optarg, NULL, 10); break;
+            case 'M': params.max_size = strtoul(optarg, NULL, 10); break;
+            case 'a': params.alpha = atof(optarg); break;
+            case 's': params.seed = strtoull(optarg, NULL, 10); break;
+            case 'o': outfile = optarg; break;
+            default:
+                error(1, 0, "Usage: %s [-p pattern] [-n ops] [-l live] [-m min] [-M max] "
+                    "[-a alpha] [-s seed] [-o file]", argv[0]);
+        }
+    }
+    if (params.live < 1 || params.num_ops < 1 || params.min_size > params.max_size ||
+        params.max_size > MAX_REQUEST_SIZE || params.alpha <= 0) {
+        error(1, 0, "Invalid parameters.");
+    }
+
+    size_t i = 0;
+    while (i < NUM_PATTERNS && strcmp(params.pattern, patterns[i].name) != 0) {
+        i++;
+    }
+    if (i == NUM_PATTERNS) {
+        error(1, 0, "Unknown pattern '%s'.", params.pattern);
+    }
+
+    out = stdout;
+    if (outfile != NULL && (out = fopen(outfile, "w")) == NULL) {
+        error(1, 0, "Could not open output file \"%s\".", outfile);
+    }
+    rng_state = params.seed;
+    fprintf(out, "# Generated by gen_script: pattern=%s ops=%ld live=%d "
+        "min=%zu max=%zu alpha=%g seed=%lu\n", params.pattern, params.num_ops,
+        params.live, params.min_size, params.max_size, params.alpha,
+        (unsigned long)params.seed);
+    patterns[i].generate(&params);
+    if (fclose(out) != 0) {
+        error(1, 0, "Error writing script.");
+    }
+    return 0;
+}
+
+
+/* PATTERN GENERATORS */
+
+
+/* Function: gen_larson
+ * --------------------
+ * Larson-style server churn.  Fills `live` slots, then repeatedly picks a
+ * random slot, frees its block and allocates a new one of random size, so
+ * the live set stays constant while object ages are random.
+ */
+static void gen_larson(gen_params *params) {
+    for (int id = 0; id < params->live && nwritten < params->num_ops; id++) {
+        emit_alloc(id, uniform_size(params));
+    }
+    while (nwritten < params->num_ops) {
+        int id = next_random() % params->live;
+        emit_free(id);
+        emit_alloc(id, uniform_size(params));
+    }
+}
+
+/* Function: gen_prodcons
+ * ----------------------
+ * Producer/consumer queue.  The producer allocates a random-length burst of
+ * messages onto a ring of `live` entries, then the consumer frees a
+ * random-length burst from the oldest end, so blocks die in FIFO order.
+ */
+static void gen_prodcons(gen_params *params) {
+    long head = 0, tail = 0;    // next id to produce / consume (mod live)
+    while (nwritten < params->num_ops) {
+        int burst = 1 + next_random() % (params->live / 4 + 1);
+        for (int i = 0; i < burst && head - tail < params->live; i++, head++) {
+            emit_alloc(head % params->live, uniform_size(params));
+        }
+        burst = 1 + next_random() % (params->live / 4 + 1);
+        for (int i = 0; i < burst && tail < head; i++, tail++) {
+            emit_free(tail % params->live);
+        }
+    }
+}
+
+/* Function: gen_powerlaw
+ * ----------------------
+ * Random churn like gen_larson, but sizes follow a Pareto distribution
+ * starting at min_size, so most requests are small with a heavy tail of
+ * large ones.  Slots are only partly filled at the start and are freed or
+ * refilled at random, so the live set drifts around half of `live`.
+ */
+static void gen_powerlaw(gen_params *params) {
+    bool *in_use = calloc(params->live, sizeof(bool));
+    if (!in_use) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    while (nwritten < params->num_ops) {
+        int id = next_random() % params->live;
+        if (in_use[id]) {
+            emit_free(id);
+        } else {
+            emit_alloc(id, pareto_size(params));
+        }
+        in_use[id] = !in_use[id];
+    }
+    free(in_use);
+}
+
+/* Function: gen_phases
+ * --------------------
+ * Program-lifetime phases.  A quarter of the ops (but no more than `live`
+ * blocks) ramp the live set up, half are steady-state random replacement,
+ * and the last quarter ramps back down by freeing the survivors in random
+ * order.  Repeats while the ops budget allows; the last round is cut off
+ * wherever the budget runs out.
+ */
+static void gen_phases(gen_params *params) {
+    int ramp = params->num_ops / 4 < params->live ? params->num_ops / 4 : params->live;
+    if (ramp < 1) {
+        ramp = 1;
+    }
+    int *order = malloc(ramp * sizeof(int));
+    if (!order) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    long steady = params->num_ops / 2;
+    while (nwritten < params->num_ops) {
+        int nramped = 0;
+        for (; nramped < ramp && nwritten < params->num_ops; nramped++) {
+            emit_alloc(nramped, uniform_size(params));
+        }
+        for (long i = 0; i < steady / 2 && nwritten < params->num_ops; i++) {
+            int id = next_random() % nramped;
+            emit_free(id);
+            emit_alloc(id, uniform_size(params));
+        }
+        // Fisher-Yates shuffle for the ramp-down order
+        for (int i = 0; i < nramped; i++) {
+            order[i] = i;
+        }
+        for (int i = nramped - 1; i > 0; i--) {
+            int j = next_random() % (i + 1);
+            int tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+        for (int i = 0; i < nramped && nwritten < params->num_ops; i++) {
+            emit_free(order[i]);
+        }
+    }
+    free(order);
+}
+
+/* Function: gen_realloc
+ * ---------------------
+ * Append-heavy buffers.  Each of `live` buffers starts at min_size and is
+ * grown by small random increments with realloc, the way a string builder
+ * or vector grows.  A buffer that passes max_size is freed and restarted.
+ */
+static void gen_realloc(gen_params *params) {
+    size_t *sizes = calloc(params->live, sizeof(size_t));
+    if (!sizes) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int id = 0; id < params->live && nwritten < params->num_ops; id++) {
+        sizes[id] = params->min_size;
+        emit_alloc(id, sizes[id]);
+    }
+    while (nwritten < params->num_ops) {
+        int id = next_random() % params->live;
+        size_t step = 1 + next_random() % (params->min_size + 16);
+        if (sizes[id] + step > params->max_size) {
+            emit_free(id);
+            sizes[id] = params->min_size;
+            emit_alloc(id, sizes[id]);
+        } else {
+            sizes[id] += step;
+            emit_realloc(id, sizes[id]);
+        }
+    }
+    free(sizes);
+}
+
+
+/* HELPERS */
+
+
+/* Function: next_random
+ * ---------------------
+ * Returns the next value from a splitmix64 generator, which is fast and
+ * fully determined by the seed.
+ */
+static uint64_t next_random(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Function: uniform_size
+ * ----------------------
+ * Returns a size chosen uniformly from [min_size, max_size].
+ */
+static size_t uniform_size(gen_params *params) {
+    return params->min_size + next_random() % (params->max_size - params->min_size + 1);
+}
+
+/* Function: pareto_size
+ * ---------------------
+ * Returns a Pareto-distributed size with scale min_size and shape alpha,
+ * clamped to max_size.
+ */
+static size_t pareto_size(gen_params *params) {
+    double u = (next_random() >> 11) * (1.0 / 9007199254740992.0);  // [0, 1)
+    double size = params->min_size / pow(1.0 - u, 1.0 / params->alpha);
+    return size > params->max_size ? params->max_size : (size_t)size;
+}
+
+static void emit_alloc(int id, size_t size) {
+    fprintf(out, "a %d %zu\n", id, size);
+    nwritten++;
+}
+
+static void emit_realloc(int id, size_t size) {
+    fprintf(out, "r %d %zu\n", id, size);
+    nwritten++;
+}
+
+static void emit_free(int id) {
+    fprintf(out, "f %d\n", id);
+    nwritten++;
+}
@@ -0,0 +1,115 @@
+/* File: handles.c
+ * ---------------
+ * The handle table described in handles.h, built on mymalloc and myfree.
+ * Free slots are chained through next_free so that handles are reused
+ * before the table grows.  The table itself comes from the C library's
+ * malloc, never from the heap being managed.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "allocator.h"
+#include "handles.h"
+
+// smallest size of the handle table
+#define MIN_HANDLES 64
+
+// bytes in front of every handle block, holding its handle
+#define HANDLE_PREFIX ALIGNMENT
+
+handle_entry *handle_table;
+
+static size_t table_capacity;
+static myhandle first_free;     // head of the chain of free slots, 0 if none
+static myhandle next_unused = 1; // slots from here to the end have never been used
+
+
+/* Function: block_handle
+ * ----------------------
+ * Returns the handle whose block has this payload, or 0 if the payload
+ * does not belong to a live handle (an ordinary mymalloc block, say).
+ */
+static myhandle block_handle(void *payload) {
+    myhandle h = *(myhandle *)payload;
+    if (h == 0 || h >= next_unused ||
+        handle_table[h].ptr != (char *)payload + HANDLE_PREFIX) {
+        return 0;
+    }
+    return h;
+}
+
+/* Function: can_move
+ * ------------------
+ * mycompact callback: only unpinned handle blocks may move.
+ */
+static bool can_move(void *payload) {
+    myhandle h = block_handle(payload);
+    return h != 0 && handle_table[h].pins == 0;
+}
+
+/* Function: block_moved
+ * ---------------------
+ * mycompact callback: points the block's handle at its new address.  The
+ * handle stored in the block moved along with it.
+ */
+static void block_moved(void *old_payload, void *new_payload) {
+    myhandle h = *(myhandle *)new_payload;
+    handle_table[h].ptr = (char *)new_payload + HANDLE_PREFIX;
+}
+
+void myhreset(void) {
+    free(handle_table);
+    handle_table = NULL;
+    table_capacity = 0;
+    first_free = 0;
+    next_unused = 1;
+}
+
+myhandle myhalloc(size_t size) {
+    if (first_free == 0 && next_unused >= table_capacity) {
+        size_t capacity = table_capacity ? 2 * table_capacity : MIN_HANDLES;
+        handle_entry *grown = realloc(handle_table, capacity * sizeof(handle_entry));
+        if (grown == NULL) {
+            return 0;
+        }
+        handle_table = grown;
+        table_capacity = capacity;
+    }
+
+    void *payload = mymalloc(HANDLE_PREFIX + size);
+    if (payload == NULL) {
+        return 0;
+    }
+    myhandle h;
+    if (first_free != 0) {
+        h = first_free;
+        first_free = handle_table[h].next_free;
+    } else {
+        h = next_unused++;
+    }
+    *(myhandle *)payload = h;
+    handle_table[h] = (handle_entry){ .ptr = (char *)payload + HANDLE_PREFIX };
+    return h;
+}
+
+void myhfree(myhandle h) {
+    if (h == 0) {
+        return;
+    }
+    myfree((char *)handle_table[h].ptr - HANDLE_PREFIX);
+    handle_table[h] = (handle_entry){ .ptr = NULL, .next_free = first_free };
+    first_free = h;
+}
+
+void *myhpin(myhandle h) {
+    handle_table[h].pins++;
+    return handle_table[h].ptr;
+}
+
+void myhunpin(myhandle h) {
+    handle_table[h].pins--;
+}
+
+size_t myhcompact(size_t budget) {
+    return mycompact(budget, can_move, block_moved);
+}
@@ -0,0 +1,94 @@
+/* File: handles.h
+ * ---------------
+ * Relocatable allocations.  A block allocated with myhalloc is named by a
+ * handle rather than a pointer, and the allocator's compactor (mycompact
+ * in allocator.h) is free to move it while it is not pinned.  Clients
+ * look the block up again with myhderef whenever they need it, and must
+ * not keep the pointer across a call to myhcompact unless the block is
+ * pinned:
+ *
+ *   myhandle h = myhalloc(100);
+ *   strcpy(myhderef(h), "hello");
+ *   myhcompact(4096);                  // may move the block
+ *   char *s = myhpin(h);               // stays put until myhunpin
+ *   ...
+ *   myhunpin(h);
+ *   myhfree(h);
+ *
+ * Handles index a table kept in the C library's heap, so myhderef is a
+ * single load.  Each block starts with ALIGNMENT bytes holding its handle,
+ * which is how the compactor's callbacks find the table entry for a
+ * block.  None of this is thread-safe.
+ */
+
+#ifndef _HANDLES_H_
+#define _HANDLES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// 0 is never a valid handle, so myhalloc can return it on failure
+typedef size_t myhandle;
+
+typedef struct {
+    void *ptr;          // the client's pointer into the block, NULL if the slot is free
+    unsigned pins;      // myhpin calls not yet matched by myhunpin
+    myhandle next_free; // next free slot while this one is free
+} handle_entry;
+
+// the handle table, indexed by handle (entry 0 is unused)
+extern handle_entry *handle_table;
+
+
+/* Function: myhderef
+ * ------------------
+ * Returns the current address of a handle's block.  The address is only
+ * good until the next myhcompact, unless the handle is pinned.
+ */
+static inline void *myhderef(myhandle h) {
+    return handle_table[h].ptr;
+}
+
+/* Function: myhreset
+ * ------------------
+ * Forgets every handle.  Call after myinit, since the old blocks are gone.
+ */
+void myhreset(void);
+
+/* Function: myhalloc
+ * ------------------
+ * Allocates a relocatable block of size bytes.  Returns 0 if there was no
+ * room in the heap or the handle table could not grow.
+ */
+myhandle myhalloc(size_t size);
+
+/* Function: myhfree
+ * -----------------
+ * Frees a handle's block and the handle itself.  Freeing handle 0 does
+ * nothing.
+ */
+void myhfree(myhandle h);
+
+/* Function: myhpin
+ * ----------------
+ * Keeps a handle's block from moving until a matching myhunpin, and
+ * returns its address.  Pins nest.
+ */
+void *myhpin(myhandle h);
+
+/* Function: myhunpin
+ * ------------------
+ * Undoes one myhpin.
+ */
+void myhunpin(myhandle h);
+
+/* Function: myhcompact
+ * --------------------
+ * One incremental compaction step: moves up to about budget bytes of
+ * unpinned handle blocks toward the start of the heap (see mycompact) and
+ * returns the number of bytes moved.  Meant to be called when the client
+ * is otherwise idle; call it until it returns 0 to compact fully.
+ */
+size_t myhcompact(size_t budget);
+
+#endif
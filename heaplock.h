@@ -0,0 +1,43 @@
+/* File: heaplock.h
+ * ----------------
+ * Optional heap lock for the allocators.  When compiled with -DTHREAD_SAFE,
+ * HEAP_LOCK() at the top of a public allocator function takes a single
+ * global heap mutex which is released automatically when the function
+ * returns.  Nested calls from the same thread (e.g. myrealloc calling
+ * mymalloc) only lock once.  Without THREAD_SAFE, HEAP_LOCK() compiles
+ * to nothing.
+ */
+
+#ifndef _HEAPLOCK_H_
+#define _HEAPLOCK_H_
+
+#ifdef THREAD_SAFE
+
+#include <pthread.h>
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int heap_lock_depth;
+
+static inline int heap_lock_acquire(void) {
+    if (heap_lock_depth++ == 0) {
+        pthread_mutex_lock(&heap_lock);
+    }
+    return 0;
+}
+
+static inline void heap_lock_release(int *unused) {
+    if (--heap_lock_depth == 0) {
+        pthread_mutex_unlock(&heap_lock);
+    }
+}
+
+#define HEAP_LOCK() \
+    int heap_lock_guard __attribute__((cleanup(heap_lock_release), unused)) = heap_lock_acquire()
+
+#else
+
+#define HEAP_LOCK() do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * File: heapmap.c
+ * ---------------
+ * Turns the heap map snapshots written by the test harness (-m n, see
+ * heapmap.h) into a fragmentation timeline, one row per snapshot:
+ *
+ *   op        requests run when the snapshot was taken
+ *   extent    bytes from the segment start to the end of the last
+ *             allocated block
+ *   in use    payload bytes in allocated blocks
+ *   free      payload bytes in free blocks
+ *   blocks    number of free blocks
+ *   largest   the largest of those free blocks
+ *   frag      external fragmentation, 1 - largest / free
+ *   util      in use / extent
+ *
+ * A free block that runs to the end of the segment is untouched space
+ * rather than fragmentation, so it is left out of the free columns.
+ * After the timeline, the free block size histogram is printed for the
+ * snapshot with the worst fragmentation (or for every snapshot with -a),
+ * e.g.
+ *
+ *   ./test_explicit -q -m 1000 samples/trace-gcc.script
+ *   ./heapmap trace-gcc.script.heapmap
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "heapmap.h"
+
+// free block sizes are counted in power-of-two classes, as in mystats
+#define SIZE_CLASSES 33
+
+// width of the longest bar in a histogram
+#define BAR_WIDTH 40
+
+// totals for one snapshot
+typedef struct {
+    uint64_t tag;
+    uint64_t extent;
+    uint64_t in_use;
+    uint64_t free_bytes;
+    uint64_t free_blocks;
+    uint64_t largest_free;
+    uint64_t histogram[SIZE_CLASSES];
+} snapshot_t;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static void print_timeline(const char *path, bool all_histograms);
+static bool read_snapshot(FILE *in, const char *path, snapshot_t *snap);
+static void add_free_block(snapshot_t *snap, uint64_t size);
+static double fragmentation(const snapshot_t *snap);
+static void print_histogram(const snapshot_t *snap);
+static int size_class(uint64_t size);
+
+
+/* Function: main
+ * --------------
+ * Parses the command-line flags (-a for a histogram after every snapshot)
+ * and prints the timeline for each snapshot file that follows.
+ */
+int main(int argc, char *argv[]) {
+    bool all_histograms = false;
+    int c;
+    while ((c = getopt(argc, argv, "a")) != EOF) {
+        if (c == 'a') {
+            all_histograms = true;
+        } else {
+            error(1, 0, "Usage: %s [-a] file.heapmap...", argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        error(1, 0, "Missing argument. Please supply one or more heap map files.");
+    }
+    for (int i = optind; i < argc; i++) {
+        print_timeline(argv[i], all_histograms);
+    }
+    return 0;
+}
+
+/* Function: print_timeline
+ * ------------------------
+ * Reads every snapshot in one file, printing a timeline row for each and
+ * then the histogram for the most fragmented one.
+ */
+static void print_timeline(const char *path, bool all_histograms) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        error(1, 0, "Could not open heap map file \"%s\".", path);
+    }
+
+    printf("%s\n%10s %12s %12s %12s %8s %12s %6s %6s\n", path, "op", "extent",
+        "in use", "free", "blocks", "largest", "frag", "util");
+    snapshot_t snap, worst;
+    int nsnapshots = 0;
+    while (read_snapshot(in, path, &snap)) {
+        printf("%10lu %12lu %12lu %12lu %8lu %12lu %5.1f%% %5.1f%%\n",
+            (unsigned long)snap.tag, (unsigned long)snap.extent,
+            (unsigned long)snap.in_use, (unsigned long)snap.free_bytes,
+            (unsigned long)snap.free_blocks, (unsigned long)snap.largest_free,
+            100 * fragmentation(&snap),
+            snap.extent ? 100.0 * snap.in_use / snap.extent : 100.0);
+        if (all_histograms) {
+            print_histogram(&snap);
+        }
+        if (nsnapshots == 0 || fragmentation(&snap) > fragmentation(&worst)) {
+            worst = snap;
+        }
+        nsnapshots++;
+    }
+    fclose(in);
+
+    if (nsnapshots > 0 && !all_histograms) {
+        printf("\nFree block sizes at op %lu (worst fragmentation, %.1f%%):\n",
+            (unsigned long)worst.tag, 100 * fragmentation(&worst));
+        print_histogram(&worst);
+    }
+    printf("\n");
+}
+
+/* Function: read_snapshot
+ * -----------------------
+ * Reads the next snapshot from in and totals it into snap.  Each block is
+ * only counted once the next one has been read, so that a trailing free
+ * block reaching the end of the segment can be left out.  Returns false
+ * at the end of the file.
+ */
+static bool read_snapshot(FILE *in, const char *path, snapshot_t *snap) {
+    heapmap_header header;
+    size_t n = fread(&header, sizeof(header), 1, in);
+    if (n == 0 && feof(in)) {
+        return false;
+    }
+    if (n != 1 || memcmp(header.magic, HEAPMAP_MAGIC, sizeof(header.magic)) != 0) {
+        error(1, 0, "\"%s\" is not a heap map file.", path);
+    }
+
+    memset(snap, 0, sizeof(*snap));
+    snap->tag = header.tag;
+    heapmap_block pending = { .offset = HEAPMAP_END };
+    heapmap_block buffer[HEAPMAP_BUFFER_BLOCKS];
+    while (true) {
+        n = fread(buffer, sizeof(heapmap_block), HEAPMAP_BUFFER_BLOCKS, in);
+        if (n == 0) {
+            error(1, 0, "Heap map file \"%s\" is truncated.", path);
+        }
+        for (size_t i = 0; i < n; i++) {
+            uint64_t size = pending.size & ~HEAPMAP_ALLOCATED;
+            if (buffer[i].offset == HEAPMAP_END) {
+                // the last block: free space at the very end isn't counted
+                if (pending.offset != HEAPMAP_END && (pending.size & HEAPMAP_ALLOCATED)) {
+                    snap->in_use += size;
+                    snap->extent = pending.offset + size;
+                } else if (pending.offset != HEAPMAP_END &&
+                    pending.offset + size != header.heap_size) {
+                    add_free_block(snap, size);
+                }
+                // step back over anything read past this snapshot
+                if (i + 1 < n && fseek(in, -(long)((n - i - 1) * sizeof(heapmap_block)),
+                    SEEK_CUR) != 0) {
+                    error(1, 0, "Could not seek in heap map file \"%s\".", path);
+                }
+                return true;
+            }
+            if (pending.offset != HEAPMAP_END) {
+                if (pending.size & HEAPMAP_ALLOCATED) {
+                    snap->in_use += size;
+                    snap->extent = pending.offset + size;
+                } else {
+                    add_free_block(snap, size);
+                }
+            }
+            pending = buffer[i];
+        }
+    }
+}
+
+static void add_free_block(snapshot_t *snap, uint64_t size) {
+    snap->free_bytes += size;
+    snap->free_blocks++;
+    if (size > snap->largest_free) {
+        snap->largest_free = size;
+    }
+    snap->histogram[size_class(size)]++;
+}
+
+/* Function: fragmentation
+ * -----------------------
+ * Returns the external fragmentation of a snapshot: the fraction of free
+ * bytes that are not in the largest free block.
+ */
+static double fragmentation(const snapshot_t *snap) {
+    if (snap->free_bytes == 0) {
+        return 0;
+    }
+    return 1.0 - (double)snap->largest_free / snap->free_bytes;
+}
+
+/* Function: print_histogram
+ * -------------------------
+ * Prints the number of free blocks in each power-of-two size class, with
+ * a bar scaled to the most common class.
+ */
+static void print_histogram(const snapshot_t *snap) {
+    uint64_t most = 0;
+    for (int i = 0; i < SIZE_CLASSES; i++) {
+        if (snap->histogram[i] > most) {
+            most = snap->histogram[i];
+        }
+    }
+    for (int i = 0; i < SIZE_CLASSES; i++) {
+        if (snap->histogram[i] == 0) {
+            continue;
+        }
+        char range[32], bar[BAR_WIDTH + 1];
+        snprintf(range, sizeof(range), "%lu-%lu", i == 0 ? 0UL : 1UL << i, (2UL << i) - 1);
+        int width = (int)((snap->histogram[i] * BAR_WIDTH + most - 1) / most);
+        memset(bar, '#', width);
+        bar[width] = '\0';
+        printf("  %22s %8lu %s\n", range, (unsigned long)snap->histogram[i], bar);
+    }
+}
+
+/* Function: size_class
+ * --------------------
+ * Returns the power-of-two class of a size: class k holds [2^k, 2^(k+1)),
+ * and sizes 0 and 1 are both in class 0.
+ */
+static int size_class(uint64_t size) {
+    return size < 2 ? 0 : 63 - __builtin_clzll(size);
+}
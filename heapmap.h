@@ -0,0 +1,96 @@
+/* File: heapmap.h
+ * ---------------
+ * Binary heap map format written by mysnapshot and read by the heapmap
+ * tool.  A snapshot file is a sequence of snapshots, each made of a
+ * heapmap_header, one heapmap_block per heap block in address order, and
+ * a terminating heapmap_block whose offset is HEAPMAP_END.  Offsets are
+ * payload offsets from the start of the heap segment, so the format covers
+ * heaps of up to 4GB.  Block sizes are payload sizes, and since they are
+ * multiples of 8 the low bit holds HEAPMAP_ALLOCATED.
+ *
+ * The allocators write snapshots through the small buffered writer below,
+ * so a whole heap goes out in a handful of fwrite calls.
+ */
+
+#ifndef _HEAPMAP_H_
+#define _HEAPMAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HEAPMAP_MAGIC "HEAPMAP1"
+#define HEAPMAP_END UINT32_MAX
+#define HEAPMAP_ALLOCATED 1u
+
+typedef struct {
+    char magic[8];          // HEAPMAP_MAGIC, not NUL-terminated
+    uint64_t tag;           // caller's label, e.g. the request number
+    uint64_t heap_size;     // size of the heap segment in bytes
+} heapmap_header;
+
+typedef struct {
+    uint32_t offset;        // payload offset from the segment start
+    uint32_t size;          // payload size, | HEAPMAP_ALLOCATED if in use
+} heapmap_block;
+
+// blocks buffered by the writer between fwrite calls
+#define HEAPMAP_BUFFER_BLOCKS 512
+
+typedef struct {
+    FILE *out;
+    char *base;             // segment start
+    bool ok;                // false once any write has failed
+    size_t count;           // blocks in buffer
+    heapmap_block buffer[HEAPMAP_BUFFER_BLOCKS];
+} heapmap_writer;
+
+
+static inline void heapmap_flush(heapmap_writer *w) {
+    if (w->count > 0 && fwrite(w->buffer, sizeof(heapmap_block), w->count, w->out) != w->count) {
+        w->ok = false;
+    }
+    w->count = 0;
+}
+
+/* Function: heapmap_begin
+ * -----------------------
+ * Starts a snapshot of the heap segment at base by writing its header.
+ */
+static inline void heapmap_begin(heapmap_writer *w, FILE *out, void *base,
+    size_t heap_size, unsigned long tag) {
+    heapmap_header header = { .tag = tag, .heap_size = heap_size };
+    memcpy(header.magic, HEAPMAP_MAGIC, sizeof(header.magic));
+    w->out = out;
+    w->base = base;
+    w->count = 0;
+    w->ok = fwrite(&header, sizeof(header), 1, out) == 1;
+}
+
+/* Function: heapmap_add
+ * ---------------------
+ * Adds the block whose payload is at the given address.  Blocks must be
+ * added in address order.
+ */
+static inline void heapmap_add(heapmap_writer *w, void *payload, size_t size, bool allocated) {
+    heapmap_block *block = &w->buffer[w->count++];
+    block->offset = (uint32_t)((char *)payload - w->base);
+    block->size = (uint32_t)size | (allocated ? HEAPMAP_ALLOCATED : 0);
+    if (w->count == HEAPMAP_BUFFER_BLOCKS) {
+        heapmap_flush(w);
+    }
+}
+
+/* Function: heapmap_end
+ * ---------------------
+ * Writes the terminating block and returns true if the whole snapshot
+ * was written successfully.
+ */
+static inline bool heapmap_end(heapmap_writer *w) {
+    w->buffer[w->count++] = (heapmap_block){ .offset = HEAPMAP_END, .size = 0 };
+    heapmap_flush(w);
+    return w->ok;
+}
+
+#endif
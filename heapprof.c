@@ -0,0 +1,280 @@
+/* File: heapprof.c
+ * ----------------
+ * The sampling heap profiler described in heapprof.h.  Sampling points are
+ * spaced by exponentially distributed byte counts with the requested mean,
+ * so every byte is equally likely to be sampled and pprof can scale the
+ * samples back up.  Call stacks are interned in a hash table, and live
+ * sampled blocks are found by address in a second, open-addressing table.
+ * The profiler's own tables come from the C library's malloc, never from
+ * the heap being profiled.
+ */
+
+#include <execinfo.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heapprof.h"
+
+// deepest backtrace recorded, and frames dropped from the top (this file)
+#define MAX_FRAMES 32
+#define SKIP_FRAMES 1
+
+// smallest size of each hash table
+#define MIN_TABLE_SLOTS 64
+
+typedef struct {
+    void *frames[MAX_FRAMES];
+    int depth;
+    uint64_t hash;
+    unsigned long inuse_count;      // sampled blocks not yet freed
+    size_t inuse_bytes;
+    unsigned long alloc_count;      // all sampled blocks
+    size_t alloc_bytes;
+} prof_stack;
+
+typedef struct {
+    void *ptr;          // NULL for an empty slot
+    int stack;          // index into stacks
+    size_t size;
+} live_sample;
+
+long heapprof_bytes_until_sample = LONG_MAX;
+
+static size_t interval;             // mean sampling interval, 0 while stopped
+static size_t period;               // interval of the last heapprof_start, for dumps
+static uint64_t rng_state = 0x853c49e6748fea9bULL;
+
+static prof_stack *stacks;          // every distinct sampled call stack
+static int nstacks, stacks_capacity;
+static int *stack_slots;            // hash table of indices into stacks (-1 = empty)
+static size_t stack_slots_capacity;
+
+static live_sample *live;           // hash table of sampled blocks still in use
+static size_t nlive, live_capacity;
+
+
+/* Function: next_interval
+ * -----------------------
+ * Returns the number of bytes until the next sample, drawn from an
+ * exponential distribution with mean `interval` (splitmix64 for the
+ * uniform variate).
+ */
+static long next_interval(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    double u = (z >> 11) * (1.0 / 9007199254740992.0);     // [0, 1)
+    double bytes = -log(1.0 - u) * interval;
+    return bytes >= LONG_MAX ? LONG_MAX : (long)bytes + 1;
+}
+
+static inline size_t hash_pointer(const void *ptr) {
+    return (size_t)(((uintptr_t)ptr >> 3) * 0x9e3779b97f4a7c15ULL);
+}
+
+/* Function: find_stack
+ * --------------------
+ * Returns the index of the given call stack in stacks, adding it if it is
+ * new, or -1 if the tables could not grow.
+ */
+static int find_stack(void **frames, int depth) {
+    uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a over the return addresses
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)frames[i]) * 0x100000001b3ULL;
+    }
+
+    if (2 * (nstacks + 1) > (int)stack_slots_capacity) {
+        size_t capacity = stack_slots_capacity ? 2 * stack_slots_capacity : MIN_TABLE_SLOTS;
+        int *slots = malloc(capacity * sizeof(int));
+        if (slots == NULL) {
+            return -1;
+        }
+        memset(slots, -1, capacity * sizeof(int));
+        for (int i = 0; i < nstacks; i++) {
+            size_t slot = stacks[i].hash & (capacity - 1);
+            while (slots[slot] != -1) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = i;
+        }
+        free(stack_slots);
+        stack_slots = slots;
+        stack_slots_capacity = capacity;
+    }
+
+    size_t slot = hash & (stack_slots_capacity - 1);
+    for (; stack_slots[slot] != -1; slot = (slot + 1) & (stack_slots_capacity - 1)) {
+        prof_stack *s = &stacks[stack_slots[slot]];
+        if (s->hash == hash && s->depth == depth &&
+            memcmp(s->frames, frames, depth * sizeof(void *)) == 0) {
+            return stack_slots[slot];
+        }
+    }
+
+    if (nstacks == stacks_capacity) {
+        int capacity = stacks_capacity ? 2 * stacks_capacity : MIN_TABLE_SLOTS;
+        prof_stack *grown = realloc(stacks, capacity * sizeof(prof_stack));
+        if (grown == NULL) {
+            return -1;
+        }
+        stacks = grown;
+        stacks_capacity = capacity;
+    }
+    prof_stack *s = &stacks[nstacks];
+    memset(s, 0, sizeof(*s));
+    memcpy(s->frames, frames, depth * sizeof(void *));
+    s->depth = depth;
+    s->hash = hash;
+    stack_slots[slot] = nstacks;
+    return nstacks++;
+}
+
+/* Function: grow_live
+ * -------------------
+ * Doubles the live sample table, rehashing every entry.  Returns false if
+ * there was no memory.
+ */
+static bool grow_live(void) {
+    size_t capacity = live_capacity ? 2 * live_capacity : MIN_TABLE_SLOTS;
+    live_sample *table = calloc(capacity, sizeof(live_sample));
+    if (table == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < live_capacity; i++) {
+        if (live[i].ptr != NULL) {
+            size_t slot = hash_pointer(live[i].ptr) & (capacity - 1);
+            while (table[slot].ptr != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table[slot] = live[i];
+        }
+    }
+    free(live);
+    live = table;
+    live_capacity = capacity;
+    return true;
+}
+
+void heapprof_start(size_t mean_interval) {
+    free(stacks);
+    free(stack_slots);
+    free(live);
+    stacks = NULL;
+    stack_slots = NULL;
+    live = NULL;
+    nstacks = stacks_capacity = 0;
+    stack_slots_capacity = nlive = live_capacity = 0;
+    interval = period = mean_interval;
+    heapprof_bytes_until_sample = interval > 0 ? next_interval() : LONG_MAX;
+}
+
+void heapprof_stop(void) {
+    interval = 0;
+    heapprof_bytes_until_sample = LONG_MAX;
+}
+
+bool heapprof_sample_alloc(void *ptr, size_t size) {
+    if (interval == 0) {
+        heapprof_bytes_until_sample = LONG_MAX;
+        return false;
+    }
+    heapprof_bytes_until_sample = next_interval();
+
+    void *frames[MAX_FRAMES + SKIP_FRAMES];
+    int depth = backtrace(frames, MAX_FRAMES + SKIP_FRAMES) - SKIP_FRAMES;
+    if (depth < 0) {
+        depth = 0;
+    }
+    int stack = find_stack(frames + SKIP_FRAMES, depth);
+    if (stack == -1 || (2 * (nlive + 1) > live_capacity && !grow_live())) {
+        return false;
+    }
+
+    size_t slot = hash_pointer(ptr) & (live_capacity - 1);
+    while (live[slot].ptr != NULL) {
+        slot = (slot + 1) & (live_capacity - 1);
+    }
+    live[slot] = (live_sample){ .ptr = ptr, .stack = stack, .size = size };
+    nlive++;
+    stacks[stack].inuse_count++;
+    stacks[stack].inuse_bytes += size;
+    stacks[stack].alloc_count++;
+    stacks[stack].alloc_bytes += size;
+    return true;
+}
+
+/* Function: heapprof_sample_free
+ * ------------------------------
+ * Removes the block from the live table with backward-shift deletion, so
+ * lookups never need tombstones.  Blocks sampled before the last
+ * heapprof_start are not in the table and are ignored.
+ */
+void heapprof_sample_free(void *ptr) {
+    if (live_capacity == 0) {
+        return;
+    }
+    size_t mask = live_capacity - 1;
+    size_t slot = hash_pointer(ptr) & mask;
+    while (live[slot].ptr != ptr) {
+        if (live[slot].ptr == NULL) {
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    prof_stack *s = &stacks[live[slot].stack];
+    s->inuse_count--;
+    s->inuse_bytes -= live[slot].size;
+    nlive--;
+
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; live[next].ptr != NULL; next = (next + 1) & mask) {
+        size_t home = hash_pointer(live[next].ptr) & mask;
+        // move the entry back if the hole lies between its home slot and where it is now
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            live[hole] = live[next];
+            hole = next;
+        }
+    }
+    live[hole].ptr = NULL;
+}
+
+/* Function: heapprof_dump
+ * -----------------------
+ * The heap_v2 format is a totals line, one line per call stack
+ *   <inuse count>: <inuse bytes> [<alloc count>: <alloc bytes>] @ <pc> <pc> ...
+ * and then this process's memory map so pprof can symbolize the pcs.
+ */
+bool heapprof_dump(FILE *out) {
+    unsigned long inuse_count = 0, alloc_count = 0;
+    size_t inuse_bytes = 0, alloc_bytes = 0;
+    for (int i = 0; i < nstacks; i++) {
+        inuse_count += stacks[i].inuse_count;
+        inuse_bytes += stacks[i].inuse_bytes;
+        alloc_count += stacks[i].alloc_count;
+        alloc_bytes += stacks[i].alloc_bytes;
+    }
+    fprintf(out, "heap profile: %6lu: %8zu [%6lu: %8zu] @ heap_v2/%zu\n",
+        inuse_count, inuse_bytes, alloc_count, alloc_bytes, period);
+    for (int i = 0; i < nstacks; i++) {
+        fprintf(out, "%6lu: %8zu [%6lu: %8zu] @", stacks[i].inuse_count,
+            stacks[i].inuse_bytes, stacks[i].alloc_count, stacks[i].alloc_bytes);
+        for (int f = 0; f < stacks[i].depth; f++) {
+            fprintf(out, " %p", stacks[i].frames[f]);
+        }
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps != NULL) {
+        char line[512];
+        while (fgets(line, sizeof(line), maps) != NULL) {
+            fputs(line, out);
+        }
+        fclose(maps);
+    }
+    return !ferror(out);
+}
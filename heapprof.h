@@ -0,0 +1,73 @@
+/* File: heapprof.h
+ * ----------------
+ * Sampling heap profiler for the allocators.  While it is running, about
+ * one allocation per `mean_interval` requested bytes is sampled: its
+ * backtrace is captured and the block is tracked until it is freed.  The
+ * allocators mark sampled blocks in their headers so that myfree only
+ * calls into the profiler for those.  heapprof_dump writes the in-use and
+ * cumulative totals per call stack in the pprof heap_v2 text format, e.g.
+ *
+ *   pprof --text ./test_explicit trace-gcc.script.heapprof
+ *
+ * Everything here is called with the heap lock held (see heaplock.h).
+ */
+
+#ifndef _HEAPPROF_H_
+#define _HEAPPROF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// default average number of bytes allocated between samples
+#define HEAPPROF_DEFAULT_INTERVAL (512 * 1024)
+
+// bytes left to allocate before the next sample; never reached while stopped
+extern long heapprof_bytes_until_sample;
+
+
+/* Function: heapprof_should_sample
+ * --------------------------------
+ * The allocators' fast path: counts an allocation of size bytes and
+ * returns true if it is time to call heapprof_sample_alloc.
+ */
+static inline bool heapprof_should_sample(size_t size) {
+    return (heapprof_bytes_until_sample -= (long)size) < 0;
+}
+
+/* Function: heapprof_start
+ * ------------------------
+ * Starts sampling on average once every mean_interval bytes, discarding
+ * any earlier samples.
+ */
+void heapprof_start(size_t mean_interval);
+
+/* Function: heapprof_stop
+ * -----------------------
+ * Stops sampling.  Samples taken so far are kept for heapprof_dump.
+ */
+void heapprof_stop(void);
+
+/* Function: heapprof_sample_alloc
+ * -------------------------------
+ * Records the backtrace of a newly allocated block and picks the next
+ * sampling point.  Returns true if the block was sampled, in which case
+ * the allocator must call heapprof_sample_free when it is freed.
+ */
+bool heapprof_sample_alloc(void *ptr, size_t size);
+
+/* Function: heapprof_sample_free
+ * ------------------------------
+ * Stops tracking a sampled block that is being freed.
+ */
+void heapprof_sample_free(void *ptr);
+
+/* Function: heapprof_dump
+ * -----------------------
+ * Writes the profile in pprof heap_v2 text format: per call stack, the
+ * sampled blocks still in use and all sampled blocks ever allocated.
+ * Returns false if writing failed.
+ */
+bool heapprof_dump(FILE *out);
+
+#endif
@@ -2,10 +2,17 @@
 #include <string.h>  // for memmove
 #include "./allocator.h"
 #include "./debug_break.h"
+#include "./heaplock.h"
+#include "./heapmap.h"
+#include "./heapprof.h"
 
-#define ALIGNMENT 8
+#define HEADER_SIZE 8  // every block starts with one size_t header
 #define MAX_REQUEST_SIZE (1 << 30)
 #define LEAST_3_SIGBITS ~0x7
+#define SAMPLED_BIT 0x2  // header flag for blocks sampled by the heap profiler
+#define TOUCHED_RING 32  // how many recently touched blocks incremental validation remembers
+#define WINDOW_BLOCKS 32  // how many other blocks each incremental validation checks
+#define MAINTAIN_BLOCKS 1024  // blocks each mymaintain call looks at
 
 static void *segment_start;
 static size_t segment_size;
@@ -13,6 +20,11 @@ static char *segment_end;
 static size_t nused;
 typedef size_t header;
 static header* start_hdr;
+static header *touched[TOUCHED_RING];  // ring of headers changed since the last incremental check
+static size_t ntouched;  // number of headers noted since the last incremental check
+static header *window_cursor;  // first block of the next incremental check's window
+static heap_stats counters;  // running totals reported by mystats
+static header *maintain_cursor;  // block where the next mymaintain call starts
 
 
 /* MAIN FUNCTION : myinit
@@ -20,24 +32,63 @@ static header* start_hdr;
  * Given a non-NULL heap_start pointer and a 
  * heap_size value, initializes the heap by 
  * giving the global variables values. 
+ * The first header is placed so that its payload
+ * is ALIGNMENT-aligned, and the end of the heap is
+ * trimmed so that its length is a multiple of
+ * ALIGNMENT (with 8-byte alignment neither moves).
  * Returns true if heap was properly initialized
  * and returns false if parameters were not valid
  * (heap not able to be initialized).
  */
 bool myinit(void *heap_start, size_t heap_size) {
-    if (heap_size < ALIGNMENT) {  // heap_size must be at least 8 bytes
+    HEAP_LOCK();
+    size_t first_payload = ((size_t) heap_start + HEADER_SIZE + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+    size_t skipped = first_payload - HEADER_SIZE - (size_t) heap_start;
+    if (heap_size < skipped + ALIGNMENT) {  // must fit at least one header
         return false;
     }
     nused = 0;  // resets nused for every script call
-    nused += ALIGNMENT;
-    segment_start = heap_start;
-    segment_size = heap_size;
+    nused += HEADER_SIZE;
+    segment_start = (char *) heap_start + skipped;
+    segment_size = (heap_size - skipped) & ~(size_t) (ALIGNMENT - 1);
     segment_end = (char *) segment_start + segment_size;
     start_hdr = segment_start;
-    *start_hdr = heap_size - ALIGNMENT;
+    *start_hdr = segment_size - HEADER_SIZE;
+    ntouched = 0;
+    window_cursor = start_hdr;
+    maintain_cursor = start_hdr;
+    memset(&counters, 0, sizeof(counters));
     return true;
 }
 
+/* MAIN FUNCTION : myattach, mydetach, myroot
+ * -------------------------------------------
+ * The implicit allocator does not keep its state
+ * inside the heap, so it cannot resume one.
+ */
+bool myattach(void *heap_start, size_t heap_size) {
+    return false;
+}
+
+void mydetach(void) {
+}
+
+void **myroot(void) {
+    return NULL;
+}
+
+/* MAIN FUNCTION : myextend, mygrow_hook
+ * --------------------------------------
+ * The implicit allocator walks one contiguous run of
+ * blocks, so it cannot span several segments.
+ */
+bool myextend(void *start, size_t size) {
+    return false;
+}
+
+void mygrow_hook(heap_grow_fn grow) {
+}
+
 /* HELPER FUNCTION : statusAllocated
  * ----------------------------------
  * Turns on least significant bit in header
@@ -73,7 +124,7 @@ size_t getSize(header* hdr) {
  * the header since the header size is eight).
  */
 void* accessPayload(header* hdr) {
-    return (char*) hdr + ALIGNMENT;
+    return (char*) hdr + HEADER_SIZE;
 }
 
 /* HELPER FUNCTION : accessHeader
@@ -83,7 +134,7 @@ void* accessPayload(header* hdr) {
  * payload since the the header size is eight).
  */ 
 header* accessHeader(void* payload) {
-    return (header*) ((char*) payload - ALIGNMENT);
+    return (header*) ((char*) payload - HEADER_SIZE);
 }
 
 /* HELPER FUNCTION : isAllocated
@@ -100,13 +151,23 @@ bool isAllocated(header* hdr) {
  * --------------------------
  * Given a number and a multiple (must be a power of 2),
  * returns the rounded up version of the number.
- * Used to make sure requested_size in mymalloc is 
- * rounded up the the next biggest multiple of eight.
  */
 size_t roundup(size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
+/* HELPER FUNCTION : payloadSize
+ * ------------------------------
+ * Given a requested size, returns the payload size of
+ * the block that will hold it: big enough, and with
+ * header plus payload a multiple of ALIGNMENT so that
+ * the next block's payload is aligned too.  With 8-byte
+ * alignment this is the next biggest multiple of eight.
+ */
+size_t payloadSize(size_t requested_size) {
+    return roundup(requested_size + HEADER_SIZE, ALIGNMENT) - HEADER_SIZE;
+}
+
 /* HELPER FUNCTION : nextBlock
  * ----------------------------
  * Given a header pointer, returns a new header 
@@ -120,12 +181,70 @@ header* nextBlock(header* hdr) {
     return nxt;
 }
 
+/* HELPER FUNCTION : noteTouched
+ * -------------------------------
+ * Remembers a header that was just changed so the next incremental
+ * validation checks it.  Only the last TOUCHED_RING are kept.
+ */
+void noteTouched(header* hdr) {
+    touched[ntouched++ % TOUCHED_RING] = hdr;
+}
+
+/* HELPER FUNCTION : profileAlloc
+ * --------------------------------
+ * Given the header of a block that was just allocated,
+ * let the heap profiler sample it if enough bytes have
+ * been allocated since the last sample, marking the
+ * header if it was.  Returns the block's payload.
+ */
+void *profileAlloc(header* hdr, size_t requested_size) {
+    void *payload = accessPayload(hdr);
+    if (heapprof_should_sample(requested_size) &&
+        heapprof_sample_alloc(payload, requested_size)) {
+        *hdr |= SAMPLED_BIT;
+    }
+    return payload;
+}
+
+/* HELPER FUNCTION : placeBlock
+ * ------------------------------
+ * Given a free heap block that is at least actual_size
+ * bytes, allocates it for the request.  If the block is
+ * bigger than actual_size, splitting is implemented.
+ * Returns the payload pointer, or NULL if the block
+ * cannot be used.
+ */
+void *placeBlock(header *ptr, size_t actual_size, size_t requested_size) {
+    if (getSize(ptr) == actual_size) {  // if heap block size is the same as actual_size
+        statusAllocated(ptr);
+        noteTouched(ptr);
+        void *load = profileAlloc(ptr, requested_size);
+        nused += actual_size;
+        return load;
+    }
+    // if heap block is more bytes than actual_size (REQUIRES SPLITTING)
+    if (getSize(ptr) >= (actual_size + HEADER_SIZE)) {
+        size_t og_size = getSize(ptr);
+        *ptr = actual_size;
+        statusAllocated(ptr);
+        header *split = nextBlock(ptr);
+        *split = og_size - actual_size - HEADER_SIZE;
+        statusFree(split);
+        noteTouched(ptr);
+        noteTouched(split);
+        void *load = profileAlloc(ptr, requested_size);
+        nused += actual_size + HEADER_SIZE;
+        return load;
+    }
+    return NULL;  
+}
+
 /* MAIN FUNCTION : mymalloc
  * -------------------------
  * Given a user-inputted requested size (the amount the user 
  * wants allocated on the heap), find the first heap block
  * that would be greater than or equal to the rounded up version
- * of requested_size (next biggest multiple of 8).
+ * of requested_size (see payloadSize).
  *
  * If the heap block found is greater than request_size bytes, 
  * splitting is implemented.
@@ -135,34 +254,66 @@ header* nextBlock(header* hdr) {
  * the requested size.
  */
 void *mymalloc(size_t requested_size) {
-    // rounds up to next biggest multiple of 8 from requested_size
-    size_t actual_size = roundup(requested_size, ALIGNMENT);  
+    HEAP_LOCK();
+    // rounds up so the next block stays aligned
+    size_t actual_size = payloadSize(requested_size);  
     header *ptr = start_hdr;
+    counters.allocs[stats_size_class(requested_size)]++;
+    counters.searches++;
+    counters.search_steps++;
     
     // adjusts ptr to point to the heap block that is free and
     // is greater than or equal to actual_size
     while (isAllocated(ptr) || actual_size > *ptr) {
         ptr = nextBlock(ptr);
+        if ((char *) ptr == segment_end) {  // nothing fits
+            return NULL;
+        }
+        counters.search_steps++;
     }
-    if (getSize(ptr) == actual_size) {  // if heap block size is the same as actual_size
-        statusAllocated(ptr);
-        void *load = accessPayload(ptr);
-        nused += actual_size;
-        return load;
+    return placeBlock(ptr, actual_size, requested_size);
+}
+
+/* MAIN FUNCTION : mymalloc_hint
+ * ------------------------------
+ * Like mymalloc, but with MALLOC_CACHE_ALIGN it finds
+ * the first free block that still fits the request once
+ * its payload is moved up to the next cache line boundary.
+ * The bytes skipped over become a free block of their own
+ * (at least a header, since they are a multiple of
+ * ALIGNMENT).
+ */
+void *mymalloc_hint(size_t requested_size, unsigned hints) {
+    HEAP_LOCK();
+    if (!(hints & MALLOC_CACHE_ALIGN) || ALIGNMENT >= CACHE_LINE_SIZE) {
+        return mymalloc(requested_size);  // every payload is already line-aligned
     }
-    // if heap block is more bytes than actual_size (REQUIRES SPLITTING)
-    if (getSize(ptr) >= (actual_size + ALIGNMENT)) {
-        size_t og_size = getSize(ptr);
-        *ptr = actual_size;
-        statusAllocated(ptr);
-        header *split = nextBlock(ptr);
-        *split = og_size - actual_size - ALIGNMENT;
-        statusFree(split);
-        void *load = accessPayload(ptr);
-        nused += actual_size + ALIGNMENT;
-        return load;
+    size_t actual_size = payloadSize(requested_size);
+    counters.allocs[stats_size_class(requested_size)]++;
+    counters.searches++;
+
+    for (header *ptr = start_hdr; (char *) ptr != segment_end; ptr = nextBlock(ptr)) {
+        counters.search_steps++;
+        if (isAllocated(ptr)) {
+            continue;
+        }
+        size_t payload = (size_t) accessPayload(ptr);
+        size_t gap = roundup(payload, CACHE_LINE_SIZE) - payload;
+        if (getSize(ptr) < gap + actual_size) {
+            continue;
+        }
+        if (gap > 0) {  // leave the bytes before the line as a free block
+            header *aligned = (header *) (payload + gap - HEADER_SIZE);
+            *aligned = getSize(ptr) - gap;
+            *ptr = gap - HEADER_SIZE;
+            nused += HEADER_SIZE;
+            noteTouched(ptr);
+            noteTouched(aligned);
+            ptr = aligned;
+        }
+        return placeBlock(ptr, actual_size, requested_size);
     }
-    return NULL;  
+    return NULL;
 }
 
 /* MAIN FUNCTION: myfree
@@ -172,12 +323,19 @@ void *mymalloc(size_t requested_size) {
  * (turn off least significant bit)
  */
 void myfree(void *ptr) {
+    HEAP_LOCK();
     if (ptr == NULL) {  // if invalid pointer is given
         return;
     }
     header *hdr = accessHeader(ptr);
     nused -= getSize(hdr);
+    counters.frees[stats_size_class(getSize(hdr))]++;
+    if (*hdr & SAMPLED_BIT) {  // tell the heap profiler a sampled block is gone
+        heapprof_sample_free(ptr);
+        *hdr &= ~SAMPLED_BIT;
+    }
     statusFree(hdr);
+    noteTouched(hdr);
 }
 
 /* MAIN FUNCTION - myrealloc
@@ -187,6 +345,7 @@ void myfree(void *ptr) {
  * of a heap block that is new_size bytes large.
  */
 void *myrealloc(void *old_ptr, size_t new_size) {
+    HEAP_LOCK();
     // if no old_ptr specified, just do regular mymalloc
     if (old_ptr == NULL) {
         void *result = mymalloc(new_size);
@@ -196,50 +355,254 @@ void *myrealloc(void *old_ptr, size_t new_size) {
     // if specified new_size is smaller than the old_size, do not change anything.
     // myrealloc only expands
     if (new_size <= old_size) {
+        counters.realloc_in_place++;
         return old_ptr;
     }
     // mymalloc a bigger heap block
     void *result = mymalloc(new_size);
+    if (result == NULL) {  // the old block is left as it was
+        return NULL;
+    }
     memcpy(result, old_ptr, old_size);  // copies memory from old block to new block
     myfree(old_ptr);
+    counters.realloc_copied++;
+    counters.realloc_bytes_copied += old_size;
     return result;
 }
 
+/* HELPER FUNCTION : blockWrong
+ * ------------------------------
+ * Given a header pointer, check that it lies inside the heap
+ * with an aligned payload, that only the status and sampled
+ * bits are used for flags and that the block does not run past the end of
+ * the heap.  Returns true if anything is wrong.
+ */
+bool blockWrong(header* hdr) {
+    if ((char *) hdr < (char *) segment_start || (char *) hdr >= segment_end ||
+        ((size_t) accessPayload(hdr) & (ALIGNMENT - 1)) != 0) {
+        return true;
+    }
+    if ((*hdr & 0x4) != 0 || (!isAllocated(hdr) && (*hdr & SAMPLED_BIT))) {
+        return true;  // bit 2 is never set, and only allocated blocks are sampled
+    }
+    return getSize(hdr) > (size_t) (segment_end - (char *) accessPayload(hdr));
+}
+
 /* HELPER FUNCTION : validate_heap
  * ----------------------
- * Goes through the entire heap and counts the number
- * of bytes used and then compares that to nused which 
+ * Runs the most thorough level of checking.
+ */
+bool validate_heap() {
+    return validate_heap_level(VALIDATE_FULL);
+}
+
+/* HELPER FUNCTION : validate_heap_level
+ * --------------------------------------
+ * The cheap checks make sure nused is in range and that the
+ * first and most recently touched headers are sane.
+ * The incremental checks also look at every header touched
+ * since the last check, then at the next WINDOW_BLOCKS blocks
+ * after window_cursor (wrapping around at the end of the heap).
+ * Only mymaintain merges blocks, and absorbNext moves the
+ * cursor and the touched ring off a header it merges away,
+ * so neither ever points into the middle of a block.
+ * The full check goes through the entire heap and counts the
+ * number of bytes used and then compares that to nused which 
  * has been doing the same thing but as the operations 
  * were being done.
  */
-bool validate_heap() {  
-    size_t check_nused = 0;
-    header *ptr = segment_start;
+bool validate_heap_level(validate_level level) {
+    HEAP_LOCK();
+    if (level == VALIDATE_NONE) {
+        return true;
+    }
 
     if (nused > segment_size) {
         printf("ERROR! More heap bytes used than are in segment_size.");
         breakpoint();
         return false;
     }
-    // Going through the heap and adding to check_nused
-    while ((char *) ptr != segment_end) {
-        if (!isAllocated(ptr)) {
-            check_nused += ALIGNMENT;
-            ptr = nextBlock(ptr);
-        } else {
-            check_nused += getSize(ptr) + ALIGNMENT;
-            ptr = nextBlock(ptr);
+    if (blockWrong(start_hdr) ||
+        (ntouched > 0 && blockWrong(touched[(ntouched - 1) % TOUCHED_RING]))) {
+        printf("ERROR! Corrupt block header.");
+        breakpoint();
+        return false;
+    }
+
+    if (level == VALIDATE_INCREMENTAL) {
+        size_t count = ntouched < TOUCHED_RING ? ntouched : TOUCHED_RING;
+        for (size_t i = 0; i < count; i++) {
+            if (blockWrong(touched[i])) {
+                printf("ERROR! Corrupt header in a recently used block.");
+                breakpoint();
+                return false;
+            }
+        }
+        ntouched = 0;
+        for (int i = 0; i < WINDOW_BLOCKS; i++) {
+            if (blockWrong(window_cursor)) {
+                printf("ERROR! Corrupt block header.");
+                breakpoint();
+                return false;
+            }
+            window_cursor = nextBlock(window_cursor);
+            if ((char *) window_cursor == segment_end) {
+                window_cursor = start_hdr;
+            }
+        }
+    } else if (level == VALIDATE_FULL) {
+        // Going through the heap and adding to check_nused
+        size_t check_nused = 0;
+        header *ptr = segment_start;
+        while ((char *) ptr != segment_end) {
+            if (blockWrong(ptr)) {
+                printf("ERROR! Corrupt block header.");
+                breakpoint();
+                return false;
+            }
+            if (!isAllocated(ptr)) {
+                check_nused += HEADER_SIZE;
+                ptr = nextBlock(ptr);
+            } else {
+                check_nused += getSize(ptr) + HEADER_SIZE;
+                ptr = nextBlock(ptr);
+            }
+        }
+        // Should be equal if heap was allocated successfully
+        if (check_nused != nused) {
+            printf("ERROR! nused and check_nused do not match up.");
+            breakpoint();
+            return false;
         }
     }
-    // Should be equal if heap was allocated successfully
-    if (check_nused != nused) {
-        printf("ERROR! nused and check_nused do not match up.");
-        breakpoint();
+    return true;
+}
+
+/* MAIN FUNCTION : mymallopt
+ * ---------------------------
+ * The implicit allocator has no tuning parameters,
+ * so every setting is rejected.
+ */
+bool mymallopt(mallopt_param param, long value) {
+    return false;
+}
+
+/* MAIN FUNCTION : mycompact
+ * ---------------------------
+ * Not supported by the implicit allocator: nothing
+ * is ever moved.
+ */
+size_t mycompact(size_t budget, bool (*can_move)(void *payload),
+    void (*moved)(void *old_payload, void *new_payload)) {
+    return 0;
+}
+
+/* HELPER FUNCTION : absorbNext
+ * ------------------------------
+ * Given the header of a free block, merges the block
+ * after it into it if that one is free too, moving
+ * anything that pointed at the absorbed header (the
+ * touched ring and the cursors) to the merged block.
+ * Returns true if it merged.
+ */
+bool absorbNext(header *hdr) {
+    header *next = nextBlock(hdr);
+    if ((char *) next == segment_end || isAllocated(next)) {
         return false;
     }
+    *hdr += getSize(next) + HEADER_SIZE;
+    nused -= HEADER_SIZE;
+    for (int i = 0; i < TOUCHED_RING; i++) {
+        if (touched[i] == next) {
+            touched[i] = hdr;
+        }
+    }
+    if (window_cursor == next) {
+        window_cursor = hdr;
+    }
+    if (maintain_cursor == next) {
+        maintain_cursor = hdr;
+    }
     return true;
 }
 
+/* MAIN FUNCTION : mymaintain
+ * -----------------------------
+ * myfree never coalesces, so freed neighbours stay
+ * separate blocks, and mymalloc has to step over each one.
+ * Starting at maintain_cursor, looks at up to
+ * MAINTAIN_BLOCKS blocks and has each free one absorb the
+ * free blocks after it.  The next call carries on where
+ * this one stopped, wrapping around at the end of the
+ * heap, so the heap lock is only held for a bounded time.
+ */
+void mymaintain(void) {
+    HEAP_LOCK();
+    if (segment_start == NULL) {
+        return;
+    }
+    counters.maintenance_passes++;
+    for (int i = 0; i < MAINTAIN_BLOCKS; i++) {
+        header *hdr = maintain_cursor;
+        if (!isAllocated(hdr)) {
+            bool merged = false;
+            while (absorbNext(hdr)) {
+                counters.blocks_merged++;
+                merged = true;
+            }
+            if (merged) {
+                noteTouched(hdr);
+            }
+        }
+        maintain_cursor = nextBlock(hdr);
+        if ((char *) maintain_cursor == segment_end) {
+            maintain_cursor = start_hdr;
+            break;
+        }
+    }
+}
+
+/* MAIN FUNCTION : mystats
+ * ------------------------
+ * Copies the running counters and then goes through the
+ * entire heap to total up the used and free payload bytes.
+ */
+void mystats(heap_stats *stats) {
+    HEAP_LOCK();
+    *stats = counters;
+    header *ptr = segment_start;
+    while ((char *) ptr != segment_end) {
+        if (isAllocated(ptr)) {
+            stats->bytes_in_use += getSize(ptr);
+        } else {
+            stats->bytes_free += getSize(ptr);
+            stats->free_blocks++;
+            if (getSize(ptr) > stats->largest_free) {
+                stats->largest_free = getSize(ptr);
+            }
+        }
+        ptr = nextBlock(ptr);
+    }
+}
+
+/* MAIN FUNCTION : mysnapshot
+ * ---------------------------
+ * Goes through the entire heap once and writes each
+ * block's payload offset, size and status to out
+ * (see heapmap.h).
+ */
+bool mysnapshot(FILE *out, unsigned long tag) {
+    HEAP_LOCK();
+    heapmap_writer writer;
+    heapmap_begin(&writer, out, segment_start, segment_size, tag);
+    header *ptr = segment_start;
+    while ((char *) ptr != segment_end) {
+        heapmap_add(&writer, accessPayload(ptr), getSize(ptr), isAllocated(ptr));
+        ptr = nextBlock(ptr);
+    }
+    return heapmap_end(&writer);
+}
+
 /* HELPER FUNCTION : dump_heap
  * ----------------------------
  * Prints out the the block contents of the heap. 
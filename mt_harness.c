@@ -0,0 +1,532 @@
+/*
+ * File: mt_harness.c
+ * ------------------
+ * Replays allocator scripts concurrently on several pthreads against a
+ * thread-safe build of an allocator (compiled with -DTHREAD_SAFE).  There
+ * are two ways of splitting the work:
+ *
+ *   copies: every thread replays its own full copy of the script
+ *   shard:  thread t replays only the requests whose block id % nthreads == t
+ *
+ * With -x, frees are handed off to the next thread instead of being done
+ * by the thread that allocated the block, which exercises cross-thread
+ * frees.  With -i us, the allocator's maintenance thread runs every us
+ * microseconds alongside the replay threads (see MALLOPT_MAINTENANCE_US).
+ * Payloads are filled and verified as in test_harness.c, and the driver
+ * reports aggregate throughput, per-thread latency and the final heap
+ * footprint for each script.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "payload.h"
+#include "script.h"
+#include "segment.h"
+
+
+const long HEAP_SIZE = 1L << 32;
+
+// maximum number of replay threads
+#define MAX_THREADS 64
+
+// latency histogram buckets are powers of two nanoseconds
+#define LATENCY_BUCKETS 40
+
+enum replay_mode {
+    MODE_COPIES,
+    MODE_SHARD
+};
+
+// a block whose free has been handed to another thread
+typedef struct {
+    void *ptr;
+    size_t size;
+    int id;
+    int lineno;
+} handoff_t;
+
+// per-thread queue of blocks other threads have asked it to free
+typedef struct {
+    pthread_mutex_t lock;
+    handoff_t *items;
+    int count;
+    int capacity;
+} mailbox_t;
+
+// per-thread replay state and results
+typedef struct {
+    int index;                  // thread number
+    script_t *script;           // shared, read-only script
+    block_t *blocks;            // this thread's view of live blocks
+    void *heap_end;             // topmost address this thread saw in use
+    unsigned long nops;         // allocator calls made by this thread
+    unsigned long total_ns;     // time spent inside the allocator
+    unsigned long max_ns;       // slowest single call
+    unsigned long histogram[LATENCY_BUCKETS];
+    double start_secs;          // when this thread started replaying
+    double end_secs;            // when it finished, including final drains
+    bool failed;
+} worker_t;
+
+// settings and shared state for the current script
+static struct {
+    int nthreads;
+    enum replay_mode mode;
+    bool cross_free;
+    bool sample_payloads;   // -p: only spot-check large payloads
+    long maintenance_us;    // -i: maintenance thread interval, 0 for none
+    pthread_barrier_t barrier;          // start line, shared with the main thread
+    pthread_barrier_t drain_barrier;    // replay threads only, before the last drain
+    mailbox_t mailboxes[MAX_THREADS];
+} replay;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static int test_scripts(char *script_names[], int num_script_names);
+static bool eval_threaded(script_t *script);
+static void *replay_thread(void *arg);
+static bool replay_request(worker_t *w, const request_t *req, int id);
+static void *timed_call(worker_t *w, enum request_type op, void *ptr, size_t size);
+static void mailbox_push(int thread, handoff_t item);
+static bool mailbox_drain(worker_t *w);
+static bool check_block(worker_t *w, void *ptr, size_t size, int lineno);
+static bool check_payload(worker_t *w, void *ptr, size_t size, int id, int lineno, char *op);
+static unsigned long latency_percentile(worker_t *w, double fraction);
+static double now_secs(void);
+static void thread_error(worker_t *w, int lineno, char *format, ...);
+
+
+/* Function: main
+ * --------------
+ * Parses the command-line flags (-t nthreads, -m copies|shard, -x for
+ * cross-thread frees, -p to spot-check large payloads, -i us for the
+ * maintenance thread) and replays each script file that follows.
+ */
+int main(int argc, char *argv[]) {
+    replay.nthreads = 4;
+    replay.mode = MODE_COPIES;
+    replay.cross_free = false;
+    replay.sample_payloads = false;
+    replay.maintenance_us = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "t:m:xpi:")) != EOF) {
+        if (c == 't') {
+            replay.nthreads = atoi(optarg);
+            if (replay.nthreads < 1 || replay.nthreads > MAX_THREADS) {
+                error(1, 0, "Thread count must be between 1 and %d.", MAX_THREADS);
+            }
+        } else if (c == 'm') {
+            if (strcmp(optarg, "copies") == 0) {
+                replay.mode = MODE_COPIES;
+            } else if (strcmp(optarg, "shard") == 0) {
+                replay.mode = MODE_SHARD;
+            } else {
+                error(1, 0, "Unknown mode '%s' (expected copies or shard).", optarg);
+            }
+        } else if (c == 'x') {
+            replay.cross_free = true;
+        } else if (c == 'p') {
+            replay.sample_payloads = true;
+        } else if (c == 'i') {
+            replay.maintenance_us = atol(optarg);
+        } else {
+            error(1, 0, "Usage: %s [-t nthreads] [-m copies|shard] [-x] [-p] [-i us] script...", argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        error(1, 0, "Missing argument. Please supply one or more script files.");
+    }
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+    if (replay.sample_payloads) {
+        printf("Spot-checking large payloads (%s kernel).\n", payload_kernel_name());
+    }
+
+    for (int i = 0; i < replay.nthreads; i++) {
+        pthread_mutex_init(&replay.mailboxes[i].lock, NULL);
+    }
+    return test_scripts(argv + optind, argc - optind);
+}
+
+/* Function: test_scripts
+ * ----------------------
+ * Replays each named script in turn and returns the number of failures.
+ */
+static int test_scripts(char *script_names[], int num_script_names) {
+    int nfailures = 0;
+    for (int i = 0; i < num_script_names; i++) {
+        script_t script = parse_script(script_names[i]);
+        printf("\nEvaluating allocator on %s with %d threads (%s%s)...", script.name,
+            replay.nthreads, replay.mode == MODE_COPIES ? "copies" : "shard",
+            replay.cross_free ? ", cross-thread frees" : "");
+        if (!eval_threaded(&script)) {
+            nfailures++;
+        }
+        free_script(&script);
+    }
+    printf("\n");
+    return nfailures;
+}
+
+/* Function: eval_threaded
+ * -----------------------
+ * Initializes a fresh heap, runs the script on all threads and prints the
+ * aggregate and per-thread results.  The maintenance thread, if any, only
+ * runs while the replay threads do, since the next script's heap replaces
+ * this one's segment.  Returns true if every thread finished without
+ * detecting an error.
+ */
+static bool eval_threaded(script_t *script) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        printf("\nALLOCATOR FAILURE [%s]: myinit() returned false\n", script->name);
+        return false;
+    }
+    if (replay.maintenance_us != 0 && !mymallopt(MALLOPT_MAINTENANCE_US, replay.maintenance_us)) {
+        error(1, 0, "This allocator does not accept -i %ld.", replay.maintenance_us);
+    }
+
+    int n = replay.nthreads;
+    worker_t *workers = calloc(n, sizeof(worker_t));
+    pthread_t *threads = malloc(n * sizeof(pthread_t));
+    if (!workers || !threads) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    pthread_barrier_init(&replay.barrier, NULL, n + 1);
+    pthread_barrier_init(&replay.drain_barrier, NULL, n);
+
+    for (int i = 0; i < n; i++) {
+        workers[i].index = i;
+        workers[i].script = script;
+        workers[i].heap_end = heap_segment_start();
+        workers[i].blocks = calloc(script->num_ids, sizeof(block_t));
+        if (!workers[i].blocks) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        replay.mailboxes[i].count = 0;
+        pthread_create(&threads[i], NULL, replay_thread, &workers[i]);
+    }
+
+    // release all threads at once and wait for them to finish
+    pthread_barrier_wait(&replay.barrier);
+    for (int i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&replay.barrier);
+    pthread_barrier_destroy(&replay.drain_barrier);
+    if (replay.maintenance_us != 0) {
+        mymallopt(MALLOPT_MAINTENANCE_US, 0);
+    }
+
+    // wall time runs from the first thread starting to the last one finishing
+    bool success = true;
+    unsigned long total_ops = 0;
+    double first_start = workers[0].start_secs, last_end = workers[0].end_secs;
+    void *heap_end = heap_segment_start();
+    for (int i = 0; i < n; i++) {
+        success = success && !workers[i].failed;
+        if (workers[i].start_secs < first_start) {
+            first_start = workers[i].start_secs;
+        }
+        if (workers[i].end_secs > last_end) {
+            last_end = workers[i].end_secs;
+        }
+        total_ops += workers[i].nops;
+        if ((char *)workers[i].heap_end > (char *)heap_end) {
+            heap_end = workers[i].heap_end;
+        }
+    }
+
+    if (success) {
+        double secs = last_end - first_start;
+        printf("successfully serviced %lu requests in %.3f s (%.0f ops/sec), heap footprint %zu bytes",
+            total_ops, secs, secs > 0 ? total_ops / secs : 0.0,
+            (size_t)((char *)heap_end - (char *)heap_segment_start()));
+        for (int i = 0; i < n; i++) {
+            worker_t *w = &workers[i];
+            printf("\n  thread %2d: %lu requests, avg %lu ns, p50 %lu ns, p99 %lu ns, p99.9 %lu ns, max %lu ns",
+                i, w->nops, w->nops ? w->total_ns / w->nops : 0, latency_percentile(w, 0.5),
+                latency_percentile(w, 0.99), latency_percentile(w, 0.999), w->max_ns);
+        }
+        if (replay.maintenance_us != 0) {
+            heap_stats stats;
+            mystats(&stats);
+            printf("\n  maintenance: %lu passes, %lu blocks merged, %zu bytes purged",
+                stats.maintenance_passes, stats.blocks_merged, stats.bytes_purged);
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        free(workers[i].blocks);
+    }
+    free(workers);
+    free(threads);
+    return success;
+}
+
+/* Function: replay_thread
+ * -----------------------
+ * Thread body: waits for the start barrier, replays this thread's share of
+ * the script and finally handles any frees that other threads handed to it.
+ * Blocks still live at the end are verified but not freed, as in the
+ * single-threaded harness.
+ */
+static void *replay_thread(void *arg) {
+    worker_t *w = arg;
+    script_t *script = w->script;
+    pthread_barrier_wait(&replay.barrier);
+    w->start_secs = now_secs();
+
+    script_cursor cursor = script_begin(script);
+    request_t request;
+    while (!w->failed && script_next(script, &cursor, &request)) {
+        int id = request.id;
+        if (replay.mode == MODE_SHARD && id % replay.nthreads != w->index) {
+            continue;
+        }
+        if (replay.cross_free && !mailbox_drain(w)) {
+            w->failed = true;
+            break;
+        }
+        if (!replay_request(w, &request, id)) {
+            w->failed = true;
+        }
+    }
+
+    // Every thread must be done pushing before the last mailbox drain
+    if (replay.cross_free) {
+        pthread_barrier_wait(&replay.drain_barrier);
+        if (!w->failed && !mailbox_drain(w)) {
+            w->failed = true;
+        }
+    }
+    w->end_secs = now_secs();
+
+    for (int id = 0; id < script->num_ids && !w->failed; id++) {
+        if (!check_payload(w, w->blocks[id].ptr, w->blocks[id].size, id, -1, "at exit")) {
+            w->failed = true;
+        }
+    }
+    return NULL;
+}
+
+/* Function: replay_request
+ * ------------------------
+ * Performs one script request on behalf of the given thread, filling and
+ * checking payloads as it goes.  Returns false on any detected error.
+ */
+static bool replay_request(worker_t *w, const request_t *req, int id) {
+    block_t *block = &w->blocks[id];
+
+    if (req->op == ALLOC) {
+        void *p = timed_call(w, ALLOC, NULL, req->size);
+        if (p == NULL && req->size != 0) {
+            thread_error(w, req->lineno, "heap exhausted, malloc returned NULL");
+            return false;
+        }
+        if (!check_block(w, p, req->size, req->lineno)) {
+            return false;
+        }
+        memset(p, id & 0xFF, req->size);
+        *block = (block_t){.ptr = p, .size = req->size};
+    } else if (req->op == REALLOC) {
+        size_t old_size = block->size;
+        if (!check_payload(w, block->ptr, old_size, id, req->lineno, "pre-realloc-ing")) {
+            return false;
+        }
+        void *p = timed_call(w, REALLOC, block->ptr, req->size);
+        if (p == NULL && req->size != 0) {
+            thread_error(w, req->lineno, "heap exhausted, realloc returned NULL");
+            return false;
+        }
+        if (!check_block(w, p, req->size, req->lineno) ||
+            !check_payload(w, p, old_size < req->size ? old_size : req->size, id,
+                req->lineno, "post-realloc-ing (preserving data)")) {
+            return false;
+        }
+        memset(p, id & 0xFF, req->size);
+        *block = (block_t){.ptr = p, .size = req->size};
+    } else if (req->op == FREE) {
+        if (!check_payload(w, block->ptr, block->size, id, req->lineno, "freeing")) {
+            return false;
+        }
+        if (replay.cross_free) {
+            handoff_t item = {.ptr = block->ptr, .size = block->size, .id = id,
+                .lineno = req->lineno};
+            mailbox_push((w->index + 1) % replay.nthreads, item);
+        } else {
+            timed_call(w, FREE, block->ptr, 0);
+        }
+        *block = (block_t){.ptr = NULL, .size = 0};
+    }
+    return true;
+}
+
+/* Function: timed_call
+ * --------------------
+ * Makes one allocator call and records how long it took in the thread's
+ * latency totals and histogram.  Returns the allocator's result (NULL for
+ * frees).
+ */
+static void *timed_call(worker_t *w, enum request_type op, void *ptr, size_t size) {
+    struct timespec start, end;
+    void *result = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (op == ALLOC) {
+        result = mymalloc(size);
+    } else if (op == REALLOC) {
+        result = myrealloc(ptr, size);
+    } else {
+        myfree(ptr);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    unsigned long ns = (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (1UL << bucket) < ns) {
+        bucket++;
+    }
+    w->histogram[bucket]++;
+    w->total_ns += ns;
+    if (ns > w->max_ns) {
+        w->max_ns = ns;
+    }
+    w->nops++;
+    return result;
+}
+
+/* Function: latency_percentile
+ * ----------------------------
+ * Returns the upper bound (a power of two, in ns) of the histogram bucket
+ * containing the given fraction of this thread's calls, capped at the
+ * slowest call actually seen.
+ */
+static unsigned long latency_percentile(worker_t *w, double fraction) {
+    unsigned long target = (unsigned long)(fraction * w->nops);
+    unsigned long seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += w->histogram[bucket];
+        if (seen > target) {
+            return (1UL << bucket) < w->max_ns ? (1UL << bucket) : w->max_ns;
+        }
+    }
+    return w->max_ns;
+}
+
+/* Function: now_secs
+ * ------------------
+ * Returns the monotonic clock reading in seconds.
+ */
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Function: mailbox_push
+ * ----------------------
+ * Queues a block for the given thread to free.
+ */
+static void mailbox_push(int thread, handoff_t item) {
+    mailbox_t *box = &replay.mailboxes[thread];
+    pthread_mutex_lock(&box->lock);
+    if (box->count == box->capacity) {
+        box->capacity = box->capacity ? 2 * box->capacity : 64;
+        box->items = realloc(box->items, box->capacity * sizeof(handoff_t));
+        if (!box->items) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+    }
+    box->items[box->count++] = item;
+    pthread_mutex_unlock(&box->lock);
+}
+
+/* Function: mailbox_drain
+ * -----------------------
+ * Frees every block queued for this thread, re-checking each payload
+ * first since the block was written by a different thread.
+ */
+static bool mailbox_drain(worker_t *w) {
+    mailbox_t *box = &replay.mailboxes[w->index];
+    pthread_mutex_lock(&box->lock);
+    while (box->count > 0) {
+        handoff_t item = box->items[--box->count];
+        if (!check_payload(w, item.ptr, item.size, item.id, item.lineno, "freeing (cross-thread)")) {
+            pthread_mutex_unlock(&box->lock);
+            return false;
+        }
+        timed_call(w, FREE, item.ptr, 0);
+    }
+    pthread_mutex_unlock(&box->lock);
+    return true;
+}
+
+/* Function: check_block
+ * ---------------------
+ * Verifies a new block is aligned and lies within the heap segment, and
+ * updates the thread's view of the topmost heap address in use.  Overlap
+ * is not checked across threads; a block handed out twice shows up as
+ * corrupted payload instead.
+ */
+static bool check_block(worker_t *w, void *ptr, size_t size, int lineno) {
+    if (((uintptr_t)ptr) % ALIGNMENT != 0) {
+        thread_error(w, lineno, "New block (%p) not aligned to %d bytes", ptr, ALIGNMENT);
+        return false;
+    }
+    if (ptr == NULL && size == 0) {
+        return true;
+    }
+    void *end = (char *)ptr + size;
+    void *heap_end = (char *)heap_segment_start() + heap_segment_size();
+    if (ptr < heap_segment_start() || end > heap_end) {
+        thread_error(w, lineno, "New block (%p:%p) not within heap segment (%p:%p)",
+            ptr, end, heap_segment_start(), heap_end);
+        return false;
+    }
+    if ((char *)end > (char *)w->heap_end) {
+        w->heap_end = end;
+    }
+    return true;
+}
+
+/* Function: check_payload
+ * -----------------------
+ * Verifies that a block still holds the id byte pattern it was filled with.
+ */
+static bool check_payload(worker_t *w, void *ptr, size_t size, int id, int lineno, char *op) {
+    bool intact = replay.sample_payloads ? payload_matches_sampled(ptr, size, id & 0xFF)
+                                         : payload_matches(ptr, size, id & 0xFF);
+    if (!intact) {
+        thread_error(w, lineno, "invalid payload data detected when %s address %p", op, ptr);
+        return false;
+    }
+    return true;
+}
+
+/* Function: thread_error
+ * ----------------------
+ * Reports an error detected by a replay thread, in the same format as
+ * allocator_error in test_harness.c plus the thread number.
+ */
+static void thread_error(worker_t *w, int lineno, char *format, ...) {
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    printf("\nALLOCATOR FAILURE [%s, line %d, thread %d]: %s\n",
+        w->script->name, lineno, w->index, message);
+}
@@ -0,0 +1,155 @@
+/* File: payload.c
+ * ---------------
+ * Payload verification kernels for the drivers.  Each kernel compares
+ * 64 bytes per loop iteration against the id byte pattern: AVX2 as two
+ * 32-byte compares, SSE2 as four 16-byte compares, and a portable
+ * fallback as eight 8-byte word compares.  The best kernel for the CPU is
+ * picked when the program starts, before any replay threads exist.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "payload.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+// bytes compared per unrolled loop iteration
+#define STEP 64
+
+// blocks up to this size are always checked in full by the sampled check
+#define SAMPLE_FULL_BYTES 512
+
+// random stripes checked in each large block by the sampled check
+#define SAMPLE_STRIPES 4
+
+typedef bool (*kernel_fn)(const unsigned char *p, size_t size, unsigned char byte);
+
+static bool kernel_scalar(const unsigned char *p, size_t size, unsigned char byte);
+
+static kernel_fn kernel = kernel_scalar;
+static const char *kernel_name = "scalar";
+
+// per-thread state for the stripe positions of the sampled check (xorshift64)
+static __thread uint64_t sample_state = 0x2545f4914f6cdd1dULL;
+
+
+/* Function: check_tail
+ * --------------------
+ * Byte-at-a-time check for the last few bytes that don't fill a step.
+ */
+static inline bool check_tail(const unsigned char *p, size_t size, unsigned char byte) {
+    for (size_t i = 0; i < size; i++) {
+        if (p[i] != byte) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool kernel_scalar(const unsigned char *p, size_t size, unsigned char byte) {
+    uint64_t pattern = 0x0101010101010101ULL * byte;
+    size_t i = 0;
+    for (; i + STEP <= size; i += STEP) {
+        uint64_t words[STEP / 8];
+        memcpy(words, p + i, STEP);     // unaligned-safe word loads
+        uint64_t diff = 0;
+        for (int w = 0; w < STEP / 8; w++) {
+            diff |= words[w] ^ pattern;
+        }
+        if (diff != 0) {
+            return false;
+        }
+    }
+    return check_tail(p + i, size - i, byte);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static bool kernel_sse2(const unsigned char *p, size_t size, unsigned char byte) {
+    __m128i pattern = _mm_set1_epi8((char)byte);
+    size_t i = 0;
+    for (; i + STEP <= size; i += STEP) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), pattern);
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 16)), pattern);
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 32)), pattern);
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 48)), pattern);
+        __m128i all = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(all) != 0xFFFF) {
+            return false;
+        }
+    }
+    return check_tail(p + i, size - i, byte);
+}
+
+__attribute__((target("avx2")))
+static bool kernel_avx2(const unsigned char *p, size_t size, unsigned char byte) {
+    __m256i pattern = _mm256_set1_epi8((char)byte);
+    size_t i = 0;
+    for (; i + STEP <= size; i += STEP) {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), pattern);
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + 32)), pattern);
+        if ((unsigned)_mm256_movemask_epi8(_mm256_and_si256(eq0, eq1)) != 0xFFFFFFFFu) {
+            return false;
+        }
+    }
+    return check_tail(p + i, size - i, byte);
+}
+
+#endif
+
+/* Function: select_kernel
+ * -----------------------
+ * Points kernel at the best kernel the CPU supports.  Runs as a
+ * constructor, so the pointer is never written while threads read it.
+ */
+__attribute__((constructor))
+static void select_kernel(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = kernel_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = kernel_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+bool payload_matches(const void *ptr, size_t size, unsigned char byte) {
+    return kernel(ptr, size, byte);
+}
+
+/* Function: payload_matches_sampled
+ * ---------------------------------
+ * Small blocks are checked in full.  For larger ones, the first and last
+ * STEP bytes are checked (where overruns from neighbors show up) along
+ * with SAMPLE_STRIPES stripes at pseudo-random offsets.
+ */
+bool payload_matches_sampled(const void *ptr, size_t size, unsigned char byte) {
+    const unsigned char *p = ptr;
+    if (size <= SAMPLE_FULL_BYTES) {
+        return kernel(p, size, byte);
+    }
+    if (!kernel(p, STEP, byte) || !kernel(p + size - STEP, STEP, byte)) {
+        return false;
+    }
+    for (int i = 0; i < SAMPLE_STRIPES; i++) {
+        sample_state ^= sample_state << 13;
+        sample_state ^= sample_state >> 7;
+        sample_state ^= sample_state << 17;
+        size_t offset = sample_state % (size - STEP);
+        if (!kernel(p + offset, STEP, byte)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *payload_kernel_name(void) {
+    return kernel_name;
+}
@@ -0,0 +1,36 @@
+/* File: payload.h
+ * ---------------
+ * Checks that a block's payload still holds the repeating id byte the
+ * drivers fill it with.  The full check uses the widest vector unit the
+ * CPU supports (picked once at runtime); the sampled check only looks at
+ * the head, the tail and a few pseudo-random stripes of large blocks, to
+ * keep correctness runs on big traces fast.
+ */
+
+#ifndef _PAYLOAD_H_
+#define _PAYLOAD_H_
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+/* Function: payload_matches
+ * -------------------------
+ * Returns true if every one of the size bytes at ptr equals byte.
+ */
+bool payload_matches(const void *ptr, size_t size, unsigned char byte);
+
+/* Function: payload_matches_sampled
+ * ---------------------------------
+ * Like payload_matches, but blocks larger than a few hundred bytes are
+ * only checked at the head, the tail and a few random 64-byte stripes.
+ */
+bool payload_matches_sampled(const void *ptr, size_t size, unsigned char byte);
+
+/* Function: payload_kernel_name
+ * -----------------------------
+ * Returns the name of the kernel payload_matches dispatches to
+ * ("avx2", "sse2" or "scalar").
+ */
+const char *payload_kernel_name(void);
+
+#endif
@@ -0,0 +1,95 @@
+/* File: perf_counters.c
+ * ---------------------
+ * perf_event_open wrappers for the drivers; see perf_counters.h.
+ */
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+// perf event type, config and name for each perf_counter_id
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} events[NUM_PERF_COUNTERS] = {
+    [PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    [PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    [PERF_L1D_MISSES] = {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), "L1D misses"},
+    [PERF_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC misses"},
+    [PERF_DTLB_MISSES] = {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+        PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), "dTLB misses"},
+    [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch misses"},
+};
+
+
+bool perf_counters_open(perf_counters *pc) {
+    bool any = false;
+    pc->open_errno = 0;
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;    // allowed at perf_event_paranoid 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pc->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pc->fds[i] != -1) {
+            any = true;
+        } else if (pc->open_errno == 0) {
+            pc->open_errno = errno;
+        }
+    }
+    return any;
+}
+
+void perf_counters_start(perf_counters *pc) {
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        if (pc->fds[i] != -1) {
+            ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perf_counters_stop(perf_counters *pc) {
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        if (pc->fds[i] != -1) {
+            ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+bool perf_counters_read(perf_counters *pc, perf_counter_id id, uint64_t *value) {
+    uint64_t data[3];   // value, time enabled, time running
+    if (pc->fds[id] == -1 || read(pc->fds[id], data, sizeof(data)) != sizeof(data) ||
+        data[2] == 0) {
+        return false;
+    }
+    *value = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+    return true;
+}
+
+const char *perf_counter_name(perf_counter_id id) {
+    return events[id].name;
+}
+
+void perf_counters_close(perf_counters *pc) {
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        if (pc->fds[i] != -1) {
+            close(pc->fds[i]);
+            pc->fds[i] = -1;
+        }
+    }
+}
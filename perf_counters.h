@@ -0,0 +1,72 @@
+/* File: perf_counters.h
+ * ---------------------
+ * Hardware performance counters (via perf_event_open) for timing the
+ * drivers' replay loops: cycles, instructions, L1D read misses, LLC
+ * misses, dTLB read misses and branch misses of the calling thread, in
+ * user space only.  Each counter is opened on its own, so a counter the
+ * CPU, kernel or perf_event_paranoid setting does not allow is simply
+ * reported as unavailable while the others still work.
+ */
+
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_COUNTERS
+} perf_counter_id;
+
+typedef struct {
+    int fds[NUM_PERF_COUNTERS];     // -1 for counters that could not be opened
+    int open_errno;                 // why the first unavailable counter failed
+} perf_counters;
+
+
+/* Function: perf_counters_open
+ * ----------------------------
+ * Opens every counter (stopped) for the calling thread.  Returns true if
+ * at least one counter is available.
+ */
+bool perf_counters_open(perf_counters *pc);
+
+/* Function: perf_counters_start
+ * -----------------------------
+ * Zeroes the available counters and starts them counting.
+ */
+void perf_counters_start(perf_counters *pc);
+
+/* Function: perf_counters_stop
+ * ----------------------------
+ * Stops the available counters; their values can then be read.
+ */
+void perf_counters_stop(perf_counters *pc);
+
+/* Function: perf_counters_read
+ * ----------------------------
+ * Stores a counter's value in *value, scaled up if the kernel had to
+ * multiplex it with other counters.  Returns false if the counter is
+ * unavailable or never got to run.
+ */
+bool perf_counters_read(perf_counters *pc, perf_counter_id id, uint64_t *value);
+
+/* Function: perf_counter_name
+ * ---------------------------
+ * Returns a short printable name for a counter.
+ */
+const char *perf_counter_name(perf_counter_id id);
+
+/* Function: perf_counters_close
+ * -----------------------------
+ * Closes every counter that was opened.
+ */
+void perf_counters_close(perf_counters *pc);
+
+#endif
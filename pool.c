@@ -0,0 +1,126 @@
+/* File: pool.c
+ * ------------
+ * The object pools described in pool.h, built on mymalloc and myfree.
+ * Each chunk starts with a pointer to the previous chunk, so that
+ * mypool_destroy can find them all, followed by the objects.  A new chunk
+ * is not threaded onto the free stack; objects are bumped off its unused
+ * end as they are needed.  Chunks double in size, from about
+ * MIN_CHUNK_BYTES up to MAX_CHUNK_BYTES, so small pools stay small.  The
+ * pool itself comes from the C library's malloc, like the handle table.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "allocator.h"
+#include "pool.h"
+
+// smallest and largest chunk, not counting the chunk header
+#define MIN_CHUNK_BYTES 4096
+#define MAX_CHUNK_BYTES (1 << 20)
+
+// fewest objects in a chunk, for objects too big for MIN_CHUNK_BYTES
+#define MIN_CHUNK_OBJECTS 8
+
+typedef struct chunk {
+    struct chunk *prev;     // chunk allocated before this one, NULL for the first
+} chunk;
+
+struct mypool {
+    size_t stride;          // bytes from one object to the next
+    size_t align;
+    size_t chunk_objects;   // objects in the next chunk
+    chunk *chunks;          // most recent chunk
+    void *free_stack;       // freed objects, each holding the next one's address
+    char *fresh;            // next never-used object in the most recent chunk
+    char *fresh_end;
+};
+
+
+/* Function: roundup
+ * -----------------
+ * Rounds sz up to a multiple of mult, a power of 2.
+ */
+static size_t roundup(size_t sz, size_t mult) {
+    return (sz + mult - 1) & ~(mult - 1);
+}
+
+mypool *mypool_create(size_t obj_size, size_t align) {
+    if (align == 0) {
+        align = ALIGNMENT;
+    }
+    if ((align & (align - 1)) != 0) {
+        return NULL;
+    }
+    mypool *pool = malloc(sizeof(mypool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    // every object must be able to hold the free stack's link
+    pool->stride = roundup(obj_size < sizeof(void *) ? sizeof(void *) : obj_size, align);
+    pool->align = align;
+    pool->chunk_objects = MIN_CHUNK_BYTES / pool->stride;
+    if (pool->chunk_objects < MIN_CHUNK_OBJECTS) {
+        pool->chunk_objects = MIN_CHUNK_OBJECTS;
+    }
+    pool->chunks = NULL;
+    pool->free_stack = NULL;
+    pool->fresh = pool->fresh_end = NULL;
+    return pool;
+}
+
+/* Function: add_chunk
+ * -------------------
+ * Allocates the pool's next chunk and makes its objects the fresh ones.
+ * Alignments above ALIGNMENT are met by allocating extra bytes and
+ * skipping to the first aligned address.  Returns false if mymalloc fails.
+ */
+static bool add_chunk(mypool *pool) {
+    size_t slack = pool->align > ALIGNMENT ? pool->align - ALIGNMENT : 0;
+    chunk *c = mymalloc(sizeof(chunk) + slack + pool->chunk_objects * pool->stride);
+    if (c == NULL) {
+        return false;
+    }
+    c->prev = pool->chunks;
+    pool->chunks = c;
+    pool->fresh = (char *)roundup((uintptr_t)(c + 1), pool->align);
+    pool->fresh_end = pool->fresh + pool->chunk_objects * pool->stride;
+    if (pool->chunk_objects * pool->stride * 2 <= MAX_CHUNK_BYTES) {
+        pool->chunk_objects *= 2;
+    }
+    return true;
+}
+
+void *mypool_alloc(mypool *pool) {
+    void *obj = pool->free_stack;
+    if (obj != NULL) {
+        pool->free_stack = *(void **)obj;
+        return obj;
+    }
+    if (pool->fresh == pool->fresh_end && !add_chunk(pool)) {
+        return NULL;
+    }
+    obj = pool->fresh;
+    pool->fresh += pool->stride;
+    return obj;
+}
+
+void mypool_free(mypool *pool, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    *(void **)obj = pool->free_stack;
+    pool->free_stack = obj;
+}
+
+void mypool_destroy(mypool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    chunk *c = pool->chunks;
+    while (c != NULL) {
+        chunk *prev = c->prev;
+        myfree(c);
+        c = prev;
+    }
+    free(pool);
+}
@@ -0,0 +1,55 @@
+/* File: pool.h
+ * ------------
+ * Pools of fixed-size objects.  A pool carves large chunks out of the heap
+ * with mymalloc and hands out objects from them, so allocating or freeing
+ * an object is a few instructions with no search, no split and no header
+ * per object:
+ *
+ *   mypool *nodes = mypool_create(sizeof(node), 0);
+ *   node *n = mypool_alloc(nodes);
+ *   ...
+ *   mypool_free(nodes, n);
+ *   mypool_destroy(nodes);             // frees every chunk, live objects too
+ *
+ * Freed objects go on a stack threaded through the objects themselves and
+ * are reused first.  Chunks are only returned to the heap by
+ * mypool_destroy.  Objects must be freed to the pool they came from, never
+ * with myfree.  None of this is thread-safe.
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+typedef struct mypool mypool;
+
+
+/* Function: mypool_create
+ * -----------------------
+ * Makes an empty pool of objects of obj_size bytes, each aligned to align
+ * (a power of 2, or 0 for ALIGNMENT).  Returns NULL if align is not a
+ * power of 2 or the pool could not be allocated.
+ */
+mypool *mypool_create(size_t obj_size, size_t align);
+
+/* Function: mypool_alloc
+ * ----------------------
+ * Returns an object from the pool, or NULL if the heap has no room for
+ * another chunk.
+ */
+void *mypool_alloc(mypool *pool);
+
+/* Function: mypool_free
+ * ---------------------
+ * Returns an object to its pool.  Freeing NULL does nothing.
+ */
+void mypool_free(mypool *pool, void *obj);
+
+/* Function: mypool_destroy
+ * ------------------------
+ * Frees all of the pool's chunks with myfree, along with the pool.
+ */
+void mypool_destroy(mypool *pool);
+
+#endif
@@ -0,0 +1,519 @@
+/* File: script.c
+ * --------------
+ * Reads script files containing a sequence of allocator requests.  Split
+ * out of test_harness.c so that every driver shares one parser.  Text
+ * scripts are mmap'ed and parsed by several threads at once; binary
+ * traces are mmap'ed and decoded lazily by script_next.
+ */
+
+#include <error.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "script.h"
+
+
+// Amount by which we resize ops when needed when reading in from file
+static const int OPS_RESIZE_AMOUNT = 500;
+
+#define MAX_SCRIPT_LINE_LEN 1024
+
+// Text files are split into chunks of at least this many bytes per thread
+#define MIN_CHUNK_BYTES (1 << 20)
+#define MAX_PARSE_THREADS 16
+
+// one thread's share of a text script being parsed in parallel
+typedef struct {
+    const char *begin;      // first byte of the chunk (start of a line)
+    const char *end;        // one past the last byte (after a newline or EOF)
+    int first_lineno;       // line number of the line at begin, minus one
+    int nlines;             // lines in this chunk, including comments
+    request_t *ops;         // requests parsed from this chunk
+    int num_ops;
+    int maxid;
+    const char *script_name;
+} parse_chunk;
+
+
+static void parse_text_stream(script_t *script, FILE *fp);
+static void parse_text_mapped(script_t *script, const char *text, size_t len);
+static void *count_chunk_lines(void *arg);
+static void *parse_chunk_lines(void *arg);
+static void map_binary_trace(script_t *script, void *data, size_t len);
+static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
+static bool is_request_line(const char *buffer);
+static void append_request(request_t **ops, int *num_ops, int *nallocated, request_t request);
+static bool read_varint(const unsigned char **pos, const unsigned char *end, uint64_t *value);
+static void write_varint(FILE *fp, uint64_t value);
+
+
+/* SCRIPT PARSING IMPLEMENTATION */
+
+
+/* Function: parse_script
+ * ----------------------
+ * This function loads the script file at the specified path, and returns an
+ * object with info about it.  Binary traces (recognized by their header)
+ * are mapped into memory as-is.  Text scripts are expected to have one
+ * request per line, and each request's information is added to the ops
+ * array within the script.  This function throws an error if the file
+ * can't be opened, if a line is malformed, or if the file is too long to
+ * store each request on the heap.
+ */
+script_t parse_script(const char *path) {
+    // Initialize a script object to store the information about this script
+    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0,
+        .trace = NULL, .mapping = NULL, .timed = false };
+    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    // A path of "-" reads the script from stdin (e.g. piped from gen_script)
+    if (strcmp(path, "-") == 0) {
+        strcpy(script.name, "stdin");
+        parse_text_stream(&script, stdin);
+    } else {
+        strncpy(script.name, basename, sizeof(script.name) - 1);
+        script.name[sizeof(script.name) - 1] = '\0';
+
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            error(1, 0, "Could not open script file \"%s\".", path);
+        }
+        size_t len = st.st_size;
+        void *data = NULL;
+        if (len > 0) {
+            data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                error(1, 0, "Could not map script file \"%s\".", path);
+            }
+        }
+        close(fd);
+
+        if (len >= sizeof(trace_header) && memcmp(data, TRACE_MAGIC, 8) == 0) {
+            map_binary_trace(&script, data, len);
+        } else {
+            parse_text_mapped(&script, data, len);
+            if (data != NULL) {
+                munmap(data, len);
+            }
+        }
+    }
+
+    script.blocks = calloc(script.num_ids, sizeof(block_t));
+    if (!script.blocks) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    return script;
+}
+
+/* Function: free_script
+ * ---------------------
+ * Frees the ops and blocks arrays allocated by parse_script and unmaps a
+ * binary trace.
+ */
+void free_script(script_t *script) {
+    free(script->ops);
+    free(script->blocks);
+    if (script->mapping != NULL) {
+        munmap(script->mapping, script->mapping_size);
+    }
+    script->ops = NULL;
+    script->blocks = NULL;
+    script->mapping = NULL;
+    script->trace = NULL;
+}
+
+/* Function: parse_text_stream
+ * ---------------------------
+ * Parses a text script one line at a time from a stream that can't be
+ * mapped, such as a pipe.
+ */
+static void parse_text_stream(script_t *script, FILE *fp) {
+    int lineno = 0;
+    int nallocated = 0;
+    int maxid = 0;
+    char buffer[MAX_SCRIPT_LINE_LEN];
+
+    while (read_line(buffer, sizeof(buffer), fp, &lineno)) {
+        request_t request = parse_script_line(buffer, lineno, script->name);
+        if (request.id > maxid) {
+            maxid = request.id;
+        }
+        append_request(&script->ops, &script->num_ops, &nallocated, request);
+    }
+    script->num_ids = maxid + 1;
+}
+
+/* Function: parse_text_mapped
+ * ---------------------------
+ * Parses a text script held in memory.  The text is split at line
+ * boundaries into one chunk per thread.  A first parallel pass counts the
+ * lines in each chunk so that every chunk knows its starting line number
+ * (for error messages), and a second parallel pass parses the requests.
+ * The per-chunk results are then concatenated in order.
+ */
+static void parse_text_mapped(script_t *script, const char *text, size_t len) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nchunks = 1 + len / MIN_CHUNK_BYTES;
+    if (nchunks > ncpus) {
+        nchunks = ncpus > 0 ? ncpus : 1;
+    }
+    if (nchunks > MAX_PARSE_THREADS) {
+        nchunks = MAX_PARSE_THREADS;
+    }
+
+    parse_chunk chunks[MAX_PARSE_THREADS];
+    const char *text_end = text + len;
+    const char *begin = text;
+    for (int i = 0; i < nchunks; i++) {
+        const char *end = text_end;
+        if (i < nchunks - 1) {
+            end = text + (len / nchunks) * (i + 1);
+            if (end < begin) {
+                end = begin;
+            }
+            const char *newline = memchr(end, '\n', text_end - end);
+            end = newline ? newline + 1 : text_end;
+        }
+        chunks[i] = (parse_chunk){ .begin = begin, .end = end, .ops = NULL,
+            .num_ops = 0, .maxid = 0, .script_name = script->name };
+        begin = end;
+    }
+
+    pthread_t threads[MAX_PARSE_THREADS];
+    for (int i = 1; i < nchunks; i++) {
+        pthread_create(&threads[i], NULL, count_chunk_lines, &chunks[i]);
+    }
+    count_chunk_lines(&chunks[0]);
+    for (int i = 1; i < nchunks; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int lineno = 0;
+    for (int i = 0; i < nchunks; i++) {
+        chunks[i].first_lineno = lineno;
+        lineno += chunks[i].nlines;
+    }
+
+    for (int i = 1; i < nchunks; i++) {
+        pthread_create(&threads[i], NULL, parse_chunk_lines, &chunks[i]);
+    }
+    parse_chunk_lines(&chunks[0]);
+    for (int i = 1; i < nchunks; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int total_ops = 0;
+    int maxid = 0;
+    for (int i = 0; i < nchunks; i++) {
+        total_ops += chunks[i].num_ops;
+        if (chunks[i].maxid > maxid) {
+            maxid = chunks[i].maxid;
+        }
+    }
+    if (nchunks == 1) {
+        script->ops = chunks[0].ops;
+    } else {
+        script->ops = malloc(total_ops * sizeof(request_t));
+        if (!script->ops && total_ops > 0) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        request_t *dst = script->ops;
+        for (int i = 0; i < nchunks; i++) {
+            memcpy(dst, chunks[i].ops, chunks[i].num_ops * sizeof(request_t));
+            dst += chunks[i].num_ops;
+            free(chunks[i].ops);
+        }
+    }
+    script->num_ops = total_ops;
+    script->num_ids = maxid + 1;
+}
+
+/* Function: count_chunk_lines
+ * ---------------------------
+ * Thread body for the first pass of parse_text_mapped: counts the lines in
+ * one chunk (a final line without a newline still counts).
+ */
+static void *count_chunk_lines(void *arg) {
+    parse_chunk *chunk = arg;
+    int nlines = 0;
+    const char *p = chunk->begin;
+    while (p < chunk->end) {
+        const char *newline = memchr(p, '\n', chunk->end - p);
+        nlines++;
+        p = newline ? newline + 1 : chunk->end;
+    }
+    chunk->nlines = nlines;
+    return NULL;
+}
+
+/* Function: parse_chunk_lines
+ * ---------------------------
+ * Thread body for the second pass of parse_text_mapped: parses every
+ * request line in one chunk.  Lines are copied into a buffer first so
+ * that they are handled exactly as read_line would hand them over.
+ */
+static void *parse_chunk_lines(void *arg) {
+    parse_chunk *chunk = arg;
+    int nallocated = 0;
+    int lineno = chunk->first_lineno;
+    char buffer[MAX_SCRIPT_LINE_LEN];
+
+    const char *p = chunk->begin;
+    while (p < chunk->end) {
+        const char *newline = memchr(p, '\n', chunk->end - p);
+        const char *line_end = newline ? newline : chunk->end;
+        size_t n = line_end - p;
+        if (n > sizeof(buffer) - 1) {
+            n = sizeof(buffer) - 1;
+        }
+        memcpy(buffer, p, n);
+        buffer[n] = '\0';
+        lineno++;
+        p = newline ? newline + 1 : chunk->end;
+
+        if (!is_request_line(buffer)) {
+            continue;
+        }
+        request_t request = parse_script_line(buffer, lineno, (char *)chunk->script_name);
+        if (request.id > chunk->maxid) {
+            chunk->maxid = request.id;
+        }
+        append_request(&chunk->ops, &chunk->num_ops, &nallocated, request);
+    }
+    return NULL;
+}
+
+/* Function: map_binary_trace
+ * --------------------------
+ * Sets up a script to replay a mapped binary trace.  Only the header is
+ * read here; requests are decoded by script_next during replay.
+ */
+static void map_binary_trace(script_t *script, void *data, size_t len) {
+    const trace_header *header = data;
+    if (header->version != TRACE_VERSION || (header->flags & ~TRACE_TIMED) != 0 ||
+        header->num_ops > (uint64_t)__INT_MAX__ || header->max_id >= (uint32_t)__INT_MAX__) {
+        error(1, 0, "Binary trace '%s' has an unsupported header.", script->name);
+    }
+    script->mapping = data;
+    script->mapping_size = len;
+    script->trace = (const unsigned char *)data + sizeof(trace_header);
+    script->trace_end = (const unsigned char *)data + len;
+    script->num_ops = header->num_ops;
+    script->num_ids = header->max_id + 1;
+    script->timed = (header->flags & TRACE_TIMED) != 0;
+}
+
+/* Function: script_begin
+ * ----------------------
+ * Returns a cursor positioned at the first request of the script.
+ */
+script_cursor script_begin(const script_t *script) {
+    return (script_cursor){ .index = 0, .pos = script->trace, .time_ns = 0 };
+}
+
+/* Function: script_next
+ * ---------------------
+ * Stores the request at the cursor in *request and advances the cursor.
+ * Text scripts simply index the parsed ops array.  Binary requests are
+ * decoded in place; a truncated request or an id beyond the header's
+ * max_id is reported as a malformed trace.
+ */
+bool script_next(const script_t *script, script_cursor *cursor, request_t *request) {
+    if (cursor->index >= script->num_ops) {
+        return false;
+    }
+    if (script->ops != NULL) {
+        *request = script->ops[cursor->index++];
+        return true;
+    }
+
+    const unsigned char *pos = cursor->pos;
+    uint64_t id = 0, size = 0, tid = 0, delta = 0;
+    char op = pos < script->trace_end ? *pos++ : 0;
+    bool ok = read_varint(&pos, script->trace_end, &id) && id < (uint64_t)script->num_ids;
+    if (op == 'a' || op == 'r') {
+        ok = ok && read_varint(&pos, script->trace_end, &size) && size <= MAX_REQUEST_SIZE;
+    } else if (op != 'f') {
+        ok = false;
+    }
+    if (script->timed) {
+        ok = ok && read_varint(&pos, script->trace_end, &tid) &&
+            read_varint(&pos, script->trace_end, &delta);
+    }
+    if (!ok) {
+        error(1, 0, "Request %d of binary trace '%s' is malformed.",
+            cursor->index + 1, script->name);
+    }
+
+    request->op = op == 'a' ? ALLOC : op == 'r' ? REALLOC : FREE;
+    request->id = id;
+    request->size = size;
+    request->lineno = ++cursor->index;
+    request->tid = tid;
+    request->time_ns = cursor->time_ns + delta;
+    cursor->time_ns = request->time_ns;
+    cursor->pos = pos;
+    return true;
+}
+
+/* Function: write_binary_script
+ * -----------------------------
+ * Writes the header and every request of the script in the binary trace
+ * format described in script.h, including thread ids and timestamps if
+ * the script is timed.
+ */
+bool write_binary_script(const script_t *script, FILE *fp) {
+    trace_header header = { .version = TRACE_VERSION, .flags = script->timed ? TRACE_TIMED : 0,
+        .num_ops = script->num_ops, .max_id = script->num_ids - 1, .reserved = 0 };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, fp);
+
+    script_cursor cursor = script_begin(script);
+    request_t request;
+    uint64_t prev_time = 0;
+    while (script_next(script, &cursor, &request)) {
+        fputc(request.op == ALLOC ? 'a' : request.op == REALLOC ? 'r' : 'f', fp);
+        write_varint(fp, request.id);
+        if (request.op != FREE) {
+            write_varint(fp, request.size);
+        }
+        if (script->timed) {
+            write_varint(fp, request.tid);
+            write_varint(fp, request.time_ns - prev_time);
+            prev_time = request.time_ns;
+        }
+    }
+    return !ferror(fp);
+}
+
+/* Function: read_line
+ * --------------------
+ * This function reads one line from the specified file and stores at most
+ * buffer_size characters from it in buffer, removing any trailing newline.
+ * It skips lines that are all-whitespace or that contain comments (begin with
+ * # as first non-whitespace character).  When reading a line, it increments the
+ * counter pointed to by `pnread` once for each line read/skipped. This function
+ * returns true if did read a valid line eventually, or false otherwise.
+ */
+static bool read_line(char buffer[], size_t buffer_size, FILE *fp,
+    int *pnread) {
+
+    while (true) {
+        if (fgets(buffer, buffer_size, fp) == NULL) {
+            return false;
+        }
+
+        (*pnread)++;
+
+        // remove any trailing newline
+        if (buffer[strlen(buffer)-1] == '\n') {
+            buffer[strlen(buffer)-1] ='\0';
+        }
+
+        if (is_request_line(buffer)) {
+            return true;
+        }
+    }
+}
+
+/* Function: is_request_line
+ * -------------------------
+ * Returns true if the line is not all-whitespace and not a comment line
+ * (comment lines start with # as first non-whitespace character).
+ */
+static bool is_request_line(const char *buffer) {
+    char ch;
+    return sscanf(buffer, " %c", &ch) == 1 && ch != '#';
+}
+
+/* Function: append_request
+ * ------------------------
+ * Appends a request to a growable ops array, resizing it by
+ * OPS_RESIZE_AMOUNT entries (or doubling, once it is large) when full.
+ */
+static void append_request(request_t **ops, int *num_ops, int *nallocated,
+    request_t request) {
+
+    if (*num_ops == *nallocated) {
+        *nallocated += *nallocated > OPS_RESIZE_AMOUNT ? *nallocated : OPS_RESIZE_AMOUNT;
+        void *new_memory = realloc(*ops, *nallocated * sizeof(request_t));
+        if (!new_memory) {
+            free(*ops);
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        *ops = new_memory;
+    }
+    (*ops)[(*num_ops)++] = request;
+}
+
+/* Function: read_varint
+ * ---------------------
+ * Decodes an unsigned LEB128 varint at *pos, advancing *pos past it.
+ * Returns false if the varint runs past end or is longer than 64 bits.
+ */
+static bool read_varint(const unsigned char **pos, const unsigned char *end,
+    uint64_t *value) {
+
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        unsigned char byte = *(*pos)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Function: write_varint
+ * ----------------------
+ * Writes value as an unsigned LEB128 varint: 7 bits per byte, low bits
+ * first, with the high bit set on every byte except the last.
+ */
+static void write_varint(FILE *fp, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7f) | 0x80, fp);
+        value >>= 7;
+    }
+    fputc(value, fp);
+}
+
+/* Function: parse_script_line
+ * ---------------------------
+ * This function parses the provided line from the script and returns info
+ * about it as a request_t object filled in with the type of the request,
+ * the size, the ID, and the line number.  If the line is malformed, this
+ * function throws an error.
+ */
+request_t parse_script_line(char *buffer, int lineno,
+    char *script_name) {
+
+    request_t request = { .lineno = lineno, .op = 0, .size = 0, .tid = 0, .time_ns = 0};
+
+    char request_char;
+    int nscanned = sscanf(buffer, " %c %d %zu", &request_char,
+        &request.id, &request.size);
+    if (request_char == 'a' && nscanned == 3) {
+        request.op = ALLOC;
+    } else if (request_char == 'r' && nscanned == 3) {
+        request.op = REALLOC;
+    } else if (request_char == 'f' && nscanned == 2) {
+        request.op = FREE;
+    }
+
+    if (!request.op || request.id < 0 || request.size > MAX_REQUEST_SIZE) {
+        error(1, 0, "Line %d of script file '%s' is malformed.",
+            lineno, script_name);
+    }
+
+    return request;
+}
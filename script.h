@@ -0,0 +1,127 @@
+/* File: script.h
+ * --------------
+ * Types and parsing routines for allocator script files.  Shared by the
+ * test harness and the other drivers that replay scripts against an
+ * allocator.  Two formats are understood:
+ *
+ *  - the text format in samples/, one "a id size", "r id size" or "f id"
+ *    request per line, with # comments
+ *  - a compact binary trace format (see trace_header below), written by
+ *    trace_convert, which is mmap'ed and decoded on the fly during replay
+ */
+
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t
+#include <stdio.h>   // for FILE
+
+
+// enum and struct for a single allocator request
+enum request_type {
+    ALLOC = 1,
+    FREE,
+    REALLOC
+};
+typedef struct {
+    enum request_type op;   // type of request
+    int id;                 // id for free() to use later
+    size_t size;            // num bytes for alloc/realloc request
+    int lineno;             // which line in file
+    int tid;                // recording thread (timed binary traces only, else 0)
+    uint64_t time_ns;       // time since the first request (timed traces only)
+} request_t;
+
+// struct for facts about a single malloc'ed block
+typedef struct {
+    void *ptr;
+    size_t size;
+} block_t;
+
+// struct for info for one script file
+typedef struct {
+    char name[128];     // short name of script
+    request_t *ops;     // array of requests read from a text script (NULL if binary)
+    int num_ops;        // number of requests
+    int num_ids;        // number of distinct block ids
+    block_t *blocks;    // array of memory blocks malloc returns when executing
+    size_t peak_size;   // total payload bytes at peak in-use
+    const unsigned char *trace;     // encoded requests of a binary trace
+    const unsigned char *trace_end; // end of the encoded requests
+    void *mapping;                  // mmap'ed binary trace file, if any
+    size_t mapping_size;
+    bool timed;                     // requests carry tid and time_ns
+} script_t;
+
+// position of a driver within a script's sequence of requests
+typedef struct {
+    int index;                  // number of requests returned so far
+    const unsigned char *pos;   // next encoded request (binary traces only)
+    uint64_t time_ns;           // timestamp of the previous request
+} script_cursor;
+
+/* Binary trace format: this header, then num_ops requests, each encoded as
+ * one op byte ('a', 'r' or 'f'), the block id as an unsigned LEB128 varint
+ * and, for 'a' and 'r', the size as another varint.  If the header has
+ * TRACE_TIMED set, every request is followed by two more varints: the
+ * recording thread id and the nanoseconds since the previous request.
+ * The harness reports the request index (counting from 1) in place of a
+ * line number.
+ */
+#define TRACE_MAGIC "HMTRACE1"
+#define TRACE_VERSION 1
+#define TRACE_TIMED 0x1
+
+typedef struct {
+    char magic[8];      // TRACE_MAGIC, not NUL-terminated
+    uint32_t version;   // TRACE_VERSION
+    uint32_t flags;     // optional per-request fields (TRACE_TIMED)
+    uint64_t num_ops;   // number of requests that follow
+    uint32_t max_id;    // largest block id used
+    uint32_t reserved;
+} trace_header;
+
+
+/* Function: parse_script
+ * ----------------------
+ * Loads the script file at the specified path and returns an object
+ * with info about it, including a zeroed blocks array with one entry per
+ * block id.  Binary traces are mapped rather than parsed; text files are
+ * parsed in parallel chunks.  A path of "-" reads text from stdin.  Exits
+ * with an error if the file can't be opened or is malformed.
+ */
+script_t parse_script(const char *path);
+
+/* Function: free_script
+ * ---------------------
+ * Releases the memory held by a script returned from parse_script.
+ */
+void free_script(script_t *script);
+
+/* Functions: script_begin, script_next
+ * ------------------------------------
+ * Iterate over a script's requests regardless of its format.  script_begin
+ * returns a cursor at the first request; script_next stores the next
+ * request in *request and returns true, or returns false at the end.
+ * Several cursors may walk the same script concurrently.
+ */
+script_cursor script_begin(const script_t *script);
+bool script_next(const script_t *script, script_cursor *cursor, request_t *request);
+
+/* Function: write_binary_script
+ * -----------------------------
+ * Writes all of the script's requests to fp in the binary trace format.
+ * Returns false if writing failed.
+ */
+bool write_binary_script(const script_t *script, FILE *fp);
+
+/* Function: parse_script_line
+ * ---------------------------
+ * Parses one (non-comment) line of a script and returns it as a request_t.
+ * Exits with an error if the line is malformed.
+ */
+request_t parse_script_line(char *buffer, int lineno, char *script_name);
+
+#endif
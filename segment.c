@@ -1,23 +1,41 @@
 /* File: segment.c
  * ---------------
  * Handles low-level storage underneath the heap allocator. It reserves
- * the large memory segment using the OS-level mmap facility.
+ * the large memory segment using the OS-level mmap facility, and any
+ * further segments the heap grows into.
  *
  * Written by jzelenski, updated Spring 2018
  */
 
+#define _GNU_SOURCE
 #include "segment.h"
 #include <assert.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Place segment at fixed address, as default addresses are quite high
  * and easily mistaken for stack addresses.
  */
 #define HEAP_START_HINT (void *)0x107000000L
 
-// Static means these variables are only visible within this file
+#define MAX_SEGMENTS 64
+#define PAGE_SIZE 4096
+
+typedef struct {
+    void *start;
+    size_t size;
+} segment;
+
+// Static means these variables are only visible within this file.
+// segment_start and segment_size describe the first segment, the one
+// init_heap_segment or open_heap_segment made; segments holds it and every
+// segment added since, in address order.
 static void *segment_start = NULL;
 static size_t segment_size = 0;
+static segment segments[MAX_SEGMENTS];
+static int nsegments = 0;
 
 void *heap_segment_start() {
     return segment_start;
@@ -27,17 +45,106 @@ size_t heap_segment_size() {
     return segment_size;
 }
 
-void *init_heap_segment(size_t total_size) {
-    // Discard any previous segment via munmap
-    if (segment_start != NULL) {
-        if (munmap(segment_start, total_size) == -1) return NULL;
-        segment_start = NULL;
-        segment_size = 0;
+size_t heap_segments_size() {
+    size_t total = 0;
+    for (int i = 0; i < nsegments; i++) {
+        total += segments[i].size;
+    }
+    return total;
+}
+
+// Unmaps every segment, each with the size it was mapped with
+static bool discard_segments() {
+    while (nsegments > 0) {
+        segment *last = &segments[nsegments - 1];
+        if (munmap(last->start, last->size) == -1) return false;
+        nsegments--;
     }
-    
+    segment_start = NULL;
+    segment_size = 0;
+    return true;
+}
+
+// Adds a mapping to segments, keeping them in address order
+static void insert_segment(void *start, size_t size) {
+    int i = nsegments++;
+    while (i > 0 && (char *)segments[i - 1].start > (char *)start) {
+        segments[i] = segments[i - 1];
+        i--;
+    }
+    segments[i] = (segment){ start, size };
+}
+
+void *init_heap_segment(size_t total_size) {
+    // Discard any previous segments via munmap
+    if (!discard_segments()) return NULL;
+
     // Re-initialize by reserving entire segment with mmap
     segment_start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
     assert(segment_start != MAP_FAILED);
     segment_size = total_size;
+    insert_segment(segment_start, segment_size);
     return segment_start;
 }
+
+void *add_heap_segment(size_t size) {
+    if (nsegments == 0 || nsegments == MAX_SEGMENTS || size == 0) return NULL;
+    size = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+    // Ask for the addresses just past the highest segment, which keeps the
+    // heap together (and within reach of compact offsets) when they are free
+    segment *last = &segments[nsegments - 1];
+    void *start = mmap((char *)last->start + last->size, size, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED) return NULL;
+    insert_segment(start, size);
+    return start;
+}
+
+bool heap_segment_find(const void *addr, void **start, size_t *size) {
+    int lo = 0, hi = nsegments - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if ((char *)addr < (char *)segments[mid].start) {
+            hi = mid - 1;
+        } else if ((char *)addr >= (char *)segments[mid].start + segments[mid].size) {
+            lo = mid + 1;
+        } else {
+            *start = segments[mid].start;
+            *size = segments[mid].size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void *open_heap_segment(const char *path, size_t total_size) {
+    if (!discard_segments()) return NULL;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || ((size_t)st.st_size < total_size && ftruncate(fd, total_size) == -1)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Pointers stored in the heap are only good at the address they were made at,
+    // so insist on the hint rather than taking whatever mmap offers
+    void *start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+    if (start == MAP_FAILED) return NULL;
+    if (start != HEAP_START_HINT) {
+        munmap(start, total_size);
+        return NULL;
+    }
+    segment_start = start;
+    segment_size = total_size;
+    insert_segment(segment_start, segment_size);
+    return segment_start;
+}
+
+bool sync_heap_segment() {
+    return segment_start != NULL && msync(segment_start, segment_size, MS_SYNC) == 0;
+}
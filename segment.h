@@ -6,8 +6,13 @@
 
 #ifndef _SEGMENT_H_
 #define _SEGMENT_H_
+#include <stdbool.h> // for bool
 #include <stddef.h> // for size_t
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 /* Function: init_heap_segment
  * ---------------------------
@@ -22,14 +27,64 @@ void *init_heap_segment(size_t total_size);
 
 
 
-/* Functions: heap_segment_start, heap_segment_size
- * ------------------------------------------------
- * heap_segment_start returns the base address of the current heap segment
- * (NULL if no segment has been initialized).
- * heap_segment_size returns the current segment size in bytes.
+/* Function: open_heap_segment
+ * ---------------------------
+ * Like init_heap_segment, but the segment is a shared mapping of the file
+ * at path (created, or extended with zeros, to total_size bytes), so the
+ * heap outlives the process.  The segment is always placed at the same
+ * fixed address, since the heap holds pointers into itself; returns NULL
+ * if the file cannot be opened or that address is taken.  After a restart,
+ * resume the heap with myattach rather than myinit.
+ */
+void *open_heap_segment(const char *path, size_t total_size);
+
+
+/* Function: sync_heap_segment
+ * ---------------------------
+ * Flushes a file-backed segment to disk, returning false on failure.
+ * Without it, the data still reaches the file, just not at a known time.
+ */
+bool sync_heap_segment();
+
+
+/* Function: add_heap_segment
+ * --------------------------
+ * Reserves another segment of at least size bytes (rounded up to whole
+ * pages), for a heap that has outgrown the ones it has; hand it to the
+ * allocator with myextend.  It goes just past the highest segment if
+ * those addresses are free, and anywhere otherwise.  Returns its base
+ * address, or NULL if there is no first segment, the 64 segments allowed
+ * are all in use or the OS refuses.  Added segments are discarded along
+ * with the first by init_heap_segment and open_heap_segment, and are never
+ * file-backed.
+ */
+void *add_heap_segment(size_t size);
+
+
+/* Function: heap_segment_find
+ * ---------------------------
+ * Finds the segment holding addr by binary search over the segments in
+ * address order, storing its base address and size in *start and *size.
+ * Returns false if addr is in none of them.
+ */
+bool heap_segment_find(const void *addr, void **start, size_t *size);
+
+
+/* Functions: heap_segment_start, heap_segment_size, heap_segments_size
+ * --------------------------------------------------------------------
+ * heap_segment_start returns the base address of the first heap segment,
+ * the one init_heap_segment or open_heap_segment made (NULL if no segment
+ * has been initialized).
+ * heap_segment_size returns the first segment's size in bytes, and
+ * heap_segments_size the total size of all the segments.
  */
 void *heap_segment_start();
 size_t heap_segment_size();
+size_t heap_segments_size();
 
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
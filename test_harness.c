@@ -1,8 +1,8 @@
 /*
  * Files: test_harness.c
  * ---------------------
- * Reads and interprets text-based script files containing a sequence of
- * allocator requests. Runs the allocator on a script and validates
+ * Reads and interprets script files (text or binary traces, see script.h)
+ * containing a sequence of allocator requests. Runs the allocator on a script and validates
  * results for correctness.
  *
  * When you compile using `make`, it will create 3 different
@@ -20,63 +20,161 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "allocator.h"
+#include "handles.h"
+#include "heapprof.h"
+#include "payload.h"
+#include "perf_counters.h"
+#include "pool.h"
+#include "script.h"
 #include "segment.h"
 
 
-/* TYPE DECLARATIONS */
-
+const long HEAP_SIZE = 1L << 32;
 
-// enum and struct for a single allocator request
-enum request_type {
-    ALLOC = 1,
-    FREE,
-    REALLOC
-};
+/* Live blocks are kept in a treap ordered by address so the overlap check
+ * in verify_block is O(log n) rather than a scan of every block id.  The
+ * nodes are indexed by block id (each id has at most one live block) and
+ * a node's key is script->blocks[id].ptr.
+ */
 typedef struct {
-    enum request_type op;   // type of request
-    int id;                 // id for free() to use later
-    size_t size;            // num bytes for alloc/realloc request
-    int lineno;             // which line in file
-} request_t;
+    int left, right;        // child ids, or -1
+    unsigned priority;      // max-heap order on priorities keeps it balanced
+} index_node;
 
-// struct for facts about a single malloc'ed block
-typedef struct {
-    void *ptr;
-    size_t size;
-} block_t;
+static index_node *index_nodes;
+static int index_root = -1;
 
-// struct for info for one script file
-typedef struct {
-    char name[128];     // short name of script
-    request_t *ops;     // array of requests read from script
-    int num_ops;        // number of requests
-    int num_ids;        // number of distinct block ids
-    block_t *blocks;    // array of memory blocks malloc returns when executing
-    size_t peak_size;   // total payload bytes at peak in-use
-} script_t;
+// set by -p: only spot-check the payloads of large blocks (see payload.h)
+static bool sample_payloads;
 
-// Amount by which we resize ops when needed when reading in from file
-const int OPS_RESIZE_AMOUNT = 500;
+// set by -N: also run a full validate_heap every this many requests (0 = never)
+static long full_check_every;
 
-const int MAX_SCRIPT_LINE_LEN = 1024;
+// set by -S: print the allocator's mystats counters after each script
+static bool show_stats;
 
-const long HEAP_SIZE = 1L << 32;
+// set by -m: write a heap map (see heapmap.h) every this many requests to
+// <script name>.heapmap, plus one after the last request (0 = never)
+static long snapshot_every;
+static FILE *snapshot_file;
+
+// set by -P: hardware counters measured around each script's replay loop
+static bool measure_perf;
+static perf_counters perf;
+
+// set by -H: mean bytes between heap profiler samples, with each script's
+// profile written to <script name>.heapprof (0 = no profiling)
+static size_t profile_interval;
+
+// set by -C: replay through the handle API (see handles.h), running an
+// incremental compaction step of this many bytes after each request
+static bool use_handles;
+static size_t compact_budget;
+
+// set by -O: after each script, replay its allocs and frees with every
+// block this many bytes, through a pool (see pool.h) and through mymalloc
+// and myfree, and print the time per request of each (0 = never)
+static size_t pool_object_size;
+
+// set by -G: start each heap in a segment of this many bytes and let the
+// allocator add segments as it fills (see grow_heap; 0 = one HEAP_SIZE
+// segment)
+static size_t grow_size;
+
+// set by -j: how many worker processes replay the scripts (1 = no workers,
+// everything runs in this process)
+static int njobs = 1;
+
+// bytes of output kept from each script a worker replays
+#define OUTPUT_MAX (1 << 20)
+
+// one script's results, left by the worker that replayed it in memory
+// shared with the parent (see test_parallel)
+typedef struct {
+    bool done;              // the worker finished the script
+    bool success;
+    int util;               // utilization in percent, if successful
+    size_t output_len;
+    char output[OUTPUT_MAX];    // everything run_script printed
+} script_result;
+
+typedef struct {
+    int next_script;        // index of the next script for a worker to take
+    script_result results[];
+} shared_results;
+
+// how many times bench_pool replays the script each way
+#define POOL_ROUNDS 5
+
+// how many handle lookups are timed for the per-deref cost
+#define DEREF_SAMPLES 10000000
+
+// what eval_handles found, printed after the script's results
+static struct {
+    size_t moved_running;   // bytes moved by the compaction steps between requests
+    size_t moved_final;     // bytes moved compacting fully at the end
+    size_t extent_before;   // live extent at the end, before and after that
+    size_t extent_after;
+    size_t free_before;     // free blocks, before and after
+    size_t free_after;
+    int nlive;              // blocks whose lookups were timed
+    double handle_ns;       // time per access through myhderef
+    double pointer_ns;      // time per access through a plain pointer
+} compaction;
+
+// names accepted by -o for the allocator's mymallopt parameters
+static const struct {
+    const char *name;
+    mallopt_param param;
+} mallopt_names[] = {
+    {"quick_max", MALLOPT_QUICK_MAX},
+    {"quick_limit", MALLOPT_QUICK_LIMIT},
+    {"realloc_growth", MALLOPT_REALLOC_GROWTH},
+    {"lifetime", MALLOPT_LIFETIME},
+    {"free_order", MALLOPT_FREE_ORDER},
+};
 
 
 /* FUNCTION PROTOTYPES */
 
 
-static int test_scripts(char *script_names[], int num_script_names, bool quiet);
-static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
-static script_t parse_script(const char *filename);
-static request_t parse_script_line(char *buffer, int lineno, char *script_name);
-static size_t eval_correctness(script_t *script, bool quiet, bool *success);
-static void *eval_malloc(int req, size_t requested_size, script_t *script, bool *failptr);
-static void *eval_realloc(int req, size_t requested_size, script_t *script, bool *failptr);
+static int test_scripts(char *script_names[], int num_script_names, validate_level level);
+static int test_parallel(char *script_names[], int num_script_names, validate_level level);
+static void run_worker(char *script_names[], int num_script_names, validate_level level,
+    shared_results *shared);
+static bool run_script(char *script_name, validate_level level, int *util);
+static void set_mallopt(const char *setting);
+static size_t eval_correctness(script_t *script, validate_level level, bool *success);
+static size_t eval_handles(script_t *script, validate_level level, bool *success);
+static size_t handles_extent(script_t *script, myhandle *handles);
+static void time_derefs(script_t *script, myhandle *handles);
+static void print_compaction(void);
+static void bench_pool(script_t *script);
+static double replay_fixed(script_t *script, void **objs, mypool *pool);
+static bool check_heap(script_t *script, validate_level level, int lineno);
+static bool init_heap(void);
+static void *grow_heap(size_t min_size, size_t *size);
+static size_t heap_extent(void *heap_end);
+static void print_heap_stats(void);
+static void take_snapshot(script_t *script, unsigned long tag);
+static void print_perf_counters(script_t *script);
+static void write_heap_profile(script_t *script);
+static void *eval_malloc(const request_t *request, script_t *script, bool *failptr);
+static void *eval_realloc(const request_t *request, script_t *script, bool *failptr);
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op);
 static void allocator_error(script_t *script, int lineno, char* format, ...);
+static void index_reset(script_t *script);
+static void index_insert(script_t *script, int id);
+static void index_remove(script_t *script, int id);
+static int index_find_overlap(script_t *script, void *ptr, void *end);
+static void index_split(script_t *script, int t, uintptr_t key, int *left, int *right);
+static int index_merge(int left, int right);
 
 
 /* CORRECTNESS EVALUATION IMPLEMENTATION */
@@ -84,18 +182,73 @@ static void allocator_error(script_t *script, int lineno, char* format, ...);
 
 /* Function: main
  * --------------
- * The main function parses command-line arguments (currently only -q for quiet)
- * and any script files that follow and runs the heap allocator on the specified
- * script files.  It outputs statistics about the run of each script, such as
- * the number of successful runs, number of failures, and average utilization.
+ * The main function parses command-line arguments and any script files that
+ * follow and runs the heap allocator on the specified script files.  The flags
+ * are -q for quiet (no heap validation), -V none|cheap|incremental|full to pick
+ * how much validate_heap_level checks after each request (default full),
+ * -N n to also run a full check every n requests, -p to only spot-check
+ * large payloads, -S to print allocator statistics after each script,
+ * -m n to write a heap map snapshot every n requests (see heapmap.h), -P
+ * to count cycles, cache misses etc. during each replay (see perf_counters.h),
+ * -H bytes to run the sampling heap profiler (see heapprof.h),
+ * -o name=value to set an allocator parameter with mymallopt (repeatable),
+ * -C bytes to allocate through relocatable handles, compacting up to
+ * that many bytes after each request (see handles.h), and -O bytes to
+ * compare an object pool of that size with mymalloc (see pool.h), -G bytes
+ * to start the heap in a segment that small and grow it a segment at a time
+ * (see segment.h), and -j n to replay the scripts in n worker processes at
+ * once (0 for one per CPU).
+ * It outputs statistics about the run of each script, such as the number of
+ * successful runs, number of failures, and average utilization.
  */
 int main(int argc, char *argv[]) {
     // Parse command line arguments
     char c;
-    bool quiet = false;
-    while ((c = getopt(argc, argv, "q")) != EOF) {
+    validate_level level = VALIDATE_FULL;
+    static const char *level_names[] = {"none", "cheap", "incremental", "full"};
+    while ((c = getopt(argc, argv, "qpSPV:N:m:H:o:C:O:G:j:")) != EOF) {
         if (c == 'q') {
-            quiet = true;
+            level = VALIDATE_NONE;
+        } else if (c == 'p') {
+            sample_payloads = true;
+        } else if (c == 'S') {
+            show_stats = true;
+        } else if (c == 'P') {
+            measure_perf = true;
+        } else if (c == 'V') {
+            int i = 0;
+            while (i <= VALIDATE_FULL && strcmp(optarg, level_names[i]) != 0) {
+                i++;
+            }
+            if (i > VALIDATE_FULL) {
+                error(1, 0, "Unknown validation level '%s' (expected none, cheap, "
+                    "incremental or full).", optarg);
+            }
+            level = i;
+        } else if (c == 'N') {
+            full_check_every = atol(optarg);
+        } else if (c == 'm') {
+            snapshot_every = atol(optarg);
+        } else if (c == 'H') {
+            profile_interval = strtoul(optarg, NULL, 10);
+        } else if (c == 'o') {
+            set_mallopt(optarg);
+        } else if (c == 'C') {
+            use_handles = true;
+            compact_budget = strtoul(optarg, NULL, 10);
+        } else if (c == 'O') {
+            pool_object_size = strtoul(optarg, NULL, 10);
+        } else if (c == 'G') {
+            grow_size = strtoul(optarg, NULL, 10);
+            mygrow_hook(grow_size > 0 ? grow_heap : NULL);
+        } else if (c == 'j') {
+            njobs = atoi(optarg);
+            if (njobs == 0) {
+                njobs = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+            if (njobs < 1) {
+                error(1, 0, "Invalid number of jobs '%s'.", optarg);
+            }
         }
     }
     if (optind >= argc) {
@@ -104,17 +257,51 @@ int main(int argc, char *argv[]) {
 
     // disable stdout buffering, all printfs display to terminal immediately
     setvbuf(stdout, NULL, _IONBF, 0);
-    
-    return test_scripts(argv + optind, argc - optind, quiet);
+    if (sample_payloads) {
+        printf("Spot-checking large payloads (%s kernel).\n", payload_kernel_name());
+    }
+
+    if (measure_perf && !perf_counters_open(&perf)) {
+        printf("Hardware counters are not available (%s), ignoring -P.\n",
+            strerror(perf.open_errno));
+        measure_perf = false;
+    }
+
+    if (njobs > 1 && argc - optind > 1) {
+        return test_parallel(argv + optind, argc - optind, level);
+    }
+    return test_scripts(argv + optind, argc - optind, level);
+}
+
+/* Function: set_mallopt
+ * ----------------------
+ * Applies one -o name=value setting, exiting if the name is unknown or the
+ * allocator rejects it.
+ */
+static void set_mallopt(const char *setting) {
+    const char *equals = strchr(setting, '=');
+    if (equals != NULL) {
+        for (size_t i = 0; i < sizeof(mallopt_names) / sizeof(mallopt_names[0]); i++) {
+            if (strlen(mallopt_names[i].name) == (size_t)(equals - setting) &&
+                strncmp(setting, mallopt_names[i].name, equals - setting) == 0) {
+                if (!mymallopt(mallopt_names[i].param, atol(equals + 1))) {
+                    error(1, 0, "This allocator does not accept -o %s.", setting);
+                }
+                return;
+            }
+        }
+    }
+    error(1, 0, "Unknown allocator option '%s' (expected quick_max=n, quick_limit=n, "
+        "realloc_growth=n, lifetime=n or free_order=n).", setting);
 }
 
 /* Function: test_scripts
  * ----------------------
- * Runs the scripts with names in the specified array, with more or less output
- * depending on the value of `quiet`.  Returns the number of failures during all
- * the tests.
+ * Runs the scripts with names in the specified array, validating the heap
+ * at the given level after each request.  Returns the number of failures
+ * during all the tests.
  */
-static int test_scripts(char *script_names[], int num_script_names, bool quiet) {
+static int test_scripts(char *script_names[], int num_script_names, validate_level level) {
     int nsuccesses = 0;
     int nfailures = 0;
 
@@ -122,33 +309,208 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
     int total_util = 0;
 
     for (int i = 0; i < num_script_names; i++) {
-        script_t script = parse_script(script_names[i]);
-
-        // Evaluate this script and record the results
-        printf("\nEvaluating allocator on %s...", script.name);
-        bool success;
-        size_t used_segment = eval_correctness(&script, quiet, &success);
-        if (success) {
-            printf("successfully serviced %d requests. (payload/segment = %zu/%zu)", 
-                script.num_ops, script.peak_size, used_segment);
-            if (used_segment > 0) {
-                total_util += (100 * script.peak_size) / used_segment;
-            }
+        int util;
+        if (run_script(script_names[i], level, &util)) {
+            total_util += util;
             nsuccesses++;
         } else {
             nfailures++;
         }
+    }
+
+    if (nsuccesses) {
+        printf("\nUtilization averaged %d%%\n", total_util / nsuccesses);
+    }
+    return nfailures;
+}
+
+/* Function: test_parallel
+ * -----------------------
+ * Like test_scripts, but forks njobs worker processes (no more than there
+ * are scripts), each with its own heap segment, which take scripts in turn
+ * until there are none left (see run_worker).  Once they have all exited,
+ * each script's output is printed in the original order, followed by the
+ * same summary, so the output reads exactly as if test_scripts had run.  A
+ * script whose worker died before finishing it counts as a failure.
+ */
+static int test_parallel(char *script_names[], int num_script_names, validate_level level) {
+    size_t shared_size = sizeof(shared_results) + num_script_names * sizeof(script_result);
+    shared_results *shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (shared == MAP_FAILED) {
+        error(1, 0, "Cannot map %zu bytes of results for the workers.", shared_size);
+    }
+
+    int nworkers = njobs < num_script_names ? njobs : num_script_names;
+    for (int i = 0; i < nworkers; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            error(1, 0, "Cannot fork worker %d.", i);
+        }
+        if (pid == 0) {
+            run_worker(script_names, num_script_names, level, shared);
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0) {}
 
-        free(script.ops);
-        free(script.blocks);
+    int nsuccesses = 0;
+    int nfailures = 0;
+    int total_util = 0;
+    for (int i = 0; i < num_script_names; i++) {
+        script_result *result = &shared->results[i];
+        if (!result->done) {
+            const char *name = strrchr(script_names[i], '/') ? strrchr(script_names[i], '/') + 1
+                                                             : script_names[i];
+            printf("\nEvaluating allocator on %s...", name);
+            printf("\nALLOCATOR FAILURE [%s]: worker process died during the script\n", name);
+            nfailures++;
+            continue;
+        }
+        fwrite(result->output, 1, result->output_len, stdout);
+        if (result->output_len == OUTPUT_MAX) {
+            printf("\n[output truncated at %d bytes]", OUTPUT_MAX);
+        }
+        if (result->success) {
+            total_util += result->util;
+            nsuccesses++;
+        } else {
+            nfailures++;
+        }
     }
 
     if (nsuccesses) {
         printf("\nUtilization averaged %d%%\n", total_util / nsuccesses);
     }
+    munmap(shared, shared_size);
     return nfailures;
 }
 
+/* Function: run_worker
+ * --------------------
+ * Body of a worker process: takes the next script nobody has taken yet
+ * and replays it with stdout going to the script's output buffer, until
+ * every script is taken.
+ * Hardware counters are reopened, since the parent's count the parent.
+ */
+static void run_worker(char *script_names[], int num_script_names, validate_level level,
+    shared_results *shared) {
+    if (measure_perf) {
+        perf_counters_close(&perf);
+        measure_perf = perf_counters_open(&perf);
+    }
+    FILE *terminal = stdout;
+    int i;
+    while ((i = __atomic_fetch_add(&shared->next_script, 1, __ATOMIC_RELAXED)) < num_script_names) {
+        script_result *result = &shared->results[i];
+        stdout = fmemopen(result->output, OUTPUT_MAX, "w");
+        if (stdout == NULL) {
+            error(1, 0, "Cannot open an output buffer for %s.", script_names[i]);
+        }
+        setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+        result->success = run_script(script_names[i], level, &result->util);
+        fflush(stdout);
+        result->output_len = ftell(stdout);
+        fclose(stdout);
+        stdout = terminal;
+        result->done = true;
+    }
+}
+
+/* Function: run_script
+ * --------------------
+ * Replays one script, validating the heap at the given level after each
+ * request, and prints its results.  Returns true and sets util to the
+ * utilization (in percent) if the allocator got through it.
+ */
+static bool run_script(char *script_name, validate_level level, int *util) {
+    script_t script = parse_script(script_name);
+
+    if (snapshot_every > 0) {
+        char path[sizeof(script.name) + 16];
+        snprintf(path, sizeof(path), "%s.heapmap", script.name);
+        if ((snapshot_file = fopen(path, "wb")) == NULL) {
+            error(1, 0, "Could not open heap map file \"%s\".", path);
+        }
+    }
+
+    // Evaluate this script and record the results
+    printf("\nEvaluating allocator on %s...", script.name);
+    bool success;
+    size_t used_segment = use_handles ? eval_handles(&script, level, &success)
+                                      : eval_correctness(&script, level, &success);
+    if (snapshot_file != NULL) {
+        if (fclose(snapshot_file) != 0) {
+            error(1, 0, "Error writing heap map for %s.", script.name);
+        }
+        snapshot_file = NULL;
+    }
+    if (success) {
+        printf("successfully serviced %d requests. (payload/segment = %zu/%zu)", 
+            script.num_ops, script.peak_size, used_segment);
+        *util = used_segment > 0 ? (100 * script.peak_size) / used_segment : 0;
+        if (use_handles) {
+            print_compaction();
+        }
+        if (measure_perf) {
+            print_perf_counters(&script);
+        }
+        if (profile_interval > 0) {
+            write_heap_profile(&script);
+        }
+        if (show_stats) {
+            print_heap_stats();
+        }
+        if (pool_object_size > 0) {
+            bench_pool(&script);
+        }
+    }
+
+    free_script(&script);
+    return success;
+}
+
+/* Function: init_heap
+ * --------------------
+ * Maps a fresh heap segment, discarding the old one and any added since,
+ * and calls myinit on it.  Returns what myinit returns.
+ */
+static bool init_heap(void) {
+    init_heap_segment(grow_size > 0 ? grow_size : HEAP_SIZE);
+    return myinit(heap_segment_start(), heap_segment_size());
+}
+
+/* Function: grow_heap
+ * -------------------
+ * The allocator's grow hook with -G: adds a segment a quarter the size of
+ * the heap so far, so that the 64 segments allowed reach a few GB, but no
+ * smaller than grow_size or min_size.
+ */
+static void *grow_heap(size_t min_size, size_t *size) {
+    *size = heap_segments_size() / 4;
+    if (*size < grow_size) {
+        *size = grow_size;
+    }
+    if (*size < min_size) {
+        *size = min_size;
+    }
+    return add_heap_segment(*size);
+}
+
+/* Function: heap_extent
+ * ---------------------
+ * Returns the bytes of heap a script used, given the end of the highest
+ * block seen.  With -G the segments need not be next to each other, so
+ * every byte of every segment counts instead: the heap only grows when
+ * the allocator has nowhere else to put a block.
+ */
+static size_t heap_extent(void *heap_end) {
+    if (grow_size > 0) {
+        return heap_segments_size();
+    }
+    return (char *)heap_end - (char *)heap_segment_start();
+}
+
 /* Function: eval_correctness
  * --------------------------
  * Check the allocator for correctness on given script. Interprets the
@@ -156,34 +518,44 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
  * errors (returning blocks outside the heap, unaligned, 
  * overlapping blocks, etc.)
  */
-static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
+static size_t eval_correctness(script_t *script, validate_level level, bool *success) {
     *success = false;
     
-    init_heap_segment(HEAP_SIZE);
-    if (!myinit(heap_segment_start(), heap_segment_size())) {
+    if (!init_heap()) {
         allocator_error(script, 0, "myinit() returned false");
         return -1;
     }
 
-    if (!quiet && !validate_heap()) {
+    if (level != VALIDATE_NONE && !validate_heap()) {
         allocator_error(script, 0, "validate_heap() after myinit returned false");
         return -1;
     }
 
+    if (profile_interval > 0) {
+        heapprof_start(profile_interval);
+    }
+
     // Track the topmost address used by the heap for utilization purposes
     void *heap_end = heap_segment_start();
 
+    index_reset(script);
+
     // Track the current amount of memory allocated on the heap
     size_t cur_size = 0;
 
     // Send each request to the heap allocator and check the resulting behavior
-    for (int req = 0; req < script->num_ops; req++) {
-        int id = script->ops[req].id;
-        size_t requested_size = script->ops[req].size;
+    script_cursor cursor = script_begin(script);
+    request_t request;
+    if (measure_perf) {
+        perf_counters_start(&perf);
+    }
+    while (script_next(script, &cursor, &request)) {
+        int id = request.id;
+        size_t requested_size = request.size;
 
-        if (script->ops[req].op == ALLOC) {
+        if (request.op == ALLOC) {
             bool fail = false;
-            void *p = eval_malloc(req, requested_size, script, &fail);
+            void *p = eval_malloc(&request, script, &fail);
             if (fail) {
                 return -1;
             }
@@ -192,10 +564,10 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
             if ((char *)p + requested_size > (char *)heap_end) {
                 heap_end = (char *)p + requested_size;
             }
-        } else if (script->ops[req].op == REALLOC) {
+        } else if (request.op == REALLOC) {
             size_t old_size = script->blocks[id].size;
             bool fail = false;
-            void *p = eval_realloc(req, requested_size, script, &fail);
+            void *p = eval_realloc(&request, script, &fail);
             if (fail) {
                 return -1;
             }
@@ -204,30 +576,43 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
             if ((char *)p + requested_size > (char *)heap_end) {
                 heap_end = (char *)p + requested_size;
             }
-        } else if (script->ops[req].op == FREE) {
+        } else if (request.op == FREE) {
             size_t old_size = script->blocks[id].size;
             void *p = script->blocks[id].ptr;
 
             // verify payload intact before free
             if (!verify_payload(p, old_size, id, script, 
-                script->ops[req].lineno, "freeing")) {
+                request.lineno, "freeing")) {
                 return -1;
             }
+            index_remove(script, id);
             script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
             myfree(p);
             cur_size -= old_size;
         }
 
         // check heap consistency after each request and stop if any error
-        if (!quiet && !validate_heap()) {
-            allocator_error(script, script->ops[req].lineno, 
-                "validate_heap() returned false, called in-between requests");
+        if (full_check_every > 0 && cursor.index % full_check_every == 0) {
+            if (!check_heap(script, VALIDATE_FULL, request.lineno)) {
+                return -1;
+            }
+        } else if (!check_heap(script, level, request.lineno)) {
             return -1;
         }
 
         if (cur_size > script->peak_size) {
             script->peak_size = cur_size;
         }
+
+        if (snapshot_file != NULL && cursor.index % snapshot_every == 0) {
+            take_snapshot(script, cursor.index);
+        }
+    }
+    if (measure_perf) {
+        perf_counters_stop(&perf);
+    }
+    if (snapshot_file != NULL && cursor.index % snapshot_every != 0) {
+        take_snapshot(script, cursor.index);
     }
 
     // verify payload is still intact for any block still allocated
@@ -239,27 +624,407 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
     }
 
     *success = true;
-    return (char *)heap_end - (char *)heap_segment_start();
+    return heap_extent(heap_end);
+}
+
+/* Function: eval_handles
+ * ------------------------
+ * The -C version of eval_correctness: every block is a relocatable handle
+ * block, payloads are checked through myhderef, and myhcompact runs after
+ * each request as if the program were idle between them.  Since blocks
+ * move, new blocks are not checked for overlaps here.  Reallocs become a
+ * new handle plus a copy.  At the end, the heap is compacted until nothing
+ * more moves, and the space that recovers at the end of the heap is
+ * reported along with the cost of a handle lookup.
+ */
+static size_t eval_handles(script_t *script, validate_level level, bool *success) {
+    *success = false;
+
+    if (!init_heap()) {
+        allocator_error(script, 0, "myinit() returned false");
+        return -1;
+    }
+    myhreset();
+    if (profile_interval > 0) {
+        heapprof_start(profile_interval);
+    }
+
+    memset(&compaction, 0, sizeof(compaction));
+    myhandle *handles = calloc(script->num_ids, sizeof(myhandle));
+    if (handles == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    void *heap_end = heap_segment_start();
+    size_t cur_size = 0;
+
+    script_cursor cursor = script_begin(script);
+    request_t request;
+    if (measure_perf) {
+        perf_counters_start(&perf);
+    }
+    while (script_next(script, &cursor, &request)) {
+        int id = request.id;
+        size_t size = request.size;
+        size_t old_size = script->blocks[id].size;
+
+        if (request.op == FREE || request.op == REALLOC) {
+            if (!verify_payload(myhderef(handles[id]), old_size, id, script,
+                request.lineno, request.op == FREE ? "freeing" : "pre-realloc-ing")) {
+                return -1;
+            }
+        }
+        if (request.op == ALLOC || request.op == REALLOC) {
+            myhandle h = myhalloc(size);
+            if (h == 0) {
+                allocator_error(script, request.lineno, "heap exhausted, myhalloc returned 0");
+                return -1;
+            }
+            char *p = myhderef(h);
+            if (((uintptr_t)p) % ALIGNMENT != 0) {
+                allocator_error(script, request.lineno, "New block (%p) not aligned to %d bytes",
+                    p, ALIGNMENT);
+                return -1;
+            }
+            if (request.op == REALLOC) {
+                memcpy(p, myhderef(handles[id]), old_size < size ? old_size : size);
+                myhfree(handles[id]);
+                cur_size -= old_size;
+            }
+            memset(p, id & 0xFF, size);
+            handles[id] = h;
+            script->blocks[id] = (block_t){.ptr = p, .size = size};  // ptr goes stale as blocks move
+            cur_size += size;
+            if (p + size > (char *)heap_end) {
+                heap_end = p + size;
+            }
+        } else if (request.op == FREE) {
+            myhfree(handles[id]);
+            handles[id] = 0;
+            script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+            cur_size -= old_size;
+        }
+
+        compaction.moved_running += myhcompact(compact_budget);
+
+        if (full_check_every > 0 && cursor.index % full_check_every == 0) {
+            if (!check_heap(script, VALIDATE_FULL, request.lineno)) {
+                return -1;
+            }
+        } else if (!check_heap(script, level, request.lineno)) {
+            return -1;
+        }
+        if (cur_size > script->peak_size) {
+            script->peak_size = cur_size;
+        }
+        if (snapshot_file != NULL && cursor.index % snapshot_every == 0) {
+            take_snapshot(script, cursor.index);
+        }
+    }
+    if (measure_perf) {
+        perf_counters_stop(&perf);
+    }
+    if (snapshot_file != NULL && cursor.index % snapshot_every != 0) {
+        take_snapshot(script, cursor.index);
+    }
+
+    // compact what is left as far as it will go
+    heap_stats stats;
+    mystats(&stats);
+    compaction.free_before = stats.free_blocks;
+    compaction.extent_before = handles_extent(script, handles);
+    size_t step;
+    while ((step = myhcompact(SIZE_MAX)) > 0) {
+        compaction.moved_final += step;
+    }
+    mystats(&stats);
+    compaction.free_after = stats.free_blocks;
+    compaction.extent_after = handles_extent(script, handles);
+    if (!check_heap(script, level, -1)) {
+        return -1;
+    }
+
+    for (int id = 0; id < script->num_ids; id++) {
+        if (handles[id] != 0 && !verify_payload(myhderef(handles[id]),
+            script->blocks[id].size, id, script, -1, "at exit")) {
+            return -1;
+        }
+    }
+    time_derefs(script, handles);
+    free(handles);
+
+    *success = true;
+    return heap_extent(heap_end);
+}
+
+/* Function: handles_extent
+ * ------------------------
+ * Returns the bytes from the start of the heap to the end of the highest
+ * live block.
+ */
+static size_t handles_extent(script_t *script, myhandle *handles) {
+    size_t extent = 0;
+    for (int id = 0; id < script->num_ids; id++) {
+        if (handles[id] != 0) {
+            size_t end = (char *)myhderef(handles[id]) + script->blocks[id].size
+                - (char *)heap_segment_start();
+            if (end > extent) {
+                extent = end;
+            }
+        }
+    }
+    return extent;
+}
+
+/* Function: time_derefs
+ * ---------------------
+ * Times DEREF_SAMPLES lookups of the live handles (reading the first byte
+ * of each block) against the same reads through plain pointers.
+ */
+static void time_derefs(script_t *script, myhandle *handles) {
+    int nlive = 0;
+    myhandle *live = malloc(script->num_ids * sizeof(myhandle) + 1);
+    char **pointers = malloc(script->num_ids * sizeof(char *) + 1);
+    if (live == NULL || pointers == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int id = 0; id < script->num_ids; id++) {
+        if (handles[id] != 0 && script->blocks[id].size > 0) {
+            live[nlive] = handles[id];
+            pointers[nlive++] = myhderef(handles[id]);
+        }
+    }
+    if (nlive > 0) {
+        volatile unsigned char sink = 0;
+        struct timespec start, middle, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (long i = 0; i < DEREF_SAMPLES; i++) {
+            sink += *(unsigned char *)myhderef(live[i % nlive]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &middle);
+        for (long i = 0; i < DEREF_SAMPLES; i++) {
+            sink += *pointers[i % nlive];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        compaction.handle_ns = ((middle.tv_sec - start.tv_sec) * 1e9 +
+            (middle.tv_nsec - start.tv_nsec)) / DEREF_SAMPLES;
+        compaction.pointer_ns = ((end.tv_sec - middle.tv_sec) * 1e9 +
+            (end.tv_nsec - middle.tv_nsec)) / DEREF_SAMPLES;
+    }
+    compaction.nlive = nlive;
+    free(live);
+    free(pointers);
+}
+
+/* Function: print_compaction
+ * --------------------------
+ * Prints what eval_handles found: bytes moved, the space recovered by the
+ * final compaction and the cost of going through a handle.
+ */
+static void print_compaction(void) {
+    printf("\n  compaction moved %zu bytes between requests and %zu at the end",
+        compaction.moved_running, compaction.moved_final);
+    printf("\n  live extent %zu -> %zu bytes (%zu recovered at the end of the heap), "
+        "free blocks %zu -> %zu", compaction.extent_before, compaction.extent_after,
+        compaction.extent_before - compaction.extent_after,
+        compaction.free_before, compaction.free_after);
+    if (compaction.nlive > 0) {
+        printf("\n  access through handle %.2f ns, through pointer %.2f ns (%d live blocks)",
+            compaction.handle_ns, compaction.pointer_ns, compaction.nlive);
+    }
+}
+
+/* Function: bench_pool
+ * --------------------
+ * Replays the script's allocs and frees with every block pool_object_size
+ * bytes (reallocs keep their block), POOL_ROUNDS times through a pool and
+ * POOL_ROUNDS times through mymalloc and myfree, each round on a fresh
+ * heap, and prints the time per request of each.  The time includes
+ * getting rid of the blocks still live at the end: one mypool_destroy,
+ * or a myfree for each of them.
+ */
+static void bench_pool(script_t *script) {
+    void **objs = calloc(script->num_ids, sizeof(void *));
+    if (objs == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    double pool_secs = 0, malloc_secs = 0;
+    for (int round = 0; round < POOL_ROUNDS; round++) {
+        mypool *pool = mypool_create(pool_object_size, 0);
+        if (pool == NULL) {
+            error(1, 0, "mypool_create() returned NULL.");
+        }
+        pool_secs += replay_fixed(script, objs, pool);
+        malloc_secs += replay_fixed(script, objs, NULL);
+    }
+    free(objs);
+    double nops = (double)script->num_ops * POOL_ROUNDS;
+    printf("\n  %zu-byte objects: pool %.2f ns/request, mymalloc %.2f ns/request",
+        pool_object_size, pool_secs * 1e9 / nops, malloc_secs * 1e9 / nops);
+}
+
+/* Function: replay_fixed
+ * ----------------------
+ * One bench_pool round on a fresh heap, through pool (which it destroys)
+ * or, if pool is NULL, through mymalloc and myfree.  The first byte of
+ * each block is written so that both touch the same memory.  Returns the
+ * seconds taken.
+ */
+static double replay_fixed(script_t *script, void **objs, mypool *pool) {
+    if (!init_heap()) {
+        error(1, 0, "myinit() returned false.");
+    }
+    memset(objs, 0, script->num_ids * sizeof(void *));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    script_cursor cursor = script_begin(script);
+    request_t request;
+    while (script_next(script, &cursor, &request)) {
+        int id = request.id;
+        if (request.op == ALLOC) {
+            objs[id] = pool != NULL ? mypool_alloc(pool) : mymalloc(pool_object_size);
+            if (objs[id] == NULL) {
+                error(1, 0, "Heap exhausted replaying %s with fixed-size blocks.", script->name);
+            }
+            *(char *)objs[id] = id;
+        } else if (request.op == FREE) {
+            if (pool != NULL) {
+                mypool_free(pool, objs[id]);
+            } else {
+                myfree(objs[id]);
+            }
+            objs[id] = NULL;
+        }
+    }
+    if (pool != NULL) {
+        mypool_destroy(pool);
+    } else {
+        for (int id = 0; id < script->num_ids; id++) {
+            myfree(objs[id]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+/* Function: check_heap
+ * --------------------
+ * Validates the heap at the given level between requests, raising an
+ * allocator error if the check fails.
+ */
+static bool check_heap(script_t *script, validate_level level, int lineno) {
+    if (level != VALIDATE_NONE && !validate_heap_level(level)) {
+        allocator_error(script, lineno,
+            "validate_heap() returned false, called in-between requests");
+        return false;
+    }
+    return true;
+}
+
+/* Function: print_heap_stats
+ * ---------------------------
+ * Prints the allocator's mystats counters for the script that just ran:
+ * heap totals, realloc behavior, average search length, any segments the
+ * heap grew by and the request counts for each size class that was used.
+ */
+static void print_heap_stats(void) {
+    heap_stats stats;
+    mystats(&stats);
+    printf("\n  in use %zu bytes, free %zu bytes in %zu blocks (largest %zu)",
+        stats.bytes_in_use, stats.bytes_free, stats.free_blocks, stats.largest_free);
+    printf("\n  realloc: %lu in place, %lu moved (%zu bytes copied)",
+        stats.realloc_in_place, stats.realloc_copied, stats.realloc_bytes_copied);
+    if (stats.slack_reclaimed > 0) {
+        printf(", %zu bytes of headroom reclaimed", stats.slack_reclaimed);
+    }
+    printf("\n  average search length %.2f over %lu searches",
+        stats.searches ? (double)stats.search_steps / stats.searches : 0.0, stats.searches);
+    if (stats.quick_hits > 0 || stats.quick_blocks > 0) {
+        printf("\n  quick lists: %lu hits, %lu flushes, %zu blocks held",
+            stats.quick_hits, stats.quick_flushes, stats.quick_blocks);
+    }
+    if (stats.nursery_allocs > 0) {
+        printf("\n  nursery: %lu requests, %lu chunks freed",
+            stats.nursery_allocs, stats.nursery_chunks_freed);
+    }
+    if (stats.segments_added > 0) {
+        printf("\n  heap grew by %lu segments", stats.segments_added);
+    }
+    printf("\n  %-22s %10s %10s", "size class", "allocs", "frees");
+    for (int i = 0; i < STATS_SIZE_CLASSES; i++) {
+        if (stats.allocs[i] == 0 && stats.frees[i] == 0) {
+            continue;
+        }
+        char range[32];
+        snprintf(range, sizeof(range), "%lu-%lu", i == 0 ? 0UL : 1UL << i, (2UL << i) - 1);
+        printf("\n  %-22s %10lu %10lu", range, stats.allocs[i], stats.frees[i]);
+    }
+}
+
+/* Function: take_snapshot
+ * ------------------------
+ * Appends a heap map of the current heap, tagged with the number of
+ * requests run so far, to this script's snapshot file.
+ */
+static void take_snapshot(script_t *script, unsigned long tag) {
+    if (!mysnapshot(snapshot_file, tag)) {
+        error(1, 0, "Error writing heap map for %s.", script->name);
+    }
+}
+
+/* Function: print_perf_counters
+ * ------------------------------
+ * Prints each hardware counter's total for the replay loop that just ran
+ * and its average per request, or n/a if that counter is unavailable.
+ * The loop includes the harness's own checks, so use -q and -p to keep
+ * them from dominating.
+ */
+static void print_perf_counters(script_t *script) {
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        uint64_t value;
+        if (perf_counters_read(&perf, i, &value)) {
+            printf("\n  %-14s %14lu  %10.2f/op", perf_counter_name(i), (unsigned long)value,
+                script->num_ops ? (double)value / script->num_ops : 0.0);
+        } else {
+            printf("\n  %-14s %14s", perf_counter_name(i), "n/a");
+        }
+    }
+}
+
+/* Function: write_heap_profile
+ * -----------------------------
+ * Stops the heap profiler and writes the profile for the script that just
+ * ran, which covers the blocks still allocated at the end of the script
+ * and every block sampled along the way.
+ */
+static void write_heap_profile(script_t *script) {
+    heapprof_stop();
+    char path[sizeof(script->name) + 16];
+    snprintf(path, sizeof(path), "%s.heapprof", script->name);
+    FILE *out = fopen(path, "w");
+    if (out == NULL || !heapprof_dump(out) || fclose(out) != 0) {
+        error(1, 0, "Error writing heap profile \"%s\".", path);
+    }
 }
 
 /* Function: eval_malloc
  * ---------------------
- * Performs a test of a call to mymalloc of the given size.  The req number
- * specifies the operation's index within the script.  This function verifies
+ * Performs a test of a call to mymalloc for the given alloc request from
+ * the script.  This function verifies
  * the entire malloc'ed block and fills in the payload with a low-order byte
  * of the request id.  If the request fails, the boolean pointed to by
  * failptr is set to true - otherwise, it is set to false.  If it is set to
  * true this function returns NULL; otherwise, it returns what was returned
  * by mymalloc.
  */
-static void *eval_malloc(int req, size_t requested_size, script_t *script, 
+static void *eval_malloc(const request_t *request, script_t *script, 
     bool *failptr) {
 
-    int id = script->ops[req].id;
+    int id = request->id;
+    size_t requested_size = request->size;
 
     void *p;
     if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
-        allocator_error(script, script->ops[req].lineno, 
+        allocator_error(script, request->lineno, 
             "heap exhausted, malloc returned NULL");
         *failptr = true;
         return NULL;
@@ -268,7 +1033,7 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
     /* Test new block for correctness: must be properly aligned
      * and must not overlap any currently allocated block.
      */
-    if (!verify_block(p, requested_size, script, script->ops[req].lineno)) {
+    if (!verify_block(p, requested_size, script, request->lineno)) {
         *failptr = true;
         return NULL;
     }
@@ -278,50 +1043,53 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
      */
     memset(p, id & 0xFF, requested_size);
     script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+    index_insert(script, id);
     *failptr = false;
     return p;
 }
 
 /* Function: eval_realloc
  * ---------------------
- * Performs a test of a call to myrealloc of the given size.  The req number
- * specifies the operation's index within the script.  This function verifies
+ * Performs a test of a call to myrealloc for the given realloc request from
+ * the script.  This function verifies
  * the entire realloc'ed block and fills in the payload with a low-order byte
  * of the request id.  If the request fails, the boolean pointed to by
  * failptr is set to true - otherwise, it is set to false.  If it is set to true
  * this function returns NULL; otherwise, it returns what was returned by
  * myrealloc.
  */
-static void *eval_realloc(int req, size_t requested_size, script_t *script, 
+static void *eval_realloc(const request_t *request, script_t *script, 
     bool *failptr) {
 
-    int id = script->ops[req].id;
+    int id = request->id;
+    size_t requested_size = request->size;
     size_t old_size = script->blocks[id].size;
 
     void *oldp = script->blocks[id].ptr;
     if (!verify_payload(oldp, old_size, id, script, 
-        script->ops[req].lineno, "pre-realloc-ing")) {
+        request->lineno, "pre-realloc-ing")) {
         *failptr = true;
         return NULL;
     }
 
     void *newp;
     if ((newp = myrealloc(oldp, requested_size)) == NULL && requested_size != 0) {
-        allocator_error(script, script->ops[req].lineno, 
+        allocator_error(script, request->lineno, 
             "heap exhausted, realloc returned NULL");
         *failptr = true;
         return NULL;
     }
 
+    index_remove(script, id);
     script->blocks[id].size = 0;
-    if (!verify_block(newp, requested_size, script, script->ops[req].lineno)) {
+    if (!verify_block(newp, requested_size, script, request->lineno)) {
         *failptr = true;
         return NULL;
     }
 
     // Verify new block contains the data from the old block
     if (!verify_payload(newp, (old_size < requested_size ? old_size : requested_size), 
-        id, script, script->ops[req].lineno, "post-realloc-ing (preserving data)")) {
+        id, script, request->lineno, "post-realloc-ing (preserving data)")) {
         *failptr = true;
         return NULL;
     }
@@ -329,6 +1097,7 @@ static void *eval_realloc(int req, size_t requested_size, script_t *script,
     // Fill new block with the low-order byte of new id
     memset(newp, id & 0xFF, requested_size);
     script->blocks[id] = (block_t){.ptr = newp, .size = requested_size};
+    index_insert(script, id);
 
     *failptr = false;
     return newp;
@@ -356,29 +1125,25 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
         return true;
     }
 
-    // block must lie within the extent of the heap
+    // block must lie within one of the heap's segments
     void *end = (char *)ptr + size;
-    void *heap_end = (char *)heap_segment_start() + heap_segment_size();
-    if (ptr < heap_segment_start() || end > heap_end) {
+    void *segment = heap_segment_start();
+    size_t segment_size = heap_segment_size();
+    if (!heap_segment_find(ptr, &segment, &segment_size) ||
+        end > (void *)((char *)segment + segment_size)) {
         allocator_error(script, lineno, "New block (%p:%p) not within heap segment (%p:%p)",
-                        ptr, end, heap_segment_start(), heap_end);
+                        ptr, end, segment, (char *)segment + segment_size);
         return false;
     }
 
     // block must not overlap any other blocks
-    for (int i = 0; i < script->num_ids; i++) {
-        if (script->blocks[i].ptr == NULL || script->blocks[i].size == 0) {
-            continue;
-        }
-
-        void *other_start = script->blocks[i].ptr;
-        void *other_end = (char *)other_start + script->blocks[i].size;
-        if ((ptr >= other_start && ptr < other_end) || (end > other_start && end < other_end) ||
-            (ptr < other_start && end >= other_end)) {
-            allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
-                            ptr, end, other_start, other_end);
-            return false;
-        }
+    int other = index_find_overlap(script, ptr, end);
+    if (other >= 0) {
+        void *other_start = script->blocks[other].ptr;
+        void *other_end = (char *)other_start + script->blocks[other].size;
+        allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
+                        ptr, end, other_start, other_end);
+        return false;
     }
 
     return true;
@@ -388,161 +1153,147 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno) {
  * ------------------------
  * When a block is allocated, the payload is filled with a simple repeating
  * pattern based on its id.  Check the payload to verify those contents are
- * still intact, otherwise raise allocator error.
+ * still intact, otherwise raise allocator error.  With -p, large payloads
+ * are only spot-checked.
  */
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, 
     int lineno, char *op) {
 
-    for (size_t i = 0; i < size; i++) {
-        if (*((unsigned char *)ptr + i) != (id & 0xFF)) {
-            allocator_error(script, lineno, 
-                "invalid payload data detected when %s address %p", op, ptr);
-            return false;
-        }
+    bool intact = sample_payloads ? payload_matches_sampled(ptr, size, id & 0xFF)
+                                  : payload_matches(ptr, size, id & 0xFF);
+    if (!intact) {
+        allocator_error(script, lineno, 
+            "invalid payload data detected when %s address %p", op, ptr);
+        return false;
     }
     return true;
 }
 
-/* Function: allocator_error
- * ------------------------
- * Report an error while running an allocator script.  Prints out the script
- * name and line number where the error occured, and the specified format
- * string, including any additional arguments as part of that format string.
- */
-static void allocator_error(script_t *script, int lineno, char* format, ...) {
-    va_list args;
-    fprintf(stdout, "\nALLOCATOR FAILURE [%s, line %d]: ", 
-        script->name, lineno);
-    va_start(args, format);
-    vfprintf(stdout, format, args);
-    va_end(args);
-    fprintf(stdout,"\n");
-}
-
-
-/* SCRIPT PARSING IMPLEMENTATION */
+/* LIVE BLOCK INDEX IMPLEMENTATION */
 
 
-/* Fuction: parse_script
+/* Function: index_reset
  * ---------------------
- * This function parses the script file at the specified path, and returns an
- * object with info about it.  It expects one request per line, and adds each
- * request's information to the ops array within the script.  This function
- * throws an error if the file can't be opened, if a line is malformed, or if
- * the file is too long to store each request on the heap.
- */
-static script_t parse_script(const char *path) {
-    FILE *fp = fopen(path, "r");
-    if (fp == NULL) {
-        error(1, 0, "Could not open script file \"%s\".", path);
-    }
-
-    // Initialize a script object to store the information about this script
-    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
-    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
-    strncpy(script.name, basename, sizeof(script.name) - 1);
-    script.name[sizeof(script.name) - 1] = '\0';
-
-    int lineno = 0;
-    int nallocated = 0;
-    int maxid = 0;
-    char buffer[MAX_SCRIPT_LINE_LEN];
-
-    for (int i = 0; read_line(buffer, sizeof(buffer), fp, &lineno); i++) {
-
-        // Resize script->ops if we need more space for lines
-        if (i == nallocated) {
-            nallocated += OPS_RESIZE_AMOUNT;
-            void *new_memory = realloc(script.ops, 
-                nallocated * sizeof(request_t));
-            if (!new_memory) {
-                free(script.ops);
-                error(1, 0, "Libc heap exhausted. Cannot continue.");
-            }
-            script.ops = new_memory;
-        }
-
-        script.ops[i] = parse_script_line(buffer, lineno, script.name);
-
-        if (script.ops[i].id > maxid) {
-            maxid = script.ops[i].id;
-        }
-
-        script.num_ops = i + 1;
-    }
-
-    fclose(fp);
-    script.num_ids = maxid + 1;
-
-    script.blocks = calloc(script.num_ids, sizeof(block_t));
-    if (!script.blocks) {
+ * Empties the index and sizes its node array for this script's block ids.
+ * Priorities come from a multiplicative hash of the id, so runs are
+ * deterministic.
+ */
+static void index_reset(script_t *script) {
+    free(index_nodes);
+    index_nodes = malloc(script->num_ids * sizeof(index_node));
+    if (!index_nodes) {
         error(1, 0, "Libc heap exhausted. Cannot continue.");
     }
-
-    return script;
+    for (int id = 0; id < script->num_ids; id++) {
+        index_nodes[id] = (index_node){ .left = -1, .right = -1,
+            .priority = (unsigned)id * 2654435761u };
+    }
+    index_root = -1;
 }
 
-/* Function: read_line
- * --------------------
- * This function reads one line from the specified file and stores at most
- * buffer_size characters from it in buffer, removing any trailing newline.
- * It skips lines that are all-whitespace or that contain comments (begin with
- * # as first non-whitespace character).  When reading a line, it increments the
- * counter pointed to by `pnread` once for each line read/skipped. This function
- * returns true if did read a valid line eventually, or false otherwise.
+/* Function: index_insert
+ * ----------------------
+ * Adds block id to the index, keyed by its current address.  Empty blocks
+ * can't overlap anything and are left out.
  */
-static bool read_line(char buffer[], size_t buffer_size, FILE *fp, 
-    int *pnread) {
-
-    while (true) {
-        if (fgets(buffer, buffer_size, fp) == NULL) {
-            return false;
-        }
-
-        (*pnread)++;
+static void index_insert(script_t *script, int id) {
+    if (script->blocks[id].ptr == NULL || script->blocks[id].size == 0) {
+        return;
+    }
+    int left, right;
+    index_split(script, index_root, (uintptr_t)script->blocks[id].ptr, &left, &right);
+    index_nodes[id].left = index_nodes[id].right = -1;
+    index_root = index_merge(index_merge(left, id), right);
+}
 
-        // remove any trailing newline
-        if (buffer[strlen(buffer)-1] == '\n') {
-            buffer[strlen(buffer)-1] ='\0'; 
-        }
+/* Function: index_remove
+ * ----------------------
+ * Removes block id from the index.  Must be called while
+ * script->blocks[id] still holds the address it was inserted with.
+ */
+static void index_remove(script_t *script, int id) {
+    if (script->blocks[id].ptr == NULL || script->blocks[id].size == 0) {
+        return;
+    }
+    uintptr_t key = (uintptr_t)script->blocks[id].ptr;
+    int left, middle, right;
+    index_split(script, index_root, key, &left, &right);
+    index_split(script, right, key + 1, &middle, &right);
+    index_root = index_merge(left, right);
+}
 
-        /* Stop only if this line is not a comment line (comment lines start
-         * with # as first non-whitespace character)
-         */
-        char ch;
-        if (sscanf(buffer, " %c", &ch) == 1 && ch != '#') {
-            return true;
+/* Function: index_find_overlap
+ * ----------------------------
+ * Returns the id of a live block overlapping [ptr, end), or -1 if none.
+ * Live blocks never overlap each other, so only the last block starting
+ * at or before ptr and the first block starting after it need checking.
+ */
+static int index_find_overlap(script_t *script, void *ptr, void *end) {
+    int pred = -1, succ = -1;
+    for (int t = index_root; t >= 0; ) {
+        if ((char *)script->blocks[t].ptr <= (char *)ptr) {
+            pred = t;
+            t = index_nodes[t].right;
+        } else {
+            succ = t;
+            t = index_nodes[t].left;
         }
     }
+    if (pred >= 0 && (char *)script->blocks[pred].ptr + script->blocks[pred].size > (char *)ptr) {
+        return pred;
+    }
+    if (succ >= 0 && (char *)script->blocks[succ].ptr < (char *)end) {
+        return succ;
+    }
+    return -1;
 }
 
-/* Function: parse_script_line
- * ---------------------------
- * This function parses the provided line from the script and returns info
- * about it as a request_t object filled in with the type of the request,
- * the size, the ID, and the line number.  If the line is malformed, this
- * function throws an error.
+/* Function: index_split
+ * ---------------------
+ * Splits the subtree rooted at t into the nodes with address < key (left)
+ * and those with address >= key (right).
  */
-static request_t parse_script_line(char *buffer, int lineno, 
-    char *script_name) {
-
-    request_t request = { .lineno = lineno, .op = 0, .size = 0};
-
-    char request_char;
-    int nscanned = sscanf(buffer, " %c %d %zu", &request_char, 
-        &request.id, &request.size);
-    if (request_char == 'a' && nscanned == 3) {
-        request.op = ALLOC;
-    } else if (request_char == 'r' && nscanned == 3) {
-        request.op = REALLOC;
-    } else if (request_char == 'f' && nscanned == 2) {
-        request.op = FREE;
+static void index_split(script_t *script, int t, uintptr_t key, int *left, int *right) {
+    if (t < 0) {
+        *left = *right = -1;
+    } else if ((uintptr_t)script->blocks[t].ptr < key) {
+        index_split(script, index_nodes[t].right, key, &index_nodes[t].right, right);
+        *left = t;
+    } else {
+        index_split(script, index_nodes[t].left, key, left, &index_nodes[t].left);
+        *right = t;
     }
+}
 
-    if (!request.op || request.id < 0 || request.size > MAX_REQUEST_SIZE) {
-        error(1, 0, "Line %d of script file '%s' is malformed.", 
-            lineno, script_name);
+/* Function: index_merge
+ * ---------------------
+ * Joins two subtrees where every address in left is below every address
+ * in right, and returns the new root.
+ */
+static int index_merge(int left, int right) {
+    if (left < 0 || right < 0) {
+        return left < 0 ? right : left;
     }
+    if (index_nodes[left].priority > index_nodes[right].priority) {
+        index_nodes[left].right = index_merge(index_nodes[left].right, right);
+        return left;
+    }
+    index_nodes[right].left = index_merge(left, index_nodes[right].left);
+    return right;
+}
 
-    return request;
+/* Function: allocator_error
+ * ------------------------
+ * Report an error while running an allocator script.  Prints out the script
+ * name and line number where the error occured, and the specified format
+ * string, including any additional arguments as part of that format string.
+ */
+static void allocator_error(script_t *script, int lineno, char* format, ...) {
+    va_list args;
+    fprintf(stdout, "\nALLOCATOR FAILURE [%s, line %d]: ", 
+        script->name, lineno);
+    va_start(args, format);
+    vfprintf(stdout, format, args);
+    va_end(args);
+    fprintf(stdout,"\n");
 }
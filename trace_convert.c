@@ -0,0 +1,402 @@
+/*
+ * File: trace_convert.c
+ * ---------------------
+ * Converts allocator scripts between the text format in samples/ and the
+ * compact binary trace format described in script.h.  The input may be in
+ * either format (parse_script recognizes binary traces by their header);
+ * the output is binary unless -t is given.  With -r, the input is instead
+ * a raw event file written by the LD_PRELOAD recorder (alloc_recorder.c):
+ * events are sorted by time and each live address is mapped to a script
+ * block id, and the resulting binary trace keeps each request's thread id
+ * and timestamp.
+ *
+ *   ./trace_convert samples/trace-firefox.script firefox.trace
+ *   ./trace_convert -t firefox.trace firefox.script
+ *   ./trace_convert -r server.raw server.trace
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "alloc_record.h"
+#include "script.h"
+
+
+// open-addressing hash table from live block address to block id
+typedef struct {
+    uint64_t *keys;     // 0 marks an empty slot
+    int *ids;
+    size_t capacity;    // always a power of two
+    size_t count;
+} address_map;
+
+// running state while converting raw events to requests
+typedef struct {
+    address_map live;
+    address_map moving; // thread id to the block its realloc is moving
+    bool split_reallocs;  // an 'm' was seen, so every realloc has one
+    int *free_ids;      // stack of freed ids, reused before new ones
+    int nfree_ids;
+    int free_ids_capacity;
+    int next_id;
+    request_t *ops;
+    int num_ops;
+    int nallocated;
+    uint64_t start_time;
+    long skipped;       // frees/reallocs of unknown or oversized blocks
+    long collisions;    // addresses handed out while still live
+} raw_converter;
+
+
+static bool write_text_script(const script_t *script, FILE *fp);
+static script_t script_from_raw(const char *path);
+static int compare_events(const void *a, const void *b);
+static void convert_event(raw_converter *conv, const raw_event *event);
+static int take_id(raw_converter *conv, const raw_event *event);
+static void release_id(raw_converter *conv, uint64_t ptr, int id);
+static void emit(raw_converter *conv, enum request_type op, int id, size_t size, const raw_event *event);
+static size_t map_slot(const address_map *map, uint64_t key);
+static int map_get(const address_map *map, uint64_t key);
+static void map_put(address_map *map, uint64_t key, int id);
+static void map_remove(address_map *map, uint64_t key);
+static void map_init(address_map *map, size_t capacity);
+
+
+int main(int argc, char *argv[]) {
+    bool text_output = false;
+    bool raw_input = false;
+    int c;
+    while ((c = getopt(argc, argv, "tr")) != EOF) {
+        if (c == 't') {
+            text_output = true;
+        } else if (c == 'r') {
+            raw_input = true;
+        } else {
+            error(1, 0, "Usage: %s [-t] [-r] input-script output-script", argv[0]);
+        }
+    }
+    if (argc - optind != 2) {
+        error(1, 0, "Usage: %s [-t] [-r] input-script output-script", argv[0]);
+    }
+
+    script_t script = raw_input ? script_from_raw(argv[optind]) : parse_script(argv[optind]);
+    FILE *fp = fopen(argv[optind + 1], "w");
+    if (fp == NULL) {
+        error(1, 0, "Could not open output file \"%s\".", argv[optind + 1]);
+    }
+
+    bool ok = text_output ? write_text_script(&script, fp) : write_binary_script(&script, fp);
+    if (fclose(fp) != 0 || !ok) {
+        error(1, 0, "Error writing \"%s\".", argv[optind + 1]);
+    }
+    printf("Converted %d requests (%d block ids) from %s\n",
+        script.num_ops, script.num_ids, script.name);
+    free_script(&script);
+    return 0;
+}
+
+/* Function: write_text_script
+ * ---------------------------
+ * Writes every request of the script in the text script format.
+ */
+static bool write_text_script(const script_t *script, FILE *fp) {
+    fprintf(fp, "# Converted from %s by trace_convert\n", script->name);
+    script_cursor cursor = script_begin(script);
+    request_t request;
+    while (script_next(script, &cursor, &request)) {
+        if (request.op == FREE) {
+            fprintf(fp, "f %d\n", request.id);
+        } else {
+            fprintf(fp, "%c %d %zu\n", request.op == ALLOC ? 'a' : 'r', request.id, request.size);
+        }
+    }
+    return !ferror(fp);
+}
+
+
+/* RAW RECORDING CONVERSION */
+
+
+/* Function: script_from_raw
+ * -------------------------
+ * Reads a raw event file from the recorder and builds a timed script from
+ * it.  Events are sorted by timestamp (frees first on ties), then every
+ * allocation is given the most recently freed block id (or a new one),
+ * and frees and reallocs
+ * are matched to ids through the table of live addresses.  A realloc's
+ * block leaves that table at its 'm' event and comes back, at its new
+ * address, at the thread's next 'r'.  Calls on
+ * addresses the recorder never saw allocated (e.g. from before it was
+ * loaded) are skipped.
+ */
+static script_t script_from_raw(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char magic[8];
+    if (fp == NULL || fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+        memcmp(magic, RAW_MAGIC, sizeof(magic)) != 0) {
+        error(1, 0, "Could not read raw recording \"%s\".", path);
+    }
+
+    size_t nevents = 0, capacity = 1 << 16;
+    raw_event *events = malloc(capacity * sizeof(raw_event));
+    while (events != NULL) {
+        nevents += fread(events + nevents, sizeof(raw_event), capacity - nevents, fp);
+        if (nevents < capacity) {
+            break;
+        }
+        capacity *= 2;
+        events = realloc(events, capacity * sizeof(raw_event));
+    }
+    if (events == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    fclose(fp);
+    qsort(events, nevents, sizeof(raw_event), compare_events);
+
+    raw_converter conv = { .start_time = nevents > 0 ? events[0].time_ns : 0 };
+    map_init(&conv.live, 1024);
+    map_init(&conv.moving, 64);
+    for (size_t i = 0; i < nevents; i++) {
+        convert_event(&conv, &events[i]);
+    }
+    printf("Recording had %zu events: %ld skipped (unknown block or oversized), "
+        "%ld reused while live\n", nevents, conv.skipped, conv.collisions);
+
+    script_t script = { .ops = conv.ops, .blocks = NULL, .num_ops = conv.num_ops,
+        .num_ids = conv.next_id > 0 ? conv.next_id : 1, .peak_size = 0,
+        .trace = NULL, .mapping = NULL, .timed = true };
+    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    strncpy(script.name, basename, sizeof(script.name) - 1);
+    script.name[sizeof(script.name) - 1] = '\0';
+
+    free(events);
+    free(conv.live.keys);
+    free(conv.live.ids);
+    free(conv.moving.keys);
+    free(conv.moving.ids);
+    free(conv.free_ids);
+    return script;
+}
+
+/* Function: compare_events
+ * ------------------------
+ * qsort comparator ordering events by time, with frees (and the 'm'
+ * halves of reallocs) before allocations stamped in the same nanosecond.
+ */
+static int compare_events(const void *a, const void *b) {
+    const raw_event *x = a, *y = b;
+    if (x->time_ns != y->time_ns) {
+        return x->time_ns < y->time_ns ? -1 : 1;
+    }
+    bool x_frees = x->op == 'f' || x->op == 'm';
+    bool y_frees = y->op == 'f' || y->op == 'm';
+    return !x_frees - !y_frees;
+}
+
+/* Function: convert_event
+ * -----------------------
+ * Turns one recorded call into zero or more script requests.
+ */
+static void convert_event(raw_converter *conv, const raw_event *event) {
+    if (event->size > MAX_REQUEST_SIZE && event->op != 'r') {
+        conv->skipped++;
+        return;
+    }
+    if (event->op == 'a') {
+        emit(conv, ALLOC, take_id(conv, event), event->size, event);
+    } else if (event->op == 'f') {
+        int id = map_get(&conv->live, event->ptr);
+        if (id < 0) {
+            conv->skipped++;
+            return;
+        }
+        release_id(conv, event->ptr, id);
+        emit(conv, FREE, id, 0, event);
+    } else if (event->op == 'm') {
+        // old_ptr is about to be released by a realloc
+        int id = map_get(&conv->live, event->old_ptr);
+        conv->split_reallocs = true;
+        if (id >= 0) {
+            map_remove(&conv->live, event->old_ptr);
+            map_put(&conv->moving, event->tid, id);
+        }
+    } else if (event->op == 'r') {
+        int id = map_get(&conv->moving, event->tid);
+        if (id >= 0) {
+            map_remove(&conv->moving, event->tid);
+        } else if (!conv->split_reallocs && event->old_ptr != 0 &&
+                   (id = map_get(&conv->live, event->old_ptr)) >= 0) {
+            // recorded in one event (by an older recorder)
+            map_remove(&conv->live, event->old_ptr);
+        }
+        if ((id < 0 && event->old_ptr != 0) || event->size > MAX_REQUEST_SIZE) {
+            conv->skipped++;
+        }
+        if (id < 0) {
+            // realloc(NULL, n) or of a block we never saw: a fresh allocation
+            if (event->ptr != 0 && event->size <= MAX_REQUEST_SIZE) {
+                emit(conv, ALLOC, take_id(conv, event), event->size, event);
+            }
+        } else if (event->ptr == 0 && event->size != 0) {
+            // the realloc failed, so the block never moved
+            map_put(&conv->live, event->old_ptr, id);
+        } else if (event->ptr == 0 || event->size > MAX_REQUEST_SIZE) {
+            // realloc(p, 0) freed the block, or it grew out of the script
+            release_id(conv, 0, id);
+            emit(conv, FREE, id, 0, event);
+        } else {
+            int other = map_get(&conv->live, event->ptr);
+            if (other >= 0) {
+                conv->collisions++;
+                release_id(conv, event->ptr, other);
+                emit(conv, FREE, other, 0, event);
+            }
+            map_put(&conv->live, event->ptr, id);
+            emit(conv, REALLOC, id, event->size, event);
+        }
+    }
+}
+
+/* Function: take_id
+ * -----------------
+ * Assigns a block id to the address returned by an allocation event.  If
+ * the address is still live (the recording raced with another thread),
+ * the old block is freed first so the script stays consistent.
+ */
+static int take_id(raw_converter *conv, const raw_event *event) {
+    int other = map_get(&conv->live, event->ptr);
+    if (other >= 0) {
+        conv->collisions++;
+        release_id(conv, event->ptr, other);
+        emit(conv, FREE, other, 0, event);
+    }
+    int id = conv->nfree_ids > 0 ? conv->free_ids[--conv->nfree_ids] : conv->next_id++;
+    map_put(&conv->live, event->ptr, id);
+    return id;
+}
+
+/* Function: release_id
+ * --------------------
+ * Forgets a live address (0 for an id no longer in the table) and
+ * makes its id available for reuse.
+ */
+static void release_id(raw_converter *conv, uint64_t ptr, int id) {
+    if (ptr != 0) {
+        map_remove(&conv->live, ptr);
+    }
+    if (conv->nfree_ids == conv->free_ids_capacity) {
+        conv->free_ids_capacity = conv->free_ids_capacity ? 2 * conv->free_ids_capacity : 1024;
+        conv->free_ids = realloc(conv->free_ids, conv->free_ids_capacity * sizeof(int));
+        if (!conv->free_ids) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+    }
+    conv->free_ids[conv->nfree_ids++] = id;
+}
+
+/* Function: emit
+ * --------------
+ * Appends a request, stamped with the event's thread and its time
+ * relative to the first event.
+ */
+static void emit(raw_converter *conv, enum request_type op, int id, size_t size,
+    const raw_event *event) {
+
+    if (conv->num_ops == conv->nallocated) {
+        conv->nallocated = conv->nallocated ? 2 * conv->nallocated : 1024;
+        conv->ops = realloc(conv->ops, conv->nallocated * sizeof(request_t));
+        if (!conv->ops) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+    }
+    int index = conv->num_ops++;
+    conv->ops[index] = (request_t){ .op = op, .id = id, .size = size, .lineno = index + 1,
+        .tid = event->tid, .time_ns = event->time_ns - conv->start_time };
+}
+
+/* Function: map_init
+ * ------------------
+ * Sets up an empty table with room for capacity (a power of two) slots.
+ */
+static void map_init(address_map *map, size_t capacity) {
+    *map = (address_map){ .capacity = capacity, .count = 0 };
+    map->keys = calloc(capacity, sizeof(uint64_t));
+    map->ids = malloc(capacity * sizeof(int));
+    if (!map->keys || !map->ids) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+}
+
+static size_t map_slot(const address_map *map, uint64_t key) {
+    size_t slot = (key * 0x9e3779b97f4a7c15ULL) >> 20;
+    while (true) {
+        slot &= map->capacity - 1;
+        if (map->keys[slot] == key || map->keys[slot] == 0) {
+            return slot;
+        }
+        slot++;
+    }
+}
+
+static int map_get(const address_map *map, uint64_t key) {
+    size_t slot = map_slot(map, key);
+    return map->keys[slot] == key ? map->ids[slot] : -1;
+}
+
+/* Function: map_put
+ * -----------------
+ * Inserts or updates a key, doubling the table when it gets half full.
+ */
+static void map_put(address_map *map, uint64_t key, int id) {
+    if (2 * (map->count + 1) > map->capacity) {
+        address_map bigger = { .capacity = 2 * map->capacity, .count = 0 };
+        bigger.keys = calloc(bigger.capacity, sizeof(uint64_t));
+        bigger.ids = malloc(bigger.capacity * sizeof(int));
+        if (!bigger.keys || !bigger.ids) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (map->keys[i] != 0) {
+                map_put(&bigger, map->keys[i], map->ids[i]);
+            }
+        }
+        free(map->keys);
+        free(map->ids);
+        *map = bigger;
+    }
+    size_t slot = map_slot(map, key);
+    if (map->keys[slot] == 0) {
+        map->count++;
+    }
+    map->keys[slot] = key;
+    map->ids[slot] = id;
+}
+
+/* Function: map_remove
+ * --------------------
+ * Removes a key using backward-shift deletion, so no tombstones are
+ * needed: later entries of the probe run are moved up into the hole.
+ */
+static void map_remove(address_map *map, uint64_t key) {
+    size_t hole = map_slot(map, key);
+    if (map->keys[hole] != key) {
+        return;
+    }
+    map->keys[hole] = 0;
+    map->count--;
+    size_t mask = map->capacity - 1;
+    for (size_t slot = (hole + 1) & mask; map->keys[slot] != 0; slot = (slot + 1) & mask) {
+        size_t home = ((map->keys[slot] * 0x9e3779b97f4a7c15ULL) >> 20) & mask;
+        // move the entry if the hole lies cyclically between its home and its slot
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            map->keys[hole] = map->keys[slot];
+            map->ids[hole] = map->ids[slot];
+            map->keys[slot] = 0;
+            hole = slot;
+        }
+    }
+}